@@ -7,30 +7,63 @@ from UM.Math.Matrix import Matrix
 from UM.Math.Vector import Vector
 from UM.Qt.Bindings.MainWindow import MainWindow
 from UM.Qt.QtApplication import QtApplication
+from UM.Scene.Iterator.BreadthFirstIterator import BreadthFirstIterator
 from UM.Scene.Selection import Selection
 from UM.Extension import Extension
 from UM.i18n import i18nCatalog
 
 from PyQt6 import QtCore
-from PyQt6.QtCore import QAbstractNativeEventFilter, Qt
+from PyQt6.QtCore import QAbstractNativeEventFilter, QSocketNotifier, Qt
 from PyQt6.QtGui import QGuiApplication
 
 from enum import IntEnum
 import math
 import numpy as np
+import os
+import time
 from typing import cast
 
 import platform
 if platform.system() == "Darwin":
     if platform.machine() == "arm64":
-        from .lib.darwin_arm64.pyspacemouse import set_logger, start_spacemouse_daemon, release_spacemouse_daemon
+        from .lib.darwin_arm64 import pyspacemouse
     else:
-        from .lib.darwin_x86_64.pyspacemouse import set_logger, start_spacemouse_daemon, release_spacemouse_daemon
+        from .lib.darwin_x86_64 import pyspacemouse
 elif platform.system() == "Linux":
-    from .lib.linux.pyspacemouse import set_logger, start_spacemouse_daemon, release_spacemouse_daemon
+    from .lib.linux import pyspacemouse
 elif platform.system() == "Windows":
-    from .lib.windows.pyspacemouse import set_logger, start_spacemouse_daemon, release_spacemouse_daemon
-    from .lib.windows.pyspacemouse import set_window_handle, process_win_event
+    from .lib.windows import pyspacemouse
+
+# the libraries in lib/ are prebuilt and may predate parts of the native api. Whatever is
+# missing is None, and the plugin falls back to what it did before it.
+set_logger = pyspacemouse.set_logger
+start_spacemouse_daemon = pyspacemouse.start_spacemouse_daemon
+release_spacemouse_daemon = pyspacemouse.release_spacemouse_daemon
+flush_log = getattr(pyspacemouse, "flush_log", None)
+set_coalescing_window = getattr(pyspacemouse, "set_coalescing_window", None)
+set_filter_chain = getattr(pyspacemouse, "set_filter_chain", None)
+set_pull_mode = getattr(pyspacemouse, "set_pull_mode", None)
+dispatch_events = getattr(pyspacemouse, "dispatch_events", None)
+get_event_fd = getattr(pyspacemouse, "get_event_fd", None)
+set_frame_sampling = getattr(pyspacemouse, "set_frame_sampling", None)
+sample_motion = getattr(pyspacemouse, "sample_motion", None)
+orbit_camera = getattr(pyspacemouse, "orbit_camera", None)
+fit_selection = getattr(pyspacemouse, "fit_selection", None)
+start_recording = getattr(pyspacemouse, "start_recording", None)
+use_evdev = getattr(pyspacemouse, "use_evdev", None)
+add_device = getattr(pyspacemouse, "add_device", None)
+set_reader_scheduling = getattr(pyspacemouse, "set_reader_scheduling", None)
+publish_state = getattr(pyspacemouse, "publish_state", None)
+if platform.system() == "Windows":
+    set_window_handle = pyspacemouse.set_window_handle
+    process_win_event = pyspacemouse.process_win_event
+
+# libraries without SPMB_UNDEFINED predate the current button numbering, they report
+# SPMB_MENU as SPMB_ALT (12) and SPMB_UNDEFINED as 14
+_legacyButtons = not hasattr(pyspacemouse, "SPMB_UNDEFINED")
+_legacyUndefinedButton = 14
+# whether start_spacemouse_daemon takes as_events
+_eventObjects = hasattr(pyspacemouse, "MoveEvent")
 
 
 catalog = i18nCatalog("cura")
@@ -41,11 +74,18 @@ def homogenize(vec4: np.array) -> np.array:  # vec3
     return vec4[0:3]
 
 
-def debugLog(s: str) -> None:
-    Logger.log("d", s)
+_logLevels = {"debug": "d", "info": "i", "warning": "w", "error": "e"}
 
 
-set_logger(debugLog)
+def spaceMouseLog(level: str, s: str) -> None:
+    Logger.log(_logLevels[level], s)
+
+
+if flush_log is None:
+    # libraries without the log queue pass the messages on right away, without their level
+    set_logger(lambda s: Logger.log("d", s))
+else:
+    set_logger(spaceMouseLog, True)
 
 
 class SpaceMouseTool(Extension):
@@ -58,6 +98,15 @@ class SpaceMouseTool(Extension):
     _zoomMin = -0.495  # same as used in CameraTool
     _zoomMax = 1       # same as used in CameraTool
     _fitBorderPercentage = 0.1
+    _coalescingWindow = 8  # ms during which move events are merged before they reach python
+    # suppress the sensor noise of a resting cap, see set_filter_chain
+    _filterChain = [("deadzone", 3.0, 1.0)]
+    # move the camera once per rendered frame instead of once per event, see sample_motion
+    _frameSampling = True
+    _sampleRate = 60.0  # Hz, event rate of the space mouse the scales above were tuned with
+    _frameTimer = None
+    _logTimer = None
+    _eventNotifier = None
     _rotationLocked = False
     _constrainedOrbit = False
 
@@ -80,15 +129,15 @@ class SpaceMouseTool(Extension):
         SPMB_SHIFT = 10      # Shift key * /
         SPMB_CTRL = 11       # Control key * /
         SPMB_ALT = 12        # Alternate key * /
-        # menu button
-        SPMB_MENU = 12       # Menu button * /
         # fit to screen button
         SPMB_FIT = 13        # Fit shown objects to screen * /
+        # menu button
+        SPMB_MENU = 14       # Menu button * /
 
         # if you own another spacemouse feel free to add further buttons
 
         # undefined button
-        SPMB_UNDEFINED = 14  # Undefined button * /
+        SPMB_UNDEFINED = 15  # Undefined button * /
 
     class SpaceMouseModifierKey(IntEnum):
         SPMM_SHIFT = 1
@@ -147,6 +196,41 @@ class SpaceMouseTool(Extension):
         if not camera or not camera.isEnabled():
             return
 
+        rotOrigin = SpaceMouseTool._cameraTool.getOrigin()
+        if orbit_camera is None:
+            SpaceMouseTool._rotateCameraFreePython(camera, rotOrigin, angle, axisX, axisY, axisZ)
+            return
+
+        # the rotation itself is done by the native kernel which operates on the camera
+        # transformation in place, see SpaceMouseCamera.hpp
+        trafo = np.array(camera.getLocalTransformation().getData(), dtype=np.float64)
+        orbit_camera(trafo, (rotOrigin.x, rotOrigin.y, rotOrigin.z),
+                     [(angle * axisX, angle * axisY, angle * axisZ)], False, 1.0)
+        camera.setTransformation(Matrix(trafo))
+
+    @staticmethod
+    def _rotateCameraConstrained(angleAzim: float, angleIncl: float) -> None:
+        if SpaceMouseTool._rotationLocked:
+            return
+        camera = SpaceMouseTool._scene.getActiveCamera()
+        if not camera or not camera.isEnabled():
+            return
+
+        target = SpaceMouseTool._cameraTool.getOrigin()
+        if orbit_camera is None:
+            SpaceMouseTool._rotateCameraConstrainedPython(camera, target, angleAzim, angleIncl)
+            return
+
+        # the native kernel computes the translation and lookAt in one step as we otherwise get
+        # artifacts from first setting the camera to a new position and then telling it to look at
+        # the rotation center, see SpaceMouseCamera.hpp
+        trafo = np.array(camera.getLocalTransformation().getData(), dtype=np.float64)
+        orbit_camera(trafo, (target.x, target.y, target.z), [(angleIncl, 0.0, angleAzim)], True, 1.0)
+        camera.setTransformation(Matrix(trafo))
+
+    @staticmethod
+    def _rotateCameraFreePython(camera, rotOrigin: Vector,
+                                angle: float, axisX: float, axisY: float, axisZ: float) -> None:
         # compute axis in view space:
         # space mouse system: x: right, y: front, z: down
         # camera system:     x: right, y: up,    z: front
@@ -163,29 +247,15 @@ class SpaceMouseTool(Extension):
         axisInWorldSpace = axisInWorldSpace - originInWorldSpace
         axisInWorldSpace = Vector(data=axisInWorldSpace)
 
-        # rotate camera around that axis by angle
-        rotOrigin = SpaceMouseTool._cameraTool.getOrigin()
-
         # rotation matrix around the axis
         rotMat = Matrix()
         rotMat.setByRotationAxis(angle, axisInWorldSpace, rotOrigin.getData())
         camera.setTransformation(camera.getLocalTransformation().preMultiply(rotMat))
 
     @staticmethod
-    def _rotateCameraConstrained(angleAzim: float, angleIncl: float) -> None:
-        if SpaceMouseTool._rotationLocked:
-            return
-        camera = SpaceMouseTool._scene.getActiveCamera()
-        if not camera or not camera.isEnabled():
-            return
-
-        # we need to compute the translation and lookAt in one step as we otherwise get artifacts
-        # from first setting the camera to a new position and then telling it to look at the
-        # rotation center
-
+    def _rotateCameraConstrainedPython(camera, target: Vector,
+                                       angleAzim: float, angleIncl: float) -> None:
         up = Vector.Unit_Y
-        target = SpaceMouseTool._cameraTool.getOrigin()
-
         oldEye = camera.getWorldPosition()
         camToTarget = (target - oldEye).normalized()
 
@@ -230,6 +300,47 @@ class SpaceMouseTool(Extension):
             Logger.log("d", "Nothing selected to fit")
             return
 
+        if fit_selection is None:
+            SpaceMouseTool._fitSelectionPython(camera)
+            return
+
+        # collect the vertex buffers of all selected meshes (including children of groups)
+        meshes = []
+        for node in Selection.getAllSelectedObjects():
+            for child in BreadthFirstIterator(node):
+                meshData = child.getMeshData()
+                if meshData is None or meshData.getVertices() is None:
+                    continue
+                meshes.append((np.ascontiguousarray(meshData.getVertices(), dtype=np.float32),
+                               child.getWorldTransformation().getData()))
+
+        # field of view of the perspective camera
+        aspect = camera.getViewportWidth() / camera.getViewportHeight()
+        halfFovY = math.radians(30) / 2.  # from Camera.py _updatePerspectiveMarix
+        tanHalfFovY = math.tan(halfFovY)
+        tanHalfFovX = aspect * tanHalfFovY
+
+        # the native fit uses the actual vertices instead of the bounding box, so that the
+        # selection fills the view as far as possible
+        viewMatrix = camera.getInverseWorldTransformation()
+        fit = fit_selection(meshes, viewMatrix.getData(), camera.isPerspective(),
+                            (tanHalfFovX, tanHalfFovY),
+                            (camera.getViewportWidth(), camera.getViewportHeight()),
+                            SpaceMouseTool._fitBorderPercentage)
+        if fit is None:
+            Logger.log("d", "Selection has no vertices to fit")
+            return
+        translation, zoomFactor = fit
+
+        # move camera in its xy-plane such that it is looking on the center and, for perspective
+        # views, along its view direction
+        camera.translate(Vector(*translation))
+        if not camera.isPerspective():
+            camera.setZoomFactor(zoomFactor)
+
+    @staticmethod
+    def _fitSelectionPython(camera) -> None:
+        # fits the bounding box of the selection instead of its vertices
         aabb = Selection.getBoundingBox()
         minAabb = aabb.minimum  # type: Vector
         maxAabb = aabb.maximum  # type: Vector
@@ -352,6 +463,8 @@ class SpaceMouseTool(Extension):
 
     @staticmethod
     def spacemouse_button_press_callback(button: int, modifiers: int):
+        if _legacyButtons and button == _legacyUndefinedButton:
+            button = SpaceMouseTool.SpaceMouseButton.SPMB_UNDEFINED
         keyboardModifiers = QGuiApplication.queryKeyboardModifiers()
         if (keyboardModifiers & Qt.KeyboardModifier.ShiftModifier) == Qt.KeyboardModifier.ShiftModifier:
             modifiers |= SpaceMouseTool.SpaceMouseModifierKey.SPMM_SHIFT
@@ -391,15 +504,122 @@ class SpaceMouseTool(Extension):
     def spacemouse_button_release_callback(button: int, modifiers: int):
         pass
 
+    # the callbacks for as_events=True, which passes one reused event object instead of building
+    # the arguments for every event
+    @staticmethod
+    def spacemouse_move_event_callback(event) -> None:
+        SpaceMouseTool.spacemouse_move_callback(event.tx, event.ty, event.tz, event.angle,
+                                                event.axis_x, event.axis_y, event.axis_z)
+
+    @staticmethod
+    def spacemouse_button_press_event_callback(event) -> None:
+        SpaceMouseTool.spacemouse_button_press_callback(event.button, event.modifiers)
+
+    @staticmethod
+    def spacemouse_button_release_event_callback(event) -> None:
+        SpaceMouseTool.spacemouse_button_release_callback(event.button, event.modifiers)
+
     if platform.system() == "Windows":
         _filterObj = None
 
+    @staticmethod
+    def _onEventsQueued() -> None:
+        # calls the spacemouse_*_callbacks for all events queued since the last call
+        dispatch_events()
+        # with frame sampling this also tells us that the space mouse started moving
+        timer = SpaceMouseTool._frameTimer
+        if timer is not None and not timer.isActive():
+            timer.start()
+            SpaceMouseTool._onFrame()
+
+    @staticmethod
+    def _onFrame() -> None:
+        # one camera update per frame, extrapolated to the time the frame will be shown
+        timer = SpaceMouseTool._frameTimer
+        motion = sample_motion(time.monotonic_ns() + timer.interval() * 1000000)
+        if motion is None:
+            # at rest, _onEventsQueued restarts the timer once it moves again
+            timer.stop()
+            return
+        # the motion is integrated over time, scale it to what the events would have summed up to
+        tx, ty, tz, angle, axisX, axisY, axisZ = motion
+        rate = SpaceMouseTool._sampleRate
+        SpaceMouseTool.spacemouse_move_callback(tx * rate, ty * rate, tz * rate, angle * rate,
+                                                axisX, axisY, axisZ)
+
     @staticmethod
     def _onEngineCreated() -> None:
-        start_spacemouse_daemon(
-            SpaceMouseTool.spacemouse_move_callback,
-            SpaceMouseTool.spacemouse_button_press_callback,
-            SpaceMouseTool.spacemouse_button_release_callback)
+        # handle the events on the qt main thread instead of on the thread reading the space
+        # mouse, if the platform supports it
+        eventFd = get_event_fd() if get_event_fd is not None else -1
+        if eventFd >= 0:
+            set_pull_mode(True)
+            SpaceMouseTool._eventNotifier = QSocketNotifier(eventFd, QSocketNotifier.Type.Read)
+            SpaceMouseTool._eventNotifier.activated.connect(SpaceMouseTool._onEventsQueued)
+
+            if SpaceMouseTool._frameSampling and set_frame_sampling is not None:
+                refreshRate = QGuiApplication.primaryScreen().refreshRate()
+                timer = QtCore.QTimer()
+                timer.setTimerType(Qt.TimerType.PreciseTimer)
+                timer.setInterval(max(1, round(1000 / refreshRate)) if refreshRate > 0 else 16)
+                timer.timeout.connect(SpaceMouseTool._onFrame)
+                SpaceMouseTool._frameTimer = timer
+                set_frame_sampling(True)
+
+        # scheduling of the thread reading the space mouse, e.g. "fifo:50" or "nice:-10", so that
+        # it stays responsive while slicing keeps all cores busy
+        scheduling = os.environ.get("SPACEMOUSETOOL_SCHEDULING")
+        if scheduling and set_reader_scheduling is not None:
+            policy, _, priority = scheduling.partition(":")
+            try:
+                set_reader_scheduling(policy, int(priority or 0))
+            except ValueError:
+                Logger.log("w", "Invalid SPACEMOUSETOOL_SCHEDULING %s", scheduling)
+
+        if _eventObjects:
+            start_spacemouse_daemon(
+                SpaceMouseTool.spacemouse_move_event_callback,
+                SpaceMouseTool.spacemouse_button_press_event_callback,
+                SpaceMouseTool.spacemouse_button_release_event_callback, False, True)
+        else:
+            start_spacemouse_daemon(
+                SpaceMouseTool.spacemouse_move_callback,
+                SpaceMouseTool.spacemouse_button_press_callback,
+                SpaceMouseTool.spacemouse_button_release_callback)
+        if set_coalescing_window is not None:
+            set_coalescing_window(SpaceMouseTool._coalescingWindow)
+        if set_filter_chain is not None:
+            set_filter_chain(SpaceMouseTool._filterChain)
+
+        # record the session for reproducing problems, see SpaceMouseTrace.hpp
+        tracePath = os.environ.get("SPACEMOUSETOOL_TRACE")
+        if tracePath and start_recording is not None:
+            if start_recording(tracePath):
+                Logger.log("i", "Recording space mouse events to %s", tracePath)
+            else:
+                Logger.log("w", "Could not record space mouse events to %s", tracePath)
+
+        # read the device directly instead of through spacenavd, "auto" picks the first one found
+        evdevPath = os.environ.get("SPACEMOUSETOOL_EVDEV")
+        if evdevPath and use_evdev is not None:
+            if not use_evdev("" if evdevPath == "auto" else evdevPath):
+                Logger.log("w", "Could not read the space mouse from %s, using spacenavd",
+                           evdevPath)
+
+        # further devices (e.g. a second space mouse for the other hand) as a ":" separated list
+        # of evdev nodes, all of them move the camera
+        devicePaths = os.environ.get("SPACEMOUSETOOL_DEVICES")
+        if devicePaths and add_device is not None:
+            for devicePath in devicePaths.split(":"):
+                if devicePath and add_device(devicePath) is None:
+                    Logger.log("w", "Could not read the space mouse from %s", devicePath)
+
+        # share the state of the devices with other local processes (e.g. a preview renderer)
+        # through a shared memory segment of this name, see SpaceMouseSharedState.hpp
+        sharedState = os.environ.get("SPACEMOUSETOOL_SHARED_STATE")
+        if sharedState and publish_state is not None:
+            if not publish_state(sharedState if sharedState.startswith("/") else "/" + sharedState):
+                Logger.log("w", "Could not publish the space mouse state to %s", sharedState)
 
         if platform.system() == "Windows":
             # the windows api requires the hwnd (window id)
@@ -413,6 +633,15 @@ class SpaceMouseTool(Extension):
             SpaceMouseTool._filterObj = WinEventFilterObj()
             QtApplication.getInstance().installNativeEventFilter(SpaceMouseTool._filterObj)
 
+        # the messages of the threads reading the space mouse are queued until they are flushed,
+        # which dispatching the events does as well
+        if flush_log is not None:
+            timer = QtCore.QTimer()
+            timer.setInterval(500)
+            timer.timeout.connect(flush_log)
+            timer.start()
+            SpaceMouseTool._logTimer = timer
+
         Logger.log("d", "Initialized SpaceMouseTool")
 
 
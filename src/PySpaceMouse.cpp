@@ -2,41 +2,366 @@
 // SpaceMouseTool is released under the terms of the AGPLv3 or higher.
 
 #include <Python.h>
+#include <structmember.h>
 
-#include "SpaceMouse.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "PySpaceMouse.hpp"
+#include "SpaceMouseCamera.hpp"
+
+/*--------------------------------------------------------------------------*/
+/* Batches of events returned by drain_events                               */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Format of one spacemouse::SpaceMouseEvent as exported through the buffer protocol, i.e.
+ * the numpy dtype of the events
+ */
+static const char* kEventRecordFormat =
+    "T{q:timestamp:(6)h:axes:B:type:B:button:B:modifiers:B:device:8x}";
+
+static const std::size_t kEventBatchCapacity =
+    spacemouse::SpaceMouseEventQueue::kCapacity + spacemouse::SpaceMouseEventQueue::kOverflowCapacity;
+
+struct EventBatch {
+  PyObject_HEAD
+  Py_ssize_t length;  /**< Number of valid records */
+  Py_ssize_t exports; /**< Number of buffer views currently handed out */
+  Py_ssize_t shape[1];
+  Py_ssize_t strides[1];
+  /** The events, drained into the batch as they are queued (python only aligns objects to 16) */
+  spacemouse::SpaceMouseEvent* records;
+  char storage[kEventBatchCapacity * sizeof(spacemouse::SpaceMouseEvent) +
+               alignof(spacemouse::SpaceMouseEvent)];
+};
+
+static int EventBatch_getbuffer(PyObject* self, Py_buffer* view, int flags) {
+  EventBatch* batch = reinterpret_cast<EventBatch*>(self);
+  if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "EventBatch is read-only");
+    view->obj = nullptr;
+    return -1;
+  }
+  batch->shape[0] = batch->length;
+  batch->strides[0] = sizeof(spacemouse::SpaceMouseEvent);
+
+  view->obj = self;
+  Py_INCREF(self);
+  view->buf = batch->records;
+  view->len = batch->length * static_cast<Py_ssize_t>(sizeof(spacemouse::SpaceMouseEvent));
+  view->readonly = 1;
+  view->itemsize = sizeof(spacemouse::SpaceMouseEvent);
+  view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(kEventRecordFormat) : nullptr;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) ? batch->shape : nullptr;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? batch->strides : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  ++batch->exports;
+  return 0;
+}
+
+static void EventBatch_releasebuffer(PyObject* self, Py_buffer* /*view*/) {
+  --reinterpret_cast<EventBatch*>(self)->exports;
+}
+
+static Py_ssize_t EventBatch_length(PyObject* self) {
+  return reinterpret_cast<EventBatch*>(self)->length;
+}
+
+static PyBufferProcs EventBatchBufferProcs = {EventBatch_getbuffer, EventBatch_releasebuffer};
+
+static PySequenceMethods EventBatchSequenceMethods = {EventBatch_length};
+
+static const char* docEventBatch =
+  "Read-only batch of space mouse events returned by drain_events.\n"
+  "\n"
+  "Supports len() and the buffer protocol, numpy.asarray(batch) gives a structured array with the"
+  " fields timestamp, axes (int16 tx, ty, tz, rx, ry, rz), type, button, modifiers, and device"
+  " without copying. The memory is reused by later calls of drain_events once no reference to the"
+  " batch (or an array/memoryview of it) is left.";
+
+static PyTypeObject EventBatchType = {PyVarObject_HEAD_INIT(nullptr, 0) "pyspacemouse.EventBatch"};
+
+/** The batch that is filled by the next drain_events call if nobody holds on to it anymore */
+static EventBatch* reusableBatch = nullptr;
+
+/*--------------------------------------------------------------------------*/
+/* Event objects passed to the callbacks                                    */
+/*--------------------------------------------------------------------------*/
+struct MoveEventObject {
+  PyObject_HEAD
+  spacemouse::SpaceMouseMoveEvent event;
+};
+
+struct ButtonEventObject {
+  PyObject_HEAD
+  int button;
+  int modifiers;
+  int device;
+};
+
+static PyMemberDef MoveEventMembers[] = {
+    {"tx", T_INT, offsetof(MoveEventObject, event.tx), READONLY, "Translation x coordinate"},
+    {"ty", T_INT, offsetof(MoveEventObject, event.ty), READONLY, "Translation y coordinate"},
+    {"tz", T_INT, offsetof(MoveEventObject, event.tz), READONLY, "Translation z coordinate"},
+    {"angle", T_DOUBLE, offsetof(MoveEventObject, event.angle), READONLY, "Rotation angle"},
+    {"axis_x", T_DOUBLE, offsetof(MoveEventObject, event.axisX), READONLY,
+     "Rotation axis x coordinate"},
+    {"axis_y", T_DOUBLE, offsetof(MoveEventObject, event.axisY), READONLY,
+     "Rotation axis y coordinate"},
+    {"axis_z", T_DOUBLE, offsetof(MoveEventObject, event.axisZ), READONLY,
+     "Rotation axis z coordinate"},
+    {"device", T_INT, offsetof(MoveEventObject, event.device), READONLY,
+     "Device that moved, see add_device"},
+    {nullptr, 0, 0, 0, nullptr}};
+
+static PyMemberDef ButtonEventMembers[] = {
+    {"button", T_INT, offsetof(ButtonEventObject, button), READONLY, "The button"},
+    {"modifiers", T_INT, offsetof(ButtonEventObject, modifiers), READONLY,
+     "Modifier keys held down on the same device"},
+    {"device", T_INT, offsetof(ButtonEventObject, device), READONLY,
+     "Device of the button, see add_device"},
+    {nullptr, 0, 0, 0, nullptr}};
+
+static const char* docMoveEvent =
+  "Move event passed to the move callback if start_spacemouse_daemon was called with"
+  " as_events=True.\n"
+  "\n"
+  "The event is only valid during the callback: it is reused for a later event unless the"
+  " callback keeps a reference to it.";
+
+static const char* docButtonEvent =
+  "Button event passed to the button callbacks if start_spacemouse_daemon was called with"
+  " as_events=True, reused like MoveEvent.";
+
+static PyTypeObject MoveEventType = {PyVarObject_HEAD_INIT(nullptr, 0) "pyspacemouse.MoveEvent"};
+
+static PyTypeObject ButtonEventType = {
+    PyVarObject_HEAD_INIT(nullptr, 0) "pyspacemouse.ButtonEvent"};
+
+/**
+ * @brief Event objects of one type for the callbacks. An object is handed out again once only the
+ * pool references it, so that dispatching allocates nothing as long as the callbacks do not keep
+ * the events. Only used while holding the GIL.
+ */
+template <typename Object>
+class EventObjectPool {
+ public:
+  /** Number of objects kept, i.e. of events a callback may keep without defeating the pool */
+  static const int kSize = 4;
+
+  explicit EventObjectPool(PyTypeObject& type) : mType(type), mNext(0) {
+    std::fill(mObjects, mObjects + kSize, nullptr);
+  }
+
+  /** @brief An object nobody else references (owned by the pool), nullptr if out of memory */
+  Object* acquire() {
+    for (Object* object : mObjects)
+      if (object != nullptr && Py_REFCNT(object) == 1)
+        return object;
+    Object* object = PyObject_New(Object, &mType);
+    if (object == nullptr)
+      return nullptr;
+    // all objects are still in use, the pool lets go of the one handed out longest ago
+    Py_XDECREF(mObjects[mNext]);
+    mObjects[mNext] = object;
+    mNext = (mNext + 1) % kSize;
+    return object;
+  }
+
+ private:
+  PyTypeObject& mType;
+  Object* mObjects[kSize];
+  int mNext;
+};
+
+static EventObjectPool<MoveEventObject> moveEventPool(MoveEventType);
+static EventObjectPool<ButtonEventObject> buttonEventPool(ButtonEventType);
+
+/*--------------------------------------------------------------------------*/
+/* Python callbacks                                                         */
+/*--------------------------------------------------------------------------*/
+static int releasePythonObject(void* object) {
+  Py_DECREF(static_cast<PyObject*>(object));
+  return 0;
+}
+
+/**
+ * @brief Releases the reference of a pythonReference(). Without the GIL, e.g. when callbackRcu
+ * frees a replaced callback on the dispatch thread, the reference is released by a pending call
+ * of the main thread: waiting for the GIL there could deadlock with a thread holding the GIL that
+ * replaces a callback.
+ */
+static void releasePythonReference(PyObject* object) {
+  if (!Py_IsInitialized())
+    return;
+  if (PyGILState_Check())
+    Py_DECREF(object);
+  else if (Py_AddPendingCall(releasePythonObject, object) != 0)
+    SPACEMOUSE_LOG(spacemouse::SPML_WARNING, "Could not release a python callback");
+}
+
+/**
+ * @brief Shared ownership of a python object, so that copies of the callbacks do not need the
+ * GIL. Creating it does (the caller has to hold it).
+ */
+static std::shared_ptr<PyObject> pythonReference(PyObject* object) {
+  Py_INCREF(object);
+  return std::shared_ptr<PyObject>(object, releasePythonReference);
+}
+
+/**
+ * @brief Calls callable with the first count arguments, which are released afterwards. Reports
+ * the exception of the call, or of creating the arguments if one of them is nullptr (GIL held).
+ */
+static void callPython(PyObject* callable, PyObject** arguments, std::size_t count) {
+  // arguments[-1] is free, which saves bound methods a copy of the arguments
+  PyObject* result = nullptr;
+  if (std::find(arguments, arguments + count, nullptr) == arguments + count)
+    result = PyObject_Vectorcall(callable, arguments, count | PY_VECTORCALL_ARGUMENTS_OFFSET,
+                                 nullptr);
+  if (result == nullptr)
+    PyErr_Print();  // do not leave the exception to the next callback
+  Py_XDECREF(result);
+  for (std::size_t i = 0; i < count; ++i) Py_XDECREF(arguments[i]);
+}
+
+std::function<void(spacemouse::SpaceMouseMoveEvent)> pythonMoveCallback(PyObject* callable,
+                                                                        bool withDevice,
+                                                                        bool asEvent) {
+  std::shared_ptr<PyObject> reference = pythonReference(callable);
+  return [reference, withDevice, asEvent](spacemouse::SpaceMouseMoveEvent e) -> void {
+    if (!Py_IsInitialized())
+      return;
+    SPACEMOUSE_STATS(const int64_t gilStart = spacemouse::monotonicTime();)
+    PyGILState_STATE gil = PyGILState_Ensure();
+    SPACEMOUSE_STATS(spacemouse::pipelineStats.record(spacemouse::SPMH_GIL_WAIT,
+                                                      spacemouse::monotonicTime() - gilStart);)
+
+    PyObject* arguments[9];
+    if (asEvent) {
+      MoveEventObject* object = moveEventPool.acquire();
+      if (object != nullptr) {
+        object->event = e;
+        Py_INCREF(object);  // released by callPython
+      }
+      arguments[1] = reinterpret_cast<PyObject*>(object);
+      callPython(reference.get(), arguments + 1, 1);
+    } else {
+      arguments[1] = PyLong_FromLong(e.tx);
+      arguments[2] = PyLong_FromLong(e.ty);
+      arguments[3] = PyLong_FromLong(e.tz);
+      arguments[4] = PyFloat_FromDouble(e.angle);
+      arguments[5] = PyFloat_FromDouble(e.axisX);
+      arguments[6] = PyFloat_FromDouble(e.axisY);
+      arguments[7] = PyFloat_FromDouble(e.axisZ);
+      arguments[8] = withDevice ? PyLong_FromLong(e.device) : nullptr;
+      callPython(reference.get(), arguments + 1, withDevice ? 8 : 7);
+    }
+    PyGILState_Release(gil);
+  };
+}
+
+std::function<void(spacemouse::SpaceMouseButtonEvent)> pythonButtonCallback(PyObject* callable,
+                                                                            bool withDevice,
+                                                                            bool asEvent) {
+  std::shared_ptr<PyObject> reference = pythonReference(callable);
+  return [reference, withDevice, asEvent](spacemouse::SpaceMouseButtonEvent e) -> void {
+    if (!Py_IsInitialized())
+      return;
+    SPACEMOUSE_STATS(const int64_t gilStart = spacemouse::monotonicTime();)
+    PyGILState_STATE gil = PyGILState_Ensure();
+    SPACEMOUSE_STATS(spacemouse::pipelineStats.record(spacemouse::SPMH_GIL_WAIT,
+                                                      spacemouse::monotonicTime() - gilStart);)
+
+    PyObject* arguments[4];
+    if (asEvent) {
+      ButtonEventObject* object = buttonEventPool.acquire();
+      if (object != nullptr) {
+        object->button = static_cast<int>(e.button);
+        object->modifiers = static_cast<int>(e.modifierKeys.modifiers());
+        object->device = e.device;
+        Py_INCREF(object);  // released by callPython
+      }
+      arguments[1] = reinterpret_cast<PyObject*>(object);
+      callPython(reference.get(), arguments + 1, 1);
+    } else {
+      arguments[1] = PyLong_FromLong(static_cast<long>(e.button));
+      arguments[2] = PyLong_FromLong(static_cast<long>(e.modifierKeys.modifiers()));
+      arguments[3] = withDevice ? PyLong_FromLong(e.device) : nullptr;
+      callPython(reference.get(), arguments + 1, withDevice ? 3 : 2);
+    }
+    PyGILState_Release(gil);
+  };
+}
+
+/** Name of a spacemouse::SpaceMouseLogLevel as passed to and by the python logger */
+static const char* logLevelName(int level) {
+  static const char* kNames[] = {"debug", "info", "warning", "error"};
+  return kNames[std::min(std::max(level, 0), 3)];
+}
 
 extern "C" {
 
 static PyObject* set_logger(PyObject* /*self*/, PyObject* args) {
   PyObject* pyLogFun;
-  if (!PyArg_ParseTuple(args, "O", &pyLogFun))
+  int withLevel = 0;
+  if (!PyArg_ParseTuple(args, "O|p", &pyLogFun, &withLevel))
     return nullptr;
   if (!PyCallable_Check(pyLogFun)) {
     PyErr_SetString(PyExc_TypeError, "First argument (logFun) is not a function!");
   } else {
-    spacemouse::logFun = std::function<void(const char*)>([pyLogFun](const char* string) {
+    std::shared_ptr<PyObject> reference = pythonReference(pyLogFun);
+    spacemouse::logFun = [reference, withLevel](const spacemouse::SpaceMouseLogRecord& record) {
       if (!Py_IsInitialized())
         return;
       PyGILState_STATE gil = PyGILState_Ensure();
 
-      PyObject* arglist = Py_BuildValue("(s)", string);
-      PyObject* result = PyObject_CallObject(pyLogFun, arglist);
-
-      Py_DECREF(arglist);
-      Py_XDECREF(result);
+      PyObject* arguments[3];
+      arguments[1] = withLevel != 0 ? PyUnicode_FromString(logLevelName(record.level))
+                                    : PyUnicode_FromString(record.text);
+      arguments[2] = withLevel != 0 ? PyUnicode_FromString(record.text) : nullptr;
+      callPython(reference.get(), arguments + 1, withLevel != 0 ? 2 : 1);
       PyGILState_Release(gil);
-    });
+    };
   }
 
   Py_INCREF(Py_None);
   return Py_None;
 }
 
+static PyObject* set_log_level(PyObject* /*self*/, PyObject* args) {
+  const char* name;
+  if (!PyArg_ParseTuple(args, "s", &name))
+    return nullptr;
+  for (int level = spacemouse::SPML_DEBUG; level <= spacemouse::SPML_ERROR; ++level) {
+    if (std::strcmp(name, logLevelName(level)) == 0) {
+      spacemouse::logRing.setLevel(static_cast<spacemouse::SpaceMouseLogLevel>(level));
+      Py_INCREF(Py_None);
+      return Py_None;
+    }
+  }
+  PyErr_SetString(PyExc_ValueError,
+                  "First argument (level) must be 'debug', 'info', 'warning' or 'error'!");
+  return nullptr;
+}
+
+static PyObject* flush_log(PyObject* /*self*/, PyObject* /*args*/) {
+  return PyLong_FromSize_t(spacemouse::logRing.flush());
+}
+
 static PyObject* start_spacemouse_daemon(PyObject* /*self*/, PyObject* args) {
   PyObject *pyMoveCallback, *pyButtonPressCallback, *pyButtonReleaseCallback;
+  int withDevice = 0;
+  int asEvents = 0;
 
-  if (!PyArg_ParseTuple(args, "OOO", &pyMoveCallback, &pyButtonPressCallback,
-                        &pyButtonReleaseCallback))
+  if (!PyArg_ParseTuple(args, "OOO|pp", &pyMoveCallback, &pyButtonPressCallback,
+                        &pyButtonReleaseCallback, &withDevice, &asEvents))
     return nullptr;
 
   if (!PyCallable_Check(pyMoveCallback)) {
@@ -47,45 +372,13 @@ static PyObject* start_spacemouse_daemon(PyObject* /*self*/, PyObject* args) {
     PyErr_SetString(PyExc_TypeError, "Third argument (buttonReleasCallback) is not a function!");
   } else {
     auto& smDaemon = spacemouse::SpaceMouseDaemon::instance();
-    smDaemon.setMoveCallback([pyMoveCallback](spacemouse::SpaceMouseMoveEvent e) -> void {
-      if (!Py_IsInitialized())
-        return;
-      PyGILState_STATE gil = PyGILState_Ensure();
-
-      PyObject* arglist =
-          Py_BuildValue("(iiidddd)", e.tx, e.ty, e.tz, e.angle, e.axisX, e.axisY, e.axisZ);
-      PyObject* result = PyObject_CallObject(pyMoveCallback, arglist);
-
-      Py_DECREF(arglist);
-      Py_XDECREF(result);
-      PyGILState_Release(gil);
-    });
+    smDaemon.setMoveCallback(pythonMoveCallback(pyMoveCallback, withDevice != 0, asEvents != 0));
     smDaemon.setButtonPressCallback(
-        [pyButtonPressCallback](spacemouse::SpaceMouseButtonEvent e) -> void {
-          if (!Py_IsInitialized())
-            return;
-          PyGILState_STATE gil = PyGILState_Ensure();
-
-          PyObject* arglist = Py_BuildValue("(ii)", (int)e.button, (int)e.modifierKeys.modifiers());
-          PyObject* result = PyObject_CallObject(pyButtonPressCallback, arglist);
-
-          Py_DECREF(arglist);
-          Py_XDECREF(result);
-          PyGILState_Release(gil);
-        });
+        pythonButtonCallback(pyButtonPressCallback, withDevice != 0, asEvents != 0));
     smDaemon.setButtonReleaseCallback(
-        [pyButtonReleaseCallback](spacemouse::SpaceMouseButtonEvent e) -> void {
-          if (!Py_IsInitialized())
-            return;
-          PyGILState_STATE gil = PyGILState_Ensure();
-
-          PyObject* arglist = Py_BuildValue("(ii)", (int)e.button, (int)e.modifierKeys.modifiers());
-          PyObject* result = PyObject_CallObject(pyButtonReleaseCallback, arglist);
-
-          Py_DECREF(arglist);
-          Py_XDECREF(result);
-          PyGILState_Release(gil);
-        });
+        pythonButtonCallback(pyButtonReleaseCallback, withDevice != 0, asEvents != 0));
+    // whatever connecting to the device logged
+    spacemouse::logRing.flush();
   }
 
   Py_INCREF(Py_None);
@@ -93,19 +386,606 @@ static PyObject* start_spacemouse_daemon(PyObject* /*self*/, PyObject* args) {
 }
 
 static PyObject* release_spacemouse_daemon(PyObject* /*self*/, PyObject* args) {
-  #ifndef NDEBUG
-  spacemouse::logFun("Releasing daemon");
-  #endif
+  SPACEMOUSE_LOG(spacemouse::SPML_DEBUG, "Releasing daemon");
   auto& smDaemon = spacemouse::SpaceMouseDaemon::instance();
   smDaemon.setMoveCallback([](spacemouse::SpaceMouseMoveEvent e) -> void {});
   smDaemon.setButtonPressCallback([](spacemouse::SpaceMouseButtonEvent e) -> void {});
   smDaemon.setButtonReleaseCallback([](spacemouse::SpaceMouseButtonEvent e) -> void {});
-  spacemouse::logFun = std::function<void(const char*)>([](const char* string) {});
+  // the old logger still gets what was logged so far
+  spacemouse::logRing.flush();
+  spacemouse::logFun = spacemouse::SpaceMouseCallback<
+      const spacemouse::SpaceMouseLogRecord&>::Function();
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* set_coalescing_window(PyObject* /*self*/, PyObject* args) {
+  int milliseconds;
+  if (!PyArg_ParseTuple(args, "i", &milliseconds))
+    return nullptr;
+  if (milliseconds < 0) {
+    PyErr_SetString(PyExc_ValueError, "First argument (milliseconds) must not be negative!");
+    return nullptr;
+  }
+  spacemouse::SpaceMouseDaemon::instance().setCoalescingWindow(milliseconds);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* set_filter_chain(PyObject* /*self*/, PyObject* args) {
+  PyObject* pyStages;
+  if (!PyArg_ParseTuple(args, "O", &pyStages))
+    return nullptr;
+  PyObject* sequence = PySequence_Fast(pyStages, "First argument (stages) must be a list!");
+  if (sequence == nullptr)
+    return nullptr;
+  const Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+  if (count > spacemouse::SpaceMouseFilterChain::kMaxStages) {
+    Py_DECREF(sequence);
+    PyErr_Format(PyExc_ValueError, "At most %d filter stages are supported!",
+                 spacemouse::SpaceMouseFilterChain::kMaxStages);
+    return nullptr;
+  }
+
+  spacemouse::SpaceMouseFilterStage stages[spacemouse::SpaceMouseFilterChain::kMaxStages];
+  for (Py_ssize_t i = 0; i < count; ++i) {
+    PyObject* pyStage = PySequence_Fast_GET_ITEM(sequence, i);
+    if (!PyTuple_Check(pyStage)) {
+      Py_DECREF(sequence);
+      PyErr_SetString(PyExc_TypeError, "Each filter stage must be a tuple!");
+      return nullptr;
+    }
+    const char* name;
+    // defaults of the optional parameters, see docSetFilterChain
+    double p[3] = {std::nan(""), std::nan(""), std::nan("")};
+    if (!PyArg_ParseTuple(pyStage, "s|ddd;filter stage", &name, &p[0], &p[1], &p[2])) {
+      Py_DECREF(sequence);
+      return nullptr;
+    }
+    spacemouse::SpaceMouseFilterStage& stage = stages[i];
+    if (std::strcmp(name, "deadzone") == 0) {
+      stage.type = spacemouse::SPMF_DEADZONE;
+      stage.parameters[0] = p[0];
+      stage.parameters[1] = std::isnan(p[1]) ? 0.0 : p[1];
+    } else if (std::strcmp(name, "ema") == 0) {
+      stage.type = spacemouse::SPMF_EMA;
+      stage.parameters[0] = p[0];
+    } else if (std::strcmp(name, "one_euro") == 0) {
+      stage.type = spacemouse::SPMF_ONE_EURO;
+      stage.parameters[0] = std::isnan(p[0]) ? 1.0 : p[0];
+      stage.parameters[1] = std::isnan(p[1]) ? 0.0 : p[1];
+      stage.parameters[2] = std::isnan(p[2]) ? 1.0 : p[2];
+    } else {
+      Py_DECREF(sequence);
+      PyErr_Format(PyExc_ValueError, "Unknown filter '%s'!", name);
+      return nullptr;
+    }
+  }
+  Py_DECREF(sequence);
+
+  if (!spacemouse::SpaceMouseDaemon::instance().setFilterChain(stages, static_cast<int>(count))) {
+    PyErr_SetString(PyExc_ValueError, "Filter parameters out of range!");
+    return nullptr;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* set_pull_mode(PyObject* /*self*/, PyObject* args) {
+  int enabled;
+  if (!PyArg_ParseTuple(args, "p", &enabled))
+    return nullptr;
+  // enabling it joins the dispatch thread, whose callbacks may be waiting for the GIL
+  Py_BEGIN_ALLOW_THREADS
+  spacemouse::SpaceMouseDaemon::instance().setPullMode(enabled != 0);
+  Py_END_ALLOW_THREADS
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* set_frame_sampling(PyObject* /*self*/, PyObject* args) {
+  int enabled;
+  if (!PyArg_ParseTuple(args, "p", &enabled))
+    return nullptr;
+  spacemouse::SpaceMouseDaemon::instance().setFrameSampling(enabled != 0);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* sample_motion(PyObject* /*self*/, PyObject* args) {
+  long long frameTime;
+  if (!PyArg_ParseTuple(args, "L", &frameTime))
+    return nullptr;
+  double delta[6];
+  if (!spacemouse::SpaceMouseDaemon::instance().sampleMotion(frameTime, delta)) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  // same form as the arguments of the move callback
+  const double angle = std::sqrt(delta[3] * delta[3] + delta[4] * delta[4] + delta[5] * delta[5]);
+  if (angle == 0)
+    return Py_BuildValue("(ddddddd)", delta[0], delta[1], delta[2], 0.0, 0.0, 0.0, 1.0);
+  return Py_BuildValue("(ddddddd)", delta[0], delta[1], delta[2], angle, delta[3] / angle,
+                       delta[4] / angle, delta[5] / angle);
+}
+
+static PyObject* drain_events(PyObject* /*self*/, PyObject* /*args*/) {
+  // reuse the last batch unless someone still references it
+  if (reusableBatch == nullptr || Py_REFCNT(reusableBatch) > 1 || reusableBatch->exports > 0) {
+    EventBatch* batch = PyObject_New(EventBatch, &EventBatchType);
+    if (batch == nullptr)
+      return nullptr;
+    batch->exports = 0;
+    const std::uintptr_t storage = reinterpret_cast<std::uintptr_t>(batch->storage);
+    const std::uintptr_t alignment = alignof(spacemouse::SpaceMouseEvent);
+    batch->records = reinterpret_cast<spacemouse::SpaceMouseEvent*>(
+        (storage + alignment - 1) & ~(alignment - 1));
+    Py_XDECREF(reusableBatch);
+    reusableBatch = batch;
+  }
+
+  const std::size_t count = spacemouse::SpaceMouseDaemon::instance().drainEvents(
+      reusableBatch->records, kEventBatchCapacity);
+  reusableBatch->length = static_cast<Py_ssize_t>(count);
+  spacemouse::logRing.flush();
+
+  Py_INCREF(reusableBatch);
+  return reinterpret_cast<PyObject*>(reusableBatch);
+}
+
+static PyObject* dispatch_events(PyObject* /*self*/, PyObject* /*args*/) {
+  spacemouse::SpaceMouseDaemon::instance().dispatchEvents();
+  spacemouse::logRing.flush();
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* get_event_fd(PyObject* /*self*/, PyObject* /*args*/) {
+  return PyLong_FromLong(spacemouse::SpaceMouseDaemon::instance().eventFd());
+}
+
+static PyObject* get_backpressure(PyObject* /*self*/, PyObject* /*args*/) {
+  const spacemouse::SpaceMouseBackpressure& backpressure =
+      spacemouse::SpaceMouseDaemon::instance().backpressure();
+  return Py_BuildValue("{s:s,s:L,s:L,s:L,s:K}",
+                       "mode", backpressure.mode() == spacemouse::SPMD_MERGED ? "merged"
+                                                                               : "per_event",
+                       "sample_interval", (long long)backpressure.sampleInterval(),
+                       "callback", (long long)backpressure.callbackTime(),
+                       "lag", (long long)backpressure.lag(),
+                       "switches", (unsigned long long)backpressure.switches());
+}
+
+/** @brief Summary of a histogram as dict, durations in nanoseconds */
+static PyObject* histogramToDict(const spacemouse::SpaceMouseHistogram& histogram) {
+  PyObject* buckets = PyList_New(0);
+  if (buckets == nullptr)
+    return nullptr;
+  for (int i = 0; i < spacemouse::SpaceMouseHistogram::kBuckets; ++i) {
+    if (histogram.bucket(i) == 0)
+      continue;
+    PyObject* entry =
+        Py_BuildValue("(LK)", (long long)spacemouse::SpaceMouseHistogram::bucketLimit(i),
+                      (unsigned long long)histogram.bucket(i));
+    if (entry == nullptr || PyList_Append(buckets, entry) != 0) {
+      Py_XDECREF(entry);
+      Py_DECREF(buckets);
+      return nullptr;
+    }
+    Py_DECREF(entry);
+  }
+  return Py_BuildValue("{s:K,s:L,s:L,s:L,s:L,s:L,s:N}",
+                       "count", (unsigned long long)histogram.count(),
+                       "sum", (long long)histogram.sum(),
+                       "max", (long long)histogram.max(),
+                       "p50", (long long)histogram.percentile(50.0),
+                       "p90", (long long)histogram.percentile(90.0),
+                       "p99", (long long)histogram.percentile(99.0),
+                       "buckets", buckets);
+}
+
+static PyObject* get_stats(PyObject* /*self*/, PyObject* /*args*/) {
+  using namespace spacemouse;
+  const SpaceMouseStats& stats = pipelineStats;
+#ifdef WITH_SPACEMOUSE_STATS
+  PyObject* enabled = Py_True;
+#else
+  PyObject* enabled = Py_False;
+#endif  // WITH_SPACEMOUSE_STATS
+  return Py_BuildValue("{s:O,s:K,s:K,s:K,s:K,s:K,s:N,s:N,s:N,s:N}",
+                       "enabled", enabled,
+                       "received", (unsigned long long)stats.counter(SPMC_RECEIVED),
+                       "dispatched", (unsigned long long)stats.counter(SPMC_DISPATCHED),
+                       "merged", (unsigned long long)stats.counter(SPMC_MERGED),
+                       "dropped", (unsigned long long)stats.counter(SPMC_DROPPED),
+                       "filtered", (unsigned long long)stats.counter(SPMC_FILTERED),
+                       "decode", histogramToDict(stats.histogram(SPMH_DECODE)),
+                       "queue_delay", histogramToDict(stats.histogram(SPMH_QUEUE_DELAY)),
+                       "callback", histogramToDict(stats.histogram(SPMH_CALLBACK)),
+                       "gil_wait", histogramToDict(stats.histogram(SPMH_GIL_WAIT)));
+}
+
+static PyObject* reset_stats(PyObject* /*self*/, PyObject* /*args*/) {
+  spacemouse::pipelineStats.reset();
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* orbit_camera(PyObject* /*self*/, PyObject* args) {
+  Py_buffer matrix;
+  double origin[3];
+  PyObject* pySamples;
+  int constrained;
+  double scale;
+  if (!PyArg_ParseTuple(args, "w*(ddd)Opd", &matrix, &origin[0], &origin[1], &origin[2],
+                        &pySamples, &constrained, &scale))
+    return nullptr;
+  if (matrix.len != 16 * sizeof(double) || !PyBuffer_IsContiguous(&matrix, 'C')) {
+    PyBuffer_Release(&matrix);
+    PyErr_SetString(PyExc_TypeError,
+                    "First argument (matrix) must be a contiguous buffer of 16 doubles!");
+    return nullptr;
+  }
+  PyObject* samples = PySequence_Fast(pySamples, "Third argument (samples) is not a sequence!");
+  if (samples == nullptr) {
+    PyBuffer_Release(&matrix);
+    return nullptr;
+  }
+
+  double* data = static_cast<double*>(matrix.buf);
+  Py_ssize_t count = PySequence_Fast_GET_SIZE(samples);
+  for (Py_ssize_t i = 0; i < count; ++i) {
+    double rotation[3];
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(samples, i), "ddd;samples must contain "
+                          "(rx, ry, rz) tuples", &rotation[0], &rotation[1], &rotation[2])) {
+      Py_DECREF(samples);
+      PyBuffer_Release(&matrix);
+      return nullptr;
+    }
+    if (constrained)
+      spacemouse::orbitCameraConstrained(data, origin, rotation, scale);
+    else
+      spacemouse::orbitCameraFree(data, origin, rotation, scale);
+  }
+
+  Py_DECREF(samples);
+  PyBuffer_Release(&matrix);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+/**
+ * @brief Gets a C-contiguous buffer of obj holding items of the given struct format character
+ * @return false with a python exception set if obj does not provide such a buffer
+ */
+static bool getTypedBuffer(PyObject* obj, Py_buffer* view, char format, const char* error) {
+  if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+    return false;
+  const char* fmt = view->format != nullptr ? view->format : "B";
+  if (std::strlen(fmt) == 0 || fmt[std::strlen(fmt) - 1] != format ||
+      (std::strlen(fmt) > 1 && std::strchr("@=<", fmt[0]) == nullptr)) {
+    PyBuffer_Release(view);
+    PyErr_SetString(PyExc_TypeError, error);
+    return false;
+  }
+  return true;
+}
+
+static PyObject* fit_selection(PyObject* /*self*/, PyObject* args) {
+  PyObject* pyMeshes;
+  PyObject* pyViewMatrix;
+  spacemouse::SpaceMouseFitParameters parameters;
+  int perspective;
+  if (!PyArg_ParseTuple(args, "OOp(dd)(dd)d", &pyMeshes, &pyViewMatrix, &perspective,
+                        &parameters.tanHalfFovX, &parameters.tanHalfFovY,
+                        &parameters.viewportWidth, &parameters.viewportHeight, &parameters.border))
+    return nullptr;
+  parameters.perspective = perspective != 0;
+
+  PyObject* meshList = PySequence_Fast(pyMeshes, "First argument (meshes) is not a sequence!");
+  if (meshList == nullptr)
+    return nullptr;
+  Py_ssize_t meshCount = PySequence_Fast_GET_SIZE(meshList);
+
+  // two buffers per mesh (vertices and transformation) plus the view matrix
+  std::vector<Py_buffer> buffers;
+  buffers.reserve(2 * meshCount + 1);
+  std::vector<spacemouse::SpaceMouseFitMesh> meshes(meshCount);
+  bool ok = true;
+  Py_buffer view;
+  if (getTypedBuffer(pyViewMatrix, &view, 'd', "Second argument (view_matrix) must be a buffer "
+                                               "of 16 doubles!")) {
+    buffers.push_back(view);
+    if (view.len != 16 * sizeof(double)) {
+      PyErr_SetString(PyExc_TypeError, "Second argument (view_matrix) must be a buffer of 16 "
+                                       "doubles!");
+      ok = false;
+    }
+  } else {
+    ok = false;
+  }
+  for (Py_ssize_t i = 0; ok && i < meshCount; ++i) {
+    PyObject* vertices;
+    PyObject* transformation;
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(meshList, i), "OO;meshes must contain "
+                          "(vertices, transformation) tuples", &vertices, &transformation)) {
+      ok = false;
+      break;
+    }
+    Py_buffer vertexBuffer;
+    if (!getTypedBuffer(vertices, &vertexBuffer, 'f', "Mesh vertices must be a contiguous float32 "
+                                                      "array of shape (n, 3)!")) {
+      ok = false;
+      break;
+    }
+    buffers.push_back(vertexBuffer);
+    Py_buffer trafoBuffer;
+    if (!getTypedBuffer(transformation, &trafoBuffer, 'd', "Mesh transformations must be buffers "
+                                                           "of 16 doubles!")) {
+      ok = false;
+      break;
+    }
+    buffers.push_back(trafoBuffer);
+    if (vertexBuffer.len % (3 * sizeof(float)) != 0 || trafoBuffer.len != 16 * sizeof(double)) {
+      PyErr_SetString(PyExc_TypeError, "Meshes must contain float32 arrays of shape (n, 3) and "
+                                       "16 doubles as transformation!");
+      ok = false;
+      break;
+    }
+    meshes[i].vertices = static_cast<const float*>(vertexBuffer.buf);
+    meshes[i].vertexCount = vertexBuffer.len / (3 * sizeof(float));
+    meshes[i].transformation = static_cast<const double*>(trafoBuffer.buf);
+  }
+
+  bool found = false;
+  spacemouse::SpaceMouseFitResult result;
+  if (ok) {
+    // the exported buffers stay valid without the GIL
+    Py_BEGIN_ALLOW_THREADS
+    found = spacemouse::fitCamera(meshes.data(), meshes.size(),
+                                  static_cast<const double*>(buffers[0].buf), parameters, result);
+    Py_END_ALLOW_THREADS
+  }
+  for (std::size_t i = 0; i < buffers.size(); ++i) PyBuffer_Release(&buffers[i]);
+  Py_DECREF(meshList);
+  if (!ok)
+    return nullptr;
+  if (!found) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return Py_BuildValue("(ddd)d", result.translation[0], result.translation[1],
+                       result.translation[2], result.zoomFactor);
+}
+
+#ifdef WITH_LIBSPACENAV
+static PyObject* start_recording(PyObject* /*self*/, PyObject* args) {
+  const char* path;
+  if (!PyArg_ParseTuple(args, "s", &path))
+    return nullptr;
+  return PyBool_FromLong(spacemouse::SpaceMouseDaemon::instance().startRecording(path));
+}
+
+static PyObject* stop_recording(PyObject* /*self*/, PyObject* /*args*/) {
+  spacemouse::SpaceMouseDaemon::instance().stopRecording();
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* replay_trace(PyObject* /*self*/, PyObject* args) {
+  const char* path;
+  int realTime = 0;
+  if (!PyArg_ParseTuple(args, "s|p", &path, &realTime))
+    return nullptr;
+  bool ok;
+  // the callbacks of the previous session may still need the GIL while the threads are stopped
+  Py_BEGIN_ALLOW_THREADS
+  ok = spacemouse::SpaceMouseDaemon::instance().startReplay(path, realTime != 0);
+  Py_END_ALLOW_THREADS
+  return PyBool_FromLong(ok);
+}
+
+static PyObject* wait_for_replay(PyObject* /*self*/, PyObject* /*args*/) {
+  Py_BEGIN_ALLOW_THREADS
+  spacemouse::SpaceMouseDaemon::instance().waitForReplay();
+  Py_END_ALLOW_THREADS
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* stop_replay(PyObject* /*self*/, PyObject* /*args*/) {
+  Py_BEGIN_ALLOW_THREADS
+  spacemouse::SpaceMouseDaemon::instance().stopReplay();
+  Py_END_ALLOW_THREADS
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* add_device(PyObject* /*self*/, PyObject* args) {
+  const char* path = "";
+  if (!PyArg_ParseTuple(args, "|s", &path))
+    return nullptr;
+  int device;
+  Py_BEGIN_ALLOW_THREADS
+  device = spacemouse::SpaceMouseDaemon::instance().addDevice(path);
+  Py_END_ALLOW_THREADS
+  if (device < 0) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return PyLong_FromLong(device);
+}
+
+static PyObject* remove_device(PyObject* /*self*/, PyObject* args) {
+  int device;
+  if (!PyArg_ParseTuple(args, "i", &device))
+    return nullptr;
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = spacemouse::SpaceMouseDaemon::instance().removeDevice(device);
+  Py_END_ALLOW_THREADS
+  return PyBool_FromLong(ok);
+}
+
+static PyObject* get_devices(PyObject* /*self*/, PyObject* /*args*/) {
+  const auto& smDaemon = spacemouse::SpaceMouseDaemon::instance();
+  PyObject* devices = PyList_New(0);
+  if (devices == nullptr)
+    return nullptr;
+  for (int device = 0; device < spacemouse::kMaxDevices; ++device) {
+    if (!smDaemon.hasDevice(device))
+      continue;
+    PyObject* entry = Py_BuildValue("{s:i,s:s,s:s,s:O}", "device", device, "source",
+                                    smDaemon.deviceSource(device).c_str(), "layout",
+                                    smDaemon.deviceProfile(device).name, "open",
+                                    smDaemon.isDeviceOpen(device) ? Py_True : Py_False);
+    if (entry == nullptr || PyList_Append(devices, entry) != 0) {
+      Py_XDECREF(entry);
+      Py_DECREF(devices);
+      return nullptr;
+    }
+    Py_DECREF(entry);
+  }
+  return devices;
+}
+
+static PyObject* use_evdev(PyObject* /*self*/, PyObject* args) {
+  const char* path;
+  if (!PyArg_ParseTuple(args, "z", &path))
+    return nullptr;
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = spacemouse::SpaceMouseDaemon::instance().useEvdev(path);
+  Py_END_ALLOW_THREADS
+  return PyBool_FromLong(ok);
+}
+
+static PyObject* publish_state(PyObject* /*self*/, PyObject* args) {
+  const char* name;
+  if (!PyArg_ParseTuple(args, "z", &name))
+    return nullptr;
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = spacemouse::SpaceMouseDaemon::instance().publishState(name);
+  Py_END_ALLOW_THREADS
+  return PyBool_FromLong(ok);
+}
+
+/** Segment sampled by read_shared_state, usually in another process than the publisher */
+static spacemouse::SpaceMouseSharedStateReader sharedStateReader;
+
+static PyObject* open_shared_state(PyObject* /*self*/, PyObject* args) {
+  const char* name;
+  if (!PyArg_ParseTuple(args, "s", &name))
+    return nullptr;
+  return PyBool_FromLong(sharedStateReader.open(name));
+}
+
+static PyObject* read_shared_state(PyObject* /*self*/, PyObject* args) {
+  int device = 0;
+  if (!PyArg_ParseTuple(args, "|i", &device))
+    return nullptr;
+  spacemouse::SpaceMouseSharedStateSample sample;
+  if (!sharedStateReader.read(device, sample)) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return Py_BuildValue("(KL(iiiiii)Ii)", static_cast<unsigned long long>(sample.sequence),
+                       static_cast<long long>(sample.timestamp), sample.axes[0], sample.axes[1],
+                       sample.axes[2], sample.axes[3], sample.axes[4], sample.axes[5],
+                       static_cast<unsigned int>(sample.buttons), sample.modifiers);
+}
 
+static PyObject* close_shared_state(PyObject* /*self*/, PyObject* /*args*/) {
+  sharedStateReader.close();
   Py_INCREF(Py_None);
   return Py_None;
 }
 
+/** Names of the scheduling policies, indexed by spacemouse::SpaceMouseSchedulingPolicy */
+static const char* const kSchedulingPolicies[] = {"default", "nice", "fifo", "rr"};
+
+static PyObject* set_reader_scheduling(PyObject* /*self*/, PyObject* args) {
+  const char* policyName;
+  spacemouse::SpaceMouseReaderScheduling scheduling;
+  PyObject* pyCpus = Py_None;
+  int lockMemory = 0;
+  if (!PyArg_ParseTuple(args, "s|iOp", &policyName, &scheduling.priority, &pyCpus, &lockMemory))
+    return nullptr;
+  int policy = 0;
+  while (policy < 4 && std::strcmp(policyName, kSchedulingPolicies[policy]) != 0) ++policy;
+  if (policy == 4) {
+    PyErr_SetString(PyExc_ValueError, "Policy must be 'default', 'nice', 'fifo' or 'rr'!");
+    return nullptr;
+  }
+  scheduling.policy = static_cast<spacemouse::SpaceMouseSchedulingPolicy>(policy);
+  if (pyCpus != Py_None) {
+    PyObject* cpus = PySequence_Fast(pyCpus, "cpus must be a sequence of cpu numbers!");
+    if (cpus == nullptr)
+      return nullptr;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(cpus); ++i) {
+      const long cpu = PyLong_AsLong(PySequence_Fast_GET_ITEM(cpus, i));
+      if (cpu < 0 || cpu > 63) {
+        if (!PyErr_Occurred())
+          PyErr_SetString(PyExc_ValueError, "cpus must be between 0 and 63!");
+        Py_DECREF(cpus);
+        return nullptr;
+      }
+      scheduling.cpus |= uint64_t(1) << cpu;
+    }
+    Py_DECREF(cpus);
+  }
+  scheduling.lockMemory = lockMemory != 0;
+  const spacemouse::SpaceMouseSchedulingPolicy applied =
+      spacemouse::SpaceMouseDaemon::instance().setReaderScheduling(scheduling);
+  return PyUnicode_FromString(kSchedulingPolicies[applied]);
+}
+
+static PyObject* get_reader_scheduling(PyObject* /*self*/, PyObject* /*args*/) {
+  const auto& smDaemon = spacemouse::SpaceMouseDaemon::instance();
+  const spacemouse::SpaceMouseReaderScheduling& scheduling = smDaemon.readerScheduling();
+  PyObject* cpus = PyList_New(0);
+  if (cpus == nullptr)
+    return nullptr;
+  for (int cpu = 0; cpu < 64; ++cpu) {
+    if (((scheduling.cpus >> cpu) & 1) == 0)
+      continue;
+    PyObject* pyCpu = PyLong_FromLong(cpu);
+    if (pyCpu == nullptr || PyList_Append(cpus, pyCpu) != 0) {
+      Py_XDECREF(pyCpu);
+      Py_DECREF(cpus);
+      return nullptr;
+    }
+    Py_DECREF(pyCpu);
+  }
+  return Py_BuildValue("{s:s,s:s,s:i,s:N,s:O}",
+                       "policy", kSchedulingPolicies[scheduling.policy],
+                       "applied", kSchedulingPolicies[smDaemon.readerPolicy()],
+                       "priority", scheduling.priority,
+                       "cpus", cpus,
+                       "lock_memory", scheduling.lockMemory ? Py_True : Py_False);
+}
+
+static PyObject* set_jitter_probe(PyObject* /*self*/, PyObject* args) {
+  long long interval;
+  if (!PyArg_ParseTuple(args, "L", &interval))
+    return nullptr;
+  spacemouse::SpaceMouseDaemon::instance().setJitterProbe(interval);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject* get_wakeup_jitter(PyObject* /*self*/, PyObject* /*args*/) {
+  return histogramToDict(spacemouse::SpaceMouseDaemon::instance().wakeupJitter());
+}
+#endif  // WITH_LIBSPACENAV
+
 #ifdef WITH_LIB3DX_WIN
 static PyObject* set_window_handle(PyObject* /*self*/, PyObject* args) {
   HWND winId;
@@ -147,13 +1027,32 @@ static PyObject* process_win_event(PyObject* /*self*/, PyObject* args) {
 
 static const char* docSetLogger =
   "Sets the logger function that will be used for printing logging information regarding the"
-  " spacemouse\n"
+  " spacemouse. Messages are queued by the threads of the daemon and passed to the logger by"
+  " flush_log on the calling thread, which dispatch_events and drain_events do as well.\n"
   "\n"
   "Parameters:\n"
   "logFun (function(str) -> None): Callback function that is called to log space mouse activity\n"
+  "with_level (bool): Pass the level ('debug', 'info', 'warning' or 'error') as additional first"
+    " argument to logFun (default: False)\n"
+  "\n"
+  "Returns:\n"
+  "None";
+static const char* docSetLogLevel =
+  "Drops the log messages below the given level. Debug messages are only compiled into debug"
+  " builds.\n"
+  "\n"
+  "Parameters:\n"
+  "level (str): 'debug', 'info', 'warning' or 'error'\n"
   "\n"
   "Returns:\n"
   "None";
+static const char* docFlushLog =
+  "Passes the queued log messages to the logger on the calling thread. Call it regularly (e.g."
+  " from a timer) if neither dispatch_events nor drain_events are, since up to 256 messages are"
+  " kept, further ones are dropped and counted in a warning.\n"
+  "\n"
+  "Returns:\n"
+  "int: Number of messages passed on";
 static const char* docStart =
   "Starts the space mouse daemon in the background\n"
   "\n"
@@ -164,6 +1063,10 @@ static const char* docStart =
     "The callback that is executed when a button is pressed\n"
   "buttonReleaseCallback (function(int, int) -> None):"
     "The callback that is executed when a button is released\n"
+  "with_device (bool): Pass the id of the device (see add_device) as additional last argument to"
+    " the callbacks (default: False)\n"
+  "as_events (bool): Pass a single MoveEvent or ButtonEvent to the callbacks instead, which are"
+    " reused instead of boxing the arguments of every event (default: False)\n"
   "\n"
   "Returns:\n"
   "None";
@@ -173,6 +1076,315 @@ static const char* docRelease =
   "\n"
   "Returns:\n"
   "None";
+static const char* docSetCoalescingWindow =
+  "Sets the window during which consecutive move events are merged into a single call of the"
+  " move callback. Button events are never merged and keep their order relative to the motion.\n"
+  "\n"
+  "Parameters:\n"
+  "milliseconds (int): Length of the window. With 0 only the move events that piled up while the"
+  " move callback was busy are merged\n"
+  "\n"
+  "Returns:\n"
+  "None";
+static const char* docSetFilterChain =
+  "Replaces the filters every motion sample passes before it is delivered. The filters run on the"
+  " thread reading the space mouse, samples whose filtered axes are all 0 cause no move callback"
+  " at all.\n"
+  "\n"
+  "Parameters:\n"
+  "stages (list(tuple)): The filters in the order they are applied, each one of"
+  " ('deadzone', threshold, hysteresis=0), ('ema', alpha) and"
+  " ('one_euro', min_cutoff=1.0, beta=0.0, d_cutoff=1.0). An empty list disables filtering\n"
+  "\n"
+  "Returns:\n"
+  "None";
+static const char* docSetPullMode =
+  "Switches between calling the callbacks passed to start_spacemouse_daemon (default) and keeping"
+  " the events queued until they are fetched with drain_events. Only supported on Linux, the other"
+  " platforms always call the callbacks.\n"
+  "\n"
+  "Parameters:\n"
+  "enabled (bool): Whether the events are fetched with drain_events\n"
+  "\n"
+  "Returns:\n"
+  "None";
+static const char* docSetFrameSampling =
+  "Switches between delivering the motion as move events (default) and integrating it over time"
+  " for sample_motion, which is meant to be called once per rendered frame. Button events are"
+  " delivered as before. In pull mode the event fd (see get_event_fd) also becomes readable when"
+  " the space mouse starts moving after sample_motion reported it at rest. Only supported on"
+  " Linux.\n"
+  "\n"
+  "Parameters:\n"
+  "enabled (bool): Whether the motion is fetched with sample_motion\n"
+  "\n"
+  "Returns:\n"
+  "None";
+static const char* docSampleMotion =
+  "Fetches the motion since the previous call, extrapolated from the current deflection of the"
+  " cap to the time the frame will be presented. Errors of the extrapolation are corrected by the"
+  " next call. Only meaningful with set_frame_sampling(True).\n"
+  "\n"
+  "Parameters:\n"
+  "frame_time (int): Presentation time of the frame in ns of time.monotonic_ns()\n"
+  "\n"
+  "Returns:\n"
+  "tuple(float, ...) or None: tx, ty, tz, angle, axisX, axisY, axisZ as passed to the move"
+  " callback, but with the raw axes integrated over time (raw units times seconds). None if the"
+  " space mouse is at rest, then sampling can pause until the event fd becomes readable.";
+static const char* docDrainEvents =
+  "Fetches all events queued since the last call in pull mode (see set_pull_mode)\n"
+  "\n"
+  "Returns:\n"
+  "EventBatch: The events in the order in which they occurred. Motion events have type 0 and"
+  " carry the raw (summed) axes, button events have type 1 (press) or 2 (release) and carry the"
+  " button and the modifiers. Use numpy.asarray(batch) to process them without creating python"
+  " objects per event.";
+static const char* docDispatchEvents =
+  "Calls the callbacks passed to start_spacemouse_daemon for all queued events on the calling"
+  " thread (pull mode only, see set_pull_mode). Consecutive move events are merged into one call"
+  " of the move callback.\n"
+  "\n"
+  "Returns:\n"
+  "None";
+static const char* docGetEventFd =
+  "Returns a file descriptor that is readable while events are queued in pull mode. Watch it with"
+  " a QSocketNotifier (or asyncio's add_reader) and call dispatch_events or drain_events when it"
+  " becomes readable, so that no python code is run on the thread reading the space mouse.\n"
+  "\n"
+  "Returns:\n"
+  "int: The file descriptor, or -1 if the platform does not support pull mode";
+static const char* docGetBackpressure =
+  "Returns whether the consumer keeps up with the space mouse. While the move callback (or the"
+  " code calling drain_events) falls behind, the motion is merged on the thread reading the space"
+  " mouse for as long as the previous move event was not delivered, so that no backlog of stale"
+  " motion builds up. Once the consumer recovered, every move event is delivered again. Only"
+  " supported on Linux.\n"
+  "\n"
+  "Returns:\n"
+  "dict: 'mode' ('per_event' or 'merged'), the averages 'sample_interval' (between two samples of"
+  " the space mouse), 'callback' (time spent in the move callback) and 'lag' (age of the motion"
+  " when it is delivered) in ns, and 'switches', the number of mode changes (int)";
+static const char* docGetStats =
+  "Returns the statistics of the event pipeline collected since the start or reset_stats (only "
+  "if built with WITH_SPACEMOUSE_STATS, otherwise everything is 0)\n"
+  "\n"
+  "Returns:\n"
+  "dict: 'enabled' (bool), the counters 'received', 'dispatched', 'merged', 'dropped' and"
+  " 'filtered' (motion samples suppressed by the filter chain, int), and the histograms 'decode'"
+  " (decoding the packets of one read), 'queue_delay' (reading to dispatching an event),"
+  " 'callback' (time spent in a callback) and 'gil_wait' (waiting for the GIL before a"
+  " callback). Each histogram is a dict with 'count', 'sum', 'max', 'p50', 'p90', "
+  "'p99' and 'buckets', a list of (upper bound, count) tuples of the non-empty power of two "
+  "buckets. All durations are in ns, percentiles are bucket upper bounds.";
+
+static const char* docResetStats =
+  "Clears the statistics returned by get_stats\n"
+  "\n"
+  "Returns:\n"
+  "None";
+
+static const char* docOrbitCamera =
+  "Rotates the camera around the rotation center by one or more space mouse samples, using the"
+  " same free or constrained orbit as the python implementation\n"
+  "\n"
+  "Parameters:\n"
+  "matrix (numpy.ndarray): The 4x4 float64 camera transformation (Matrix.getData()), it is"
+  " updated in place\n"
+  "origin (tuple(float, float, float)): The rotation center\n"
+  "samples (list(tuple(float, float, float))): Raw rotation vectors (rx, ry, rz), i.e. angle"
+  " times axis of the move events, applied one after another\n"
+  "constrained (bool): Whether the constrained instead of the free orbit is used\n"
+  "scale (float): Factor converting the raw angles into radians\n"
+  "\n"
+  "Returns:\n"
+  "None";
+static const char* docFitSelection =
+  "Computes how the camera has to be moved to tightly fit the given meshes into the view, see "
+  "spacemouse::fitCamera\n"
+  "\n"
+  "Parameters:\n"
+  "meshes (list(tuple(numpy.ndarray, numpy.ndarray))): Vertices (float32 array of shape (n, 3),"
+  " MeshData.getVertices()) and world transformation (4x4 float64) of each mesh\n"
+  "view_matrix (numpy.ndarray): Inverse world transformation (4x4 float64) of the camera\n"
+  "perspective (bool): Whether the camera uses a perspective projection\n"
+  "tan_half_fov (tuple(float, float)): Tangents of the horizontal and vertical half field of "
+  "view (perspective only)\n"
+  "viewport (tuple(float, float)): Width and height of the viewport (orthographic only)\n"
+  "border (float): Border around the selection relative to its extents on each side\n"
+  "\n"
+  "Returns:\n"
+  "tuple(tuple(float, float, float), float): Translation of the camera in view space and new "
+  "zoom factor (orthographic only), or None if the meshes have no vertices";
+
+#ifdef WITH_LIBSPACENAV
+static const char* docStartRecording =
+  "Starts appending every packet received from spacenavd to a binary trace file (replacing a "
+  "running recording)\n"
+  "\n"
+  "Parameters:\n"
+  "path (str): The trace file, it is overwritten if it exists\n"
+  "\n"
+  "Returns:\n"
+  "bool: Whether the file could be created";
+
+static const char* docStopRecording =
+  "Stops the recording started with start_recording and closes the trace file\n"
+  "\n"
+  "Returns:\n"
+  "None";
+
+static const char* docReplayTrace =
+  "Disconnects from spacenavd and replays a trace recorded with start_recording through the "
+  "callbacks (or drain_events in pull mode) instead\n"
+  "\n"
+  "Parameters:\n"
+  "path (str): The trace file\n"
+  "real_time (bool): Replay with the recorded timing instead of as fast as possible "
+  "(default: False)\n"
+  "\n"
+  "Returns:\n"
+  "bool: Whether the trace could be read, otherwise the connection to spacenavd is restored";
+
+static const char* docWaitForReplay =
+  "Waits until all events of the replayed trace were queued, they may still be dispatched\n"
+  "\n"
+  "Returns:\n"
+  "None";
+
+static const char* docStopReplay =
+  "Stops replaying a trace and reconnects to spacenavd\n"
+  "\n"
+  "Returns:\n"
+  "None";
+
+static const char* docAddDevice =
+  "Reads a further space mouse from its evdev node (/dev/input/event*), besides device 0 (spacenavd"
+  " or the node set with use_evdev). All devices are read by the same thread, each has its own"
+  " modifier keys and filter history. The device is passed to the callbacks if the daemon was"
+  " started with with_device=True, and is found in the device field of drained events.\n"
+  "\n"
+  "Parameters:\n"
+  "path (str): The evdev node, or \"\" (default) for a space mouse that is not read yet\n"
+  "\n"
+  "Returns:\n"
+  "int: The id of the device, or None if the node could not be opened";
+
+static const char* docRemoveDevice =
+  "Stops reading a device added with add_device\n"
+  "\n"
+  "Parameters:\n"
+  "device (int): The id returned by add_device\n"
+  "\n"
+  "Returns:\n"
+  "bool: Whether there was such a device";
+
+static const char* docGetDevices =
+  "Lists the devices that are read\n"
+  "\n"
+  "Returns:\n"
+  "list(dict): One dict per device with its id (device), evdev node or 'spacenavd' (source), button"
+  " layout (layout), and whether it is read at the moment (open), e.g. not after it was unplugged";
+
+static const char* docUseEvdev =
+  "Reconnects, reading the space mouse directly from its evdev node (/dev/input/event*) instead "
+  "of from spacenavd, which saves a process hop per event. spacenavd must not grab the device.\n"
+  "\n"
+  "Parameters:\n"
+  "path (str): The evdev node, \"\" to use the first space mouse found, or None to go back to "
+  "spacenavd\n"
+  "\n"
+  "Returns:\n"
+  "bool: Whether the device is read from its evdev node, if it could not be opened spacenavd is "
+  "used again";
+
+static const char* docPublishState =
+  "Starts publishing the latest state of all devices to a POSIX shared memory segment, so that"
+  " other local processes can sample it with open_shared_state and read_shared_state instead of"
+  " connecting to the space mouse themselves. Restarts the thread reading the space mouse, a"
+  " running replay starts over.\n"
+  "\n"
+  "Parameters:\n"
+  "name (str): Name of the segment, e.g. '/spacemousetool', or None to stop publishing\n"
+  "\n"
+  "Returns:\n"
+  "bool: Whether the segment could be created, it fails if another process publishes to it";
+
+static const char* docOpenSharedState =
+  "Maps the segment of a process calling publish_state for read_shared_state, replacing the one"
+  " opened before. Works without starting the daemon.\n"
+  "\n"
+  "Parameters:\n"
+  "name (str): Name of the segment passed to publish_state\n"
+  "\n"
+  "Returns:\n"
+  "bool: Whether the segment exists and holds device states";
+
+static const char* docReadSharedState =
+  "Samples the latest state of a device from the segment opened with open_shared_state, without"
+  " locks or syscalls\n"
+  "\n"
+  "Parameters:\n"
+  "device (int): The device (default: 0)\n"
+  "\n"
+  "Returns:\n"
+  "tuple: (sequence, timestamp, (tx, ty, tz, rx, ry, rz), buttons, modifiers) with the number of"
+  " updates so far, the time of the last one (like time.monotonic_ns()), the filtered axes, a bit"
+  " per button held down and the modifier keys held down. None if no segment is open, there is"
+  " no such device, or the publisher died while writing.";
+
+static const char* docCloseSharedState =
+  "Unmaps the segment opened with open_shared_state\n"
+  "\n"
+  "Returns:\n"
+  "None";
+
+static const char* docSetReaderScheduling =
+  "Changes how the thread reading the space mouse is scheduled, so that the input stays responsive"
+  " while slicing keeps all cores busy. Takes effect right away, or when the daemon is started.\n"
+  "Real-time policies need CAP_SYS_NICE or an RLIMIT_RTPRIO (e.g. set in limits.conf), without"
+  " them the nice value is raised instead, as far as RLIMIT_NICE allows. Failures are logged.\n"
+  "\n"
+  "Parameters:\n"
+  "policy (str): 'default', 'nice', 'fifo' (SCHED_FIFO) or 'rr' (SCHED_RR)\n"
+  "priority (int): The real-time priority (1 to 99) for 'fifo' and 'rr', the nice value (-20 to"
+  " 19) for 'nice'\n"
+  "cpus (list(int)): The cpus the thread may run on, None (default) for those of the process\n"
+  "lock_memory (bool): Lock the memory of the backend and the stack of the thread into RAM"
+  " (default: False)\n"
+  "\n"
+  "Returns:\n"
+  "str: The policy the thread got, which differs from the requested one after a fallback";
+
+static const char* docGetReaderScheduling =
+  "Returns the scheduling requested with set_reader_scheduling\n"
+  "\n"
+  "Returns:\n"
+  "dict: The requested policy, priority, cpus and lock_memory, and the policy the thread actually"
+  " got (applied)";
+
+static const char* docSetJitterProbe =
+  "Starts measuring the wakeup jitter of the thread reading the space mouse: a timer expiring"
+  " every interval is watched along with the devices, and the delay between its expiry and the"
+  " thread waking up is recorded (like cyclictest). This is the delay an event suffers before it"
+  " is read, so it shows whether the input stays responsive under load. Costs a wakeup per"
+  " interval, so it is meant for measuring only.\n"
+  "\n"
+  "Parameters:\n"
+  "interval (int): Interval of the timer in nanoseconds, 0 to stop. Starting clears the"
+  " measurements.\n"
+  "\n"
+  "Returns:\n"
+  "None";
+
+static const char* docGetWakeupJitter =
+  "Returns the wakeup delays measured since set_jitter_probe\n"
+  "\n"
+  "Returns:\n"
+  "dict: count, sum, max, p50, p90, p99 (in nanoseconds) and the non-empty buckets as (upper"
+  " limit, count), like the histograms of get_stats";
+#endif  // WITH_LIBSPACENAV
+
 #ifdef WITH_LIB3DX_WIN
 static const char* docSetHwnd =
   "Sets the hwnd window handle\n"
@@ -193,8 +1405,42 @@ static const char* docProcessWinEvent =
 
 static PyMethodDef SpaceMouseMethods[] = {
     {"set_logger", set_logger, METH_VARARGS, docSetLogger},
+    {"set_log_level", set_log_level, METH_VARARGS, docSetLogLevel},
+    {"flush_log", flush_log, METH_NOARGS, docFlushLog},
     {"start_spacemouse_daemon", start_spacemouse_daemon, METH_VARARGS, docStart},
     {"release_spacemouse_daemon", release_spacemouse_daemon, METH_NOARGS, docRelease},
+    {"set_coalescing_window", set_coalescing_window, METH_VARARGS, docSetCoalescingWindow},
+    {"set_filter_chain", set_filter_chain, METH_VARARGS, docSetFilterChain},
+    {"set_pull_mode", set_pull_mode, METH_VARARGS, docSetPullMode},
+    {"set_frame_sampling", set_frame_sampling, METH_VARARGS, docSetFrameSampling},
+    {"sample_motion", sample_motion, METH_VARARGS, docSampleMotion},
+    {"drain_events", drain_events, METH_NOARGS, docDrainEvents},
+    {"dispatch_events", dispatch_events, METH_NOARGS, docDispatchEvents},
+    {"get_event_fd", get_event_fd, METH_NOARGS, docGetEventFd},
+    {"get_backpressure", get_backpressure, METH_NOARGS, docGetBackpressure},
+    {"get_stats", get_stats, METH_NOARGS, docGetStats},
+    {"reset_stats", reset_stats, METH_NOARGS, docResetStats},
+    {"orbit_camera", orbit_camera, METH_VARARGS, docOrbitCamera},
+    {"fit_selection", fit_selection, METH_VARARGS, docFitSelection},
+#ifdef WITH_LIBSPACENAV
+    {"start_recording", start_recording, METH_VARARGS, docStartRecording},
+    {"stop_recording", stop_recording, METH_NOARGS, docStopRecording},
+    {"replay_trace", replay_trace, METH_VARARGS, docReplayTrace},
+    {"wait_for_replay", wait_for_replay, METH_NOARGS, docWaitForReplay},
+    {"stop_replay", stop_replay, METH_NOARGS, docStopReplay},
+    {"use_evdev", use_evdev, METH_VARARGS, docUseEvdev},
+    {"publish_state", publish_state, METH_VARARGS, docPublishState},
+    {"open_shared_state", open_shared_state, METH_VARARGS, docOpenSharedState},
+    {"read_shared_state", read_shared_state, METH_VARARGS, docReadSharedState},
+    {"close_shared_state", close_shared_state, METH_NOARGS, docCloseSharedState},
+    {"add_device", add_device, METH_VARARGS, docAddDevice},
+    {"remove_device", remove_device, METH_VARARGS, docRemoveDevice},
+    {"get_devices", get_devices, METH_NOARGS, docGetDevices},
+    {"set_reader_scheduling", set_reader_scheduling, METH_VARARGS, docSetReaderScheduling},
+    {"get_reader_scheduling", get_reader_scheduling, METH_NOARGS, docGetReaderScheduling},
+    {"set_jitter_probe", set_jitter_probe, METH_VARARGS, docSetJitterProbe},
+    {"get_wakeup_jitter", get_wakeup_jitter, METH_NOARGS, docGetWakeupJitter},
+#endif  // WITH_LIBSPACENAV
 #ifdef WITH_LIB3DX_WIN
     {"set_window_handle", set_window_handle, METH_VARARGS, docSetHwnd},
     {"process_win_event", process_win_event, METH_VARARGS, docProcessWinEvent},
@@ -205,6 +1451,47 @@ static PyMethodDef SpaceMouseMethods[] = {
 static struct PyModuleDef PySpaceMouseModule = {PyModuleDef_HEAD_INIT, "pyspacemouse", nullptr, -1,
                                                 SpaceMouseMethods};
 
-PyMODINIT_FUNC PyInit_pyspacemouse(void) { return PyModule_Create(&PySpaceMouseModule); }
+PyMODINIT_FUNC PyInit_pyspacemouse(void) {
+  EventBatchType.tp_basicsize = sizeof(EventBatch);
+  EventBatchType.tp_flags = Py_TPFLAGS_DEFAULT;
+  EventBatchType.tp_doc = docEventBatch;
+  EventBatchType.tp_as_buffer = &EventBatchBufferProcs;
+  EventBatchType.tp_as_sequence = &EventBatchSequenceMethods;
+  if (PyType_Ready(&EventBatchType) < 0)
+    return nullptr;
+  MoveEventType.tp_basicsize = sizeof(MoveEventObject);
+  MoveEventType.tp_flags = Py_TPFLAGS_DEFAULT;
+  MoveEventType.tp_doc = docMoveEvent;
+  MoveEventType.tp_members = MoveEventMembers;
+  if (PyType_Ready(&MoveEventType) < 0)
+    return nullptr;
+  ButtonEventType.tp_basicsize = sizeof(ButtonEventObject);
+  ButtonEventType.tp_flags = Py_TPFLAGS_DEFAULT;
+  ButtonEventType.tp_doc = docButtonEvent;
+  ButtonEventType.tp_members = ButtonEventMembers;
+  if (PyType_Ready(&ButtonEventType) < 0)
+    return nullptr;
+
+  PyObject* module = PyModule_Create(&PySpaceMouseModule);
+  if (module == nullptr)
+    return nullptr;
+  const char* names[] = {"EventBatch", "MoveEvent", "ButtonEvent"};
+  PyTypeObject* types[] = {&EventBatchType, &MoveEventType, &ButtonEventType};
+  for (int i = 0; i < 3; ++i) {
+    Py_INCREF(types[i]);
+    if (PyModule_AddObject(module, names[i], reinterpret_cast<PyObject*>(types[i])) < 0) {
+      Py_DECREF(types[i]);
+      Py_DECREF(module);
+      return nullptr;
+    }
+  }
+  // tells the plugin that the buttons are numbered as in SpaceMouseButton, which older builds
+  // did not
+  if (PyModule_AddIntConstant(module, "SPMB_UNDEFINED", spacemouse::SPMB_UNDEFINED) < 0) {
+    Py_DECREF(module);
+    return nullptr;
+  }
+  return module;
+}
 
 } // extern "C"
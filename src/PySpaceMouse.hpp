@@ -0,0 +1,39 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef PYSPACEMOUSE_HPP
+#define PYSPACEMOUSE_HPP
+
+#include <Python.h>
+
+#include <functional>
+
+#include "SpaceMouse.hpp"
+
+/*--------------------------------------------------------------------------*/
+/* Python callbacks                                                         */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Wraps a python callable into a move callback for SpaceMouseDaemon. The callable is
+ * called with (tx, ty, tz, angle, axisX, axisY, axisZ) while holding the GIL, which is acquired
+ * by the callback, so it may be called from any thread. If withDevice is set, the device of the
+ * event (see SpaceMouseEvent::device) is passed as additional last argument. If asEvent is set,
+ * the callable is called with a single pyspacemouse.MoveEvent instead, which is reused for later
+ * events. The callback holds a reference to the callable, the GIL must be held to create it.
+ */
+std::function<void(spacemouse::SpaceMouseMoveEvent)> pythonMoveCallback(PyObject* callable,
+                                                                        bool withDevice = false,
+                                                                        bool asEvent = false);
+
+/**
+ * @brief Wraps a python callable into a button press or release callback for SpaceMouseDaemon.
+ * The callable is called with (button, modifiers), (button, modifiers, device) or a
+ * pyspacemouse.ButtonEvent, see pythonMoveCallback().
+ */
+std::function<void(spacemouse::SpaceMouseButtonEvent)> pythonButtonCallback(
+    PyObject* callable, bool withDevice = false, bool asEvent = false);
+
+/** @brief Creates the module, which also readies its types (for embedding the interpreter) */
+PyMODINIT_FUNC PyInit_pyspacemouse(void);
+
+#endif  // PYSPACEMOUSE_HPP
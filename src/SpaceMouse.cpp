@@ -3,196 +3,1464 @@
 
 #include "SpaceMouse.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdarg>
+#include <cstdio>
 #include <iostream>
 
+#ifdef WITH_LIBSPACENAV
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <future>
+#endif  // WITH_LIBSPACENAV
+
 namespace spacemouse {
 
-std::function<void(const char*)> logFun =
-  std::function<void(const char*)>([](const char*){return;});
+// the domain has to outlive the callbacks published through it
+SpaceMouseRcu callbackRcu;
+
+SpaceMouseCallback<const SpaceMouseLogRecord &> logFun;
+
+SpaceMouseLogRing logRing;
+
+SpaceMouseStats pipelineStats;
+
+/*--------------------------------------------------------------------------*/
+/* Pipeline statistics                                                      */
+/*--------------------------------------------------------------------------*/
+int64_t SpaceMouseHistogram::percentile(double percent) const {
+  uint64_t total = 0;
+  uint64_t counts[kBuckets];
+  for (int i = 0; i < kBuckets; ++i) total += counts[i] = bucket(i);
+  if (total == 0)
+    return 0;
+  const double rank = percent / 100.0 * static_cast<double>(total);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += counts[i];
+    if (static_cast<double>(seen) >= rank && counts[i] != 0)
+      return i == 0 ? 0 : bucketLimit(i);
+  }
+  return bucketLimit(kBuckets - 1);
+}
+
+void SpaceMouseStats::reset() {
+  for (int i = 0; i < SPMC_COUNT; ++i) {
+    mReader.counters[i].store(0, std::memory_order_relaxed);
+    mDispatch.counters[i].store(0, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < SPMH_COUNT; ++i) mHistograms[i].reset();
+}
+
+/*--------------------------------------------------------------------------*/
+/* Asynchronous logging                                                     */
+/*--------------------------------------------------------------------------*/
+const std::size_t SpaceMouseLogRing::kCapacity;
+
+SpaceMouseLogRing::SpaceMouseLogRing()
+    : mTail(0), mDropped(0), mLevel(SPML_DEBUG), mHead(0), mReportedDropped(0) {
+  for (std::size_t i = 0; i < kCapacity; ++i)
+    mSlots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+void SpaceMouseLogRing::log(int level, const char *format, ...) {
+  std::size_t position = mTail.load(std::memory_order_relaxed);
+  Slot *slot;
+  for (;;) {
+    slot = &mSlots[position & (kCapacity - 1)];
+    const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    const std::ptrdiff_t difference =
+        static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+    if (difference == 0) {
+      // the slot is free, claim it unless another producer was faster
+      if (mTail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        break;
+    } else if (difference < 0) {
+      // the slot still holds the message from one round ago, i.e. the ring is full
+      mDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = mTail.load(std::memory_order_relaxed);
+    }
+  }
+
+  SpaceMouseLogRecord &record = slot->record;
+  record.timestamp = monotonicTime();
+  record.level = level;
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(record.text, SpaceMouseLogRecord::kTextSize, format, arguments);
+  va_end(arguments);
+  slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+std::size_t SpaceMouseLogRing::flush() {
+  std::unique_lock<std::mutex> lock(mFlushMutex, std::try_to_lock);
+  if (!lock.owns_lock())
+    return 0;
+  // only what was queued so far, so that busy producers cannot keep us here
+  const std::size_t end = mTail.load(std::memory_order_relaxed);
+  std::size_t count = 0;
+  while (mHead != end) {
+    Slot &slot = mSlots[mHead & (kCapacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != mHead + 1)
+      break;  // still being written, passed on by the next flush()
+    logFun(slot.record);
+    slot.sequence.store(mHead + kCapacity, std::memory_order_release);
+    ++mHead;
+    ++count;
+  }
+
+  const uint64_t dropped = mDropped.load(std::memory_order_relaxed);
+  if (dropped != mReportedDropped) {
+    SpaceMouseLogRecord record;
+    record.timestamp = monotonicTime();
+    record.level = SPML_WARNING;
+    snprintf(record.text, sizeof(record.text), "%llu log messages dropped",
+             static_cast<unsigned long long>(dropped - mReportedDropped));
+    mReportedDropped = dropped;
+    logFun(record);
+    ++count;
+  }
+  return count;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Spacemouse events                                                        */
+/*--------------------------------------------------------------------------*/
+SpaceMouseMoveEvent SpaceMouseMoveEvent::fromAxes(int tx, int ty, int tz, double rx, double ry,
+                                                  double rz) {
+  SpaceMouseMoveEvent moveEvent;
+
+  // set translation
+  moveEvent.tx = tx;
+  moveEvent.ty = ty;
+  moveEvent.tz = tz;
+
+  // compute and set angle = norm of the rotation axis
+  moveEvent.angle = sqrt(rx * rx + ry * ry + rz * rz);
+
+  // set (normalized) rotation axis
+  if (moveEvent.angle == 0) {
+    moveEvent.axisX = 0;
+    moveEvent.axisY = 0;
+    moveEvent.axisZ = 1;
+  } else {
+    moveEvent.axisX = rx / moveEvent.angle;
+    moveEvent.axisY = ry / moveEvent.angle;
+    moveEvent.axisZ = rz / moveEvent.angle;
+  }
+  return moveEvent;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Button decoding                                                          */
+/*--------------------------------------------------------------------------*/
+// Button numbers of the devices. 3Dconnexion numbers the buttons of all its devices alike (the
+// menu key is always 0, the top view key always 2, ...), so that the models only differ in which
+// of the buttons they have.
+
+/** Devices with a left (menu) and a right (fit) button only */
+static constexpr SpaceMouseButtonCode kButtonsTwoButtons[] = {{0, SPMB_MENU}, {1, SPMB_FIT}};
+
+/** SpaceMouse Pro (Wireless) and Enterprise, the latter has further buttons not supported yet */
+static constexpr SpaceMouseButtonCode kButtonsPro[] = {
+    {0, SPMB_MENU},     {1, SPMB_FIT},   {2, SPMB_TOP},    {4, SPMB_RIGHT},    {5, SPMB_FRONT},
+    {8, SPMB_ROLL_CW},  {12, SPMB_1},    {13, SPMB_2},     {14, SPMB_3},       {15, SPMB_4},
+    {22, SPMB_ESC},     {23, SPMB_ALT},  {24, SPMB_SHIFT}, {25, SPMB_CTRL},    {26, SPMB_LOCK_ROT}};
+
+static constexpr SpaceMouseDeviceProfile kDeviceProfiles[] = {
+    {SPMD_SPACENAVIGATOR, "SpaceNavigator", makeButtonMap(kButtonsTwoButtons)},
+    {SPMD_COMPACT, "SpaceMouse Compact", makeButtonMap(kButtonsTwoButtons)},
+    {SPMD_WIRELESS, "SpaceMouse Wireless", makeButtonMap(kButtonsTwoButtons)},
+    {SPMD_PRO, "SpaceMouse Pro", makeButtonMap(kButtonsPro)},
+    {SPMD_PRO_WIRELESS, "SpaceMouse Pro Wireless", makeButtonMap(kButtonsPro)},
+    {SPMD_ENTERPRISE, "SpaceMouse Enterprise", makeButtonMap(kButtonsPro)}};
+
+/** USB product ids of the devices, the vendor is either 3Dconnexion or Logitech */
+static const struct {
+  unsigned productId;
+  SpaceMouseDeviceModel model;
+} kDeviceProducts[] = {{0xc626, SPMD_SPACENAVIGATOR}, {0xc628, SPMD_SPACENAVIGATOR},
+                       {0xc635, SPMD_COMPACT},        {0xc62e, SPMD_WIRELESS},
+                       {0xc62f, SPMD_WIRELESS},       {0xc62b, SPMD_PRO},
+                       {0xc631, SPMD_PRO_WIRELESS},   {0xc632, SPMD_PRO_WIRELESS},
+                       {0xc652, SPMD_PRO_WIRELESS},   {0xc633, SPMD_ENTERPRISE}};
+
+static const unsigned kVendor3Dconnexion = 0x256f;
+static const unsigned kVendorLogitech = 0x046d;
+
+const SpaceMouseDeviceProfile *findDeviceProfile(unsigned vendorId, unsigned productId) {
+  if (vendorId != kVendor3Dconnexion && vendorId != kVendorLogitech)
+    return nullptr;
+  for (const auto &product : kDeviceProducts) {
+    if (product.productId == productId)
+      return &kDeviceProfiles[product.model];
+  }
+  return nullptr;
+}
+
+const SpaceMouseDeviceProfile &defaultDeviceProfile() { return kDeviceProfiles[SPMD_PRO_WIRELESS]; }
+
+/*--------------------------------------------------------------------------*/
+/* Queue passing events from the device thread to the consumer             */
+/*--------------------------------------------------------------------------*/
+SpaceMouseEvent SpaceMouseEvent::motion(int64_t timestamp, const int axes[6], int device) {
+  SpaceMouseEvent event = {};
+  event.timestamp = timestamp;
+  for (int i = 0; i < 6; ++i) event.axes[i] = saturateAxis(axes[i]);
+  event.type = SPME_MOTION;
+  event.device = static_cast<uint8_t>(device);
+  return event;
+}
+
+SpaceMouseEvent SpaceMouseEvent::buttonEvent(SpaceMouseEventType type, int64_t timestamp,
+                                             const SpaceMouseButtonEvent &buttonEvent) {
+  SpaceMouseEvent event = {};
+  event.timestamp = timestamp;
+  event.type = static_cast<uint8_t>(type);
+  event.button = static_cast<uint8_t>(buttonEvent.button);
+  event.modifiers = static_cast<uint8_t>(buttonEvent.modifierKeys.modifiers());
+  event.device = static_cast<uint8_t>(buttonEvent.device);
+  return event;
+}
+
+SpaceMouseButtonEvent SpaceMouseEvent::buttonEvent() const {
+  return {static_cast<SpaceMouseButton>(button),
+          SpaceMouseModifierKeys(SpaceMouseModifierKey(modifiers)), device};
+}
+
+SpaceMouseEventQueue::SpaceMouseEventQueue()
+    : mOverflowHead(0), mOverflowCount(0), mOverflows(0), mMerged(0), mDropped(0) {}
+
+bool SpaceMouseEventQueue::flushOverflow() {
+  while (mOverflowCount != 0) {
+    if (!mRing.tryPush(mOverflow[mOverflowHead]))
+      return false;
+    mOverflowHead = (mOverflowHead + 1) % kOverflowCapacity;
+    --mOverflowCount;
+  }
+  return true;
+}
+
+bool SpaceMouseEventQueue::push(const SpaceMouseEvent &event) {
+  // older overflowed events have to go first to keep the order
+  if (flushOverflow() && mRing.tryPush(event))
+    return true;
+
+  mOverflows.fetch_add(1, std::memory_order_relaxed);
+  if (mOverflowCount != 0) {
+    SpaceMouseEvent &last = mOverflow[(mOverflowHead + mOverflowCount - 1) % kOverflowCapacity];
+    if (event.type == SPME_MOTION && last.type == SPME_MOTION && event.device == last.device) {
+      // latest wins: sum up the motion instead of occupying a further slot
+      for (int i = 0; i < 6; ++i) last.axes[i] = saturateAxis(last.axes[i] + event.axes[i]);
+      last.timestamp = event.timestamp;
+      mMerged.fetch_add(1, std::memory_order_relaxed);
+      SPACEMOUSE_STATS(pipelineStats.countRead(SPMC_MERGED);)
+      return false;
+    }
+  }
+  if (mOverflowCount == kOverflowCapacity) {
+    mDropped.fetch_add(1, std::memory_order_relaxed);
+    SPACEMOUSE_STATS(pipelineStats.countRead(SPMC_DROPPED);)
+    return false;
+  }
+  mOverflow[(mOverflowHead + mOverflowCount) % kOverflowCapacity] = event;
+  ++mOverflowCount;
+  return true;
+}
+
+std::size_t SpaceMouseEventBatch::append(const SpaceMouseEvent *events, std::size_t count) {
+  count = std::min(count, kCapacity - mSize);
+  for (std::size_t i = 0; i < count; ++i) {
+    const SpaceMouseEvent &event = events[i];
+    const std::size_t j = mSize + i;
+    mTimestamps[j] = event.timestamp;
+    for (int axis = 0; axis < 6; ++axis) mAxes[axis][j] = event.axes[axis];
+    mTypes[j] = event.type;
+    mButtons[j] = event.button;
+    mModifiers[j] = event.modifiers;
+    mDevices[j] = event.device;
+  }
+  mSize += count;
+  return count;
+}
+
+SpaceMouseEvent SpaceMouseEventBatch::event(std::size_t i) const {
+  SpaceMouseEvent event = {};
+  event.timestamp = mTimestamps[i];
+  for (int axis = 0; axis < 6; ++axis) event.axes[axis] = mAxes[axis][i];
+  event.type = mTypes[i];
+  event.button = mButtons[i];
+  event.modifiers = mModifiers[i];
+  event.device = mDevices[i];
+  return event;
+}
+
+std::size_t SpaceMouseEventBatch::motionEnd(std::size_t begin) const {
+  std::size_t end = begin;
+  while (end < mSize && mTypes[end] == SPME_MOTION && mDevices[end] == mDevices[begin]) ++end;
+  return end;
+}
+
+void SpaceMouseEventBatch::sumAxes(std::size_t begin, std::size_t end, int sums[6]) const {
+  for (int axis = 0; axis < 6; ++axis) {
+    const int16_t *values = mAxes[axis];
+    int sum = 0;
+    for (std::size_t i = begin; i < end; ++i) sum += values[i];
+    sums[axis] = sum;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+/* Backpressure between the device thread and the consumer                  */
+/*--------------------------------------------------------------------------*/
+const int64_t SpaceMouseBackpressure::kMaxInterval;
+const unsigned SpaceMouseBackpressure::kTimingPeriod;
+
+/** @brief Exponential moving average with a weight of 1/8, starting at the first value */
+static int64_t movingAverage(int64_t average, int64_t value) {
+  return average == 0 ? value : average + (value - average) / 8;
+}
+
+SpaceMouseBackpressure::SpaceMouseBackpressure()
+    : mLastSample(0),
+      mSampleInterval(0),
+      mQueuedMotion(0),
+      mTakenMotion(0),
+      mDeliveries(0),
+      mCallbackTime(0),
+      mLag(0),
+      mMode(SPMD_PER_EVENT),
+      mSwitches(0) {}
+
+void SpaceMouseBackpressure::recordSample(int64_t timestamp) {
+  const int64_t interval = timestamp - mLastSample;
+  mLastSample = timestamp;
+  if (interval <= 0 || interval > kMaxInterval)
+    return;
+  mSampleInterval.store(movingAverage(mSampleInterval.load(std::memory_order_relaxed), interval),
+                        std::memory_order_relaxed);
+}
+
+bool SpaceMouseBackpressure::recordDelivery(int64_t callbackTime, int64_t lag) {
+  int64_t callback = mCallbackTime.load(std::memory_order_relaxed);
+  if (callbackTime > 0) {
+    callback = movingAverage(callback, callbackTime);
+    mCallbackTime.store(callback, std::memory_order_relaxed);
+  }
+  const int64_t averageLag = movingAverage(mLag.load(std::memory_order_relaxed), lag);
+  mLag.store(averageLag, std::memory_order_relaxed);
+
+  const int64_t interval = mSampleInterval.load(std::memory_order_relaxed);
+  if (interval == 0)
+    return false;  // no idea of the rate of the device yet
+  SpaceMouseDeliveryMode mode = mMode.load(std::memory_order_relaxed);
+  if (mode == SPMD_PER_EVENT && (callback > interval || averageLag > 2 * interval))
+    mode = SPMD_MERGED;
+  else if (mode == SPMD_MERGED && callback < interval / 2 && averageLag < interval)
+    mode = SPMD_PER_EVENT;
+  else
+    return false;
+  mMode.store(mode, std::memory_order_relaxed);
+  mSwitches.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
 /*--------------------------------------------------------------------------*/
 /* Abstract base class defining core functionality of spacemouse            */
 /*--------------------------------------------------------------------------*/
 SpaceMouseAbstract::SpaceMouseAbstract()
     : mInitialized(false),
-      mMoveCallback([](SpaceMouseMoveEvent) {}),
-      mButtonPressCallback([](SpaceMouseButtonEvent) {}),
-      mButtonReleaseCallback([](SpaceMouseButtonEvent) {}) {}
+      mPullMode(false),
+      mCoalescingWindow(0),
+      mFilterChanged(false),
+      mFrameSampling(false) {}
 
 SpaceMouseAbstract::~SpaceMouseAbstract() {}
 
+void SpaceMouseAbstract::dispatchEvents() {
+  SpaceMouseEvent events[SpaceMouseEventBatch::kCapacity];
+  SpaceMouseMotionAccumulator motion;
+  int64_t motionTimestamp = 0;
+  int motionDevice = 0;
+  std::size_t count;
+  while ((count = mEventQueue.pop(events, SpaceMouseEventBatch::kCapacity)) != 0) {
+    SPACEMOUSE_STATS(
+      const int64_t now = monotonicTime();
+      for (std::size_t i = 0; i < count; ++i)
+        pipelineStats.record(SPMH_QUEUE_DELAY, now - events[i].timestamp);
+    )
+    mDispatchBatch.clear();
+    mDispatchBatch.append(events, count);
+    // the device thread may queue motion again while we are busy with these
+    uint64_t taken = 0;
+    for (std::size_t i = 0; i < count; ++i) taken += mDispatchBatch.types()[i] == SPME_MOTION;
+    mBackpressure.motionTaken(taken);
+    std::size_t i = 0;
+    while (i < count) {
+      if (mDispatchBatch.types()[i] == SPME_MOTION) {
+        // the motion of different devices is never merged
+        if (!motion.isEmpty() && mDispatchBatch.devices()[i] != motionDevice) {
+          dispatchMotion(motion, motionTimestamp, motionDevice);
+          motion.clear();
+        }
+        // sum up the whole run of motion at once, it may continue in the next batch
+        const std::size_t end = mDispatchBatch.motionEnd(i);
+        int sums[6];
+        mDispatchBatch.sumAxes(i, end, sums);
+        motion.add(sums, static_cast<int>(end - i));
+        motionTimestamp = mDispatchBatch.timestamps()[end - 1];
+        motionDevice = mDispatchBatch.devices()[i];
+        i = end;
+        continue;
+      }
+      // keep the order of motion and button events
+      if (!motion.isEmpty()) {
+        dispatchMotion(motion, motionTimestamp, motionDevice);
+        motion.clear();
+      }
+      SPACEMOUSE_STATS(const int64_t start = monotonicTime();)
+      if (mDispatchBatch.types()[i] == SPME_BUTTON_PRESS)
+        mButtonPressCallback(events[i].buttonEvent());
+      else
+        mButtonReleaseCallback(events[i].buttonEvent());
+      SPACEMOUSE_STATS(pipelineStats.record(SPMH_CALLBACK, monotonicTime() - start);
+                       pipelineStats.countDispatch(SPMC_DISPATCHED);)
+      ++i;
+    }
+  }
+  if (!motion.isEmpty())
+    dispatchMotion(motion, motionTimestamp, motionDevice);
+  // free the callbacks that were replaced while they were running
+  if (callbackRcu.hasRetired())
+    callbackRcu.reclaim();
+  rearmEventFd();
+}
+
+void SpaceMouseAbstract::dispatchMotion(const SpaceMouseMotionAccumulator &motion,
+                                        int64_t timestamp, int device) {
+  bool timed = mBackpressure.timeNextDelivery();
+  SPACEMOUSE_STATS(
+    pipelineStats.countDispatch(SPMC_MERGED, static_cast<uint64_t>(motion.count() - 1));
+    timed = true;
+  )
+  const int64_t start = timed ? monotonicTime() : 0;
+  SpaceMouseMoveEvent event = motion.moveEvent();
+  event.device = device;
+  mMoveCallback(event);
+  if (!timed)
+    return;
+  const int64_t end = monotonicTime();
+  SPACEMOUSE_STATS(pipelineStats.record(SPMH_CALLBACK, end - start);
+                   pipelineStats.countDispatch(SPMC_DISPATCHED);)
+  if (mBackpressure.recordDelivery(end - start, start - timestamp))
+    logDeliveryMode();
+}
+
+void SpaceMouseAbstract::logDeliveryMode() {
+  SPACEMOUSE_LOG(SPML_INFO, "%s (callback %lld us, lag %lld us)",
+                 mBackpressure.mode() == SPMD_MERGED ? "Consumer falls behind, merging motion"
+                                                     : "Consumer caught up, queueing every motion",
+                 static_cast<long long>(mBackpressure.callbackTime() / 1000),
+                 static_cast<long long>(mBackpressure.lag() / 1000));
+}
+
+bool SpaceMouseAbstract::setFilterChain(const SpaceMouseFilterStage *stages, int count) {
+  std::lock_guard<std::mutex> lock(mFilterMutex);
+  if (!mPendingFilter.configure(stages, count))
+    return false;
+  mFilterChanged.store(true, std::memory_order_release);
+  return true;
+}
+
+bool SpaceMouseAbstract::filterMotion(int axes[6], int64_t timestamp, int device) {
+  if (mFilterChanged.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(mFilterMutex);
+    for (SpaceMouseDeviceState &state : mDevices) state.filter = mPendingFilter;
+    mFilterChanged.store(false, std::memory_order_relaxed);
+  }
+  if (mDevices[device].filter.apply(axes, timestamp))
+    return true;
+  SPACEMOUSE_STATS(pipelineStats.countRead(SPMC_FILTERED);)
+  return false;
+}
+
+void SpaceMouseAbstract::setDeviceProfile(const SpaceMouseDeviceProfile &profile, int device) {
+  mDevices[device].profile.store(&profile, std::memory_order_relaxed);
+  if (device == 0)
+    SPACEMOUSE_LOG(SPML_INFO, "Button layout: %s", profile.name);
+  else
+    SPACEMOUSE_LOG(SPML_INFO, "Button layout of device %d: %s", device, profile.name);
+}
+
+std::size_t SpaceMouseAbstract::drainEvents(SpaceMouseEvent *events, std::size_t maxEvents) {
+  if (!mPullMode)
+    return 0;  // the queue belongs to the dispatcher
+  const std::size_t count = mEventQueue.pop(events, maxEvents);
+  rearmEventFd();
+  uint64_t taken = 0;
+  int64_t motionTimestamp = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    if (events[i].type == SPME_MOTION) {
+      ++taken;
+      motionTimestamp = events[i].timestamp;
+    }
+  }
+  if (taken > 0) {
+    mBackpressure.motionTaken(taken);
+    // what the caller does with the events is unknown, only the lag tells whether it keeps up
+    if (mBackpressure.recordDelivery(0, monotonicTime() - motionTimestamp))
+      logDeliveryMode();
+  }
+  SPACEMOUSE_STATS(
+    const int64_t now = monotonicTime();
+    for (std::size_t i = 0; i < count; ++i)
+      pipelineStats.record(SPMH_QUEUE_DELAY, now - events[i].timestamp);
+    pipelineStats.countDispatch(SPMC_DISPATCHED, count);
+  )
+  return count;
+}
+
 #ifdef WITH_LIBSPACENAV
 /*--------------------------------------------------------------------------*/
 /* Spacemouse support using libspacenav                                     */
 /*--------------------------------------------------------------------------*/
-enum SpaceMouseButtonSpnav {
-  // buttons on the 3DConnexion Spacemouse Wireles Pro
-  SPMB_SPNAV_TOP = 2,
-  SPMB_SPNAV_RIGHT = 4,
-  SPMB_SPNAV_FRONT = 5,
-  SPMB_SPNAV_ROLL_CW = 8,
-  SPMB_SPNAV_LOCK_ROT = 26,
-  SPMB_SPNAV_1 = 12,
-  SPMB_SPNAV_2 = 13,
-  SPMB_SPNAV_3 = 14,
-  SPMB_SPNAV_4 = 15,
-  SPMB_SPNAV_ESC = 22,
-  SPMB_SPNAV_SHIFT = 24,
-  SPMB_SPNAV_CTRL = 25,
-  SPMB_SPNAV_ALT = 23,
-  SPMB_SPNAV_MENU = 0,
-  SPMB_SPNAV_FIT = 1
-
-  // if you own an other spacemouse feel free to add further buttons
-};
-
-void SpaceMouseSpnav::ProcessEvent(spnav_event sev) {
-  if (sev.type == SPNAV_EVENT_MOTION) {
-    SpaceMouseMoveEvent moveEvent;
-    double axis[3];
-
-    // set translation
-    moveEvent.tx = sev.motion.x;
-    moveEvent.ty = sev.motion.y;
-    moveEvent.tz = sev.motion.z;
-
-    axis[0] = sev.motion.rx;
-    axis[1] = sev.motion.ry;
-    axis[2] = sev.motion.rz;
-
-    // compute and set angle = norm of the rotation axis
-    moveEvent.angle = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
-
-    // set (normalized) rotation axis
-    if (moveEvent.angle == 0) {
-      moveEvent.axisX = 0;
-      moveEvent.axisY = 0;
-      moveEvent.axisZ = 1;
+SpaceMouseWakeup::SpaceMouseWakeup() : mPipe{-1, -1}, mWaiting(false) {}
+
+SpaceMouseWakeup::~SpaceMouseWakeup() { close(); }
+
+bool SpaceMouseWakeup::open() {
+  if (pipe(mPipe) == -1) {
+    mPipe[0] = mPipe[1] = -1;
+    return false;
+  }
+  for (int i = 0; i < 2; ++i) {
+    fcntl(mPipe[i], F_SETFD, FD_CLOEXEC);
+    fcntl(mPipe[i], F_SETFL, fcntl(mPipe[i], F_GETFL) | O_NONBLOCK);
+  }
+  mWaiting = false;
+  return true;
+}
+
+void SpaceMouseWakeup::close() {
+  for (int i = 0; i < 2; ++i) {
+    if (mPipe[i] != -1)
+      ::close(mPipe[i]);
+    mPipe[i] = -1;
+  }
+}
+
+void SpaceMouseWakeup::notify() {
+  // a full pipe is fine, the waiting thread is going to wake up anyway
+  const char wakeup = 0;
+  while (write(mPipe[1], &wakeup, 1) == -1 && errno == EINTR) {}
+}
+
+void SpaceMouseWakeup::notifyIfWaiting() {
+  // pairs with the fence in prepareWait(): either the waiting thread sees the work published
+  // before this call, or we see that it is waiting
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (mWaiting.load(std::memory_order_relaxed) && mWaiting.exchange(false))
+    notify();
+}
+
+void SpaceMouseWakeup::prepareWait() {
+  mWaiting.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void SpaceMouseWakeup::clear() {
+  mWaiting = false;
+  char buffer[64];
+  while (read(mPipe[0], buffer, sizeof(buffer)) > 0) {}
+}
+
+/**
+ * @brief Looks for a space mouse among the input devices in sysfs, spacenavd does not tell which
+ * device it is connected to
+ * @param eventNode If not null, gets the evdev node of the device
+ * @param skip      If set, devices whose evdev node it returns true for are skipped
+ * @return The profile of the first device found, nullptr if there is none
+ */
+static const SpaceMouseDeviceProfile *findInputDevice(
+    std::string *eventNode, const std::function<bool(const std::string &)> &skip = nullptr) {
+  const char *inputDir = "/sys/class/input";
+  DIR *dir = opendir(inputDir);
+  if (dir == nullptr)
+    return nullptr;
+  const SpaceMouseDeviceProfile *profile = nullptr;
+  while (profile == nullptr) {
+    const dirent *entry = readdir(dir);
+    if (entry == nullptr)
+      break;
+    if (std::strncmp(entry->d_name, "event", 5) != 0)
+      continue;
+    const std::string node = std::string("/dev/input/") + entry->d_name;
+    if (skip && skip(node))
+      continue;
+    unsigned ids[2] = {0, 0};
+    const char *names[2] = {"vendor", "product"};
+    for (int i = 0; i < 2; ++i) {
+      char path[300];
+      snprintf(path, sizeof(path), "%s/%s/device/id/%s", inputDir, entry->d_name, names[i]);
+      if (FILE *file = fopen(path, "r")) {
+        if (fscanf(file, "%x", &ids[i]) != 1)
+          ids[i] = 0;
+        fclose(file);
+      }
+    }
+    profile = findDeviceProfile(ids[0], ids[1]);
+    if (profile != nullptr && eventNode != nullptr)
+      *eventNode = node;
+  }
+  closedir(dir);
+  return profile;
+}
+
+void SpaceMouseSpnav::ProcessEvent(const SpaceMouseSpnavPacket &packet, int device) {
+  Source &source = mSources[device];
+  if (packet.type == SPNAV_PACKET_MOTION) {
+    const int64_t now = monotonicTime();
+    mBackpressure.recordSample(now);
+    int axes[6];
+    for (int i = 0; i < 6; ++i) axes[i] = packet.data[i];
+    const bool keep = filterMotion(axes, now, device);
+    // the filtered sample at rest as well, readers would otherwise keep the last deflection
+    if (mStatePublisher.isOpen())
+      mStatePublisher.publishMotion(device, now, axes);
+    if (mFrameSampling.load(std::memory_order_relaxed)) {
+      // the sampler needs the samples at rest as well, to know when the motion stopped. Each
+      // device holds its deflection until its next sample, so the sampler gets their sum.
+      int sum[6] = {0, 0, 0, 0, 0, 0};
+      for (int i = 0; i < 6; ++i) source.sampledAxes[i] = axes[i];
+      for (const Source &other : mSources)
+        for (int i = 0; i < 6; ++i) sum[i] += other.sampledAxes[i];
+      if (mFrameSampler.add(sum, now))
+        mDispatchWakeup.notify();
+      return;
+    }
+    if (!keep)
+      return;
+    // only collect the motion here, it is passed on by FlushSource()
+    if (source.pendingMotion.isEmpty())
+      source.pendingSince = std::chrono::steady_clock::now();
+    source.pendingTimestamp = now;
+    source.pendingMotion.add(axes);
+  } else if (packet.type == SPNAV_PACKET_PRESS || packet.type == SPNAV_PACKET_RELEASE) {
+    // keep the order of motion and button events
+    FlushSource(device);
+
+    const bool pressed = packet.type == SPNAV_PACKET_PRESS;
+    const int64_t now = monotonicTime();
+    const SpaceMouseButtonEvent event = buttonEvent(packet.data[0], pressed, device);
+    if (mStatePublisher.isOpen())
+      mStatePublisher.publishButton(device, now, event.button, pressed,
+                                    static_cast<int>(event.modifierKeys.modifiers()));
+    mEventQueue.push(SpaceMouseEvent::buttonEvent(pressed ? SPME_BUTTON_PRESS : SPME_BUTTON_RELEASE,
+                                                  now, event));
+  }
+}
+
+void SpaceMouseSpnav::FlushSource(int device) {
+  SpaceMouseMotionAccumulator &motion = mSources[device].pendingMotion;
+  if (motion.isEmpty())
+    return;
+  const SpaceMouseEvent event =
+      SpaceMouseEvent::motion(mSources[device].pendingTimestamp, motion.axes(), device);
+  SPACEMOUSE_STATS(pipelineStats.countRead(SPMC_MERGED,
+                                           static_cast<uint64_t>(motion.count() - 1));)
+  motion.clear();
+  // motion merged into an overflowed event is taken together with it, so only counts once
+  if (mEventQueue.push(event))
+    mBackpressure.motionQueued();
+}
+
+void SpaceMouseSpnav::FlushMotion() {
+  for (int device = 0; device < kMaxDevices; ++device) FlushSource(device);
+}
+
+static_assert(kSharedStateDevices >= kMaxDevices, "the shared state has to hold all devices");
+
+const int SpaceMouseSpnav::kMinReconnectDelay;
+const int SpaceMouseSpnav::kMaxReconnectDelay;
+
+SpaceMouseSpnav &SpaceMouseSpnav::instance() {
+  static SpaceMouseSpnav pInstance;
+  return pInstance;
+}
+
+void SpaceMouseSpnav::Run() {
+  // a single epoll set for the wakeup pipe, the jitter probe and the sources of all devices, each
+  // entry carries its device (or kMaxDevices for the wakeup pipe, kMaxDevices + 1 for the probe)
+  const int epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll == -1) {
+    SPACEMOUSE_LOG(SPML_ERROR, "Could not create epoll instance for spacenav reader");
+    return;
+  }
+  epoll_event entry;
+  entry.events = EPOLLIN;
+  entry.data.u32 = kMaxDevices;
+  epoll_ctl(epoll, EPOLL_CTL_ADD, mReaderWakeup.fd(), &entry);
+  if (mJitterTimer != -1) {
+    // expirations while nobody was waiting would count as huge delays
+    uint64_t expirations;
+    if (read(mJitterTimer, &expirations, sizeof(expirations)) < 0) {}
+    entry.data.u32 = kMaxDevices + 1;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, mJitterTimer, &entry);
+  }
+  // further devices that were unplugged meanwhile are skipped
+  for (int device = 1; device < kMaxDevices; ++device)
+    if (hasDevice(device) && !mSources[device].open.load(std::memory_order_relaxed))
+      OpenEvdev(device);
+  for (int device = 0; device < kMaxDevices; ++device) {
+    if (!mSources[device].open.load(std::memory_order_relaxed))
+      continue;
+    entry.data.u32 = static_cast<uint32_t>(device);
+    epoll_ctl(epoll, EPOLL_CTL_ADD, SourceFd(device), &entry);
+  }
+
+  // device 0 is connected right away if it is not yet, then with exponential backoff. Only the
+  // first failure in a row is reported.
+  std::chrono::milliseconds reconnectDelay(kMinReconnectDelay);
+  std::chrono::steady_clock::time_point reconnectTime = std::chrono::steady_clock::now();
+  bool reportFailure = true;
+  bool closing = false;
+  while (!closing) {
+    // block until either a device sends something, the coalescing window of pending motion ends,
+    // or Close() wakes us up
+    const std::chrono::milliseconds window(mCoalescingWindow.load());
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    bool pending = false;
+    int timeout = -1;
+    for (const Source &source : mSources) {
+      if (source.pendingMotion.isEmpty())
+        continue;
+      pending = true;
+      auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+          source.pendingSince + window - now);
+      // round up, otherwise we would spin during the last millisecond of the window
+      const int wait =
+          remaining.count() > 0 ? static_cast<int>((remaining.count() + 999) / 1000) : 0;
+      timeout = timeout < 0 ? wait : std::min(timeout, wait);
+    }
+    if (!mSources[0].open.load(std::memory_order_relaxed)) {
+      const auto remaining =
+          std::chrono::duration_cast<std::chrono::microseconds>(reconnectTime - now);
+      const int wait =
+          remaining.count() > 0 ? static_cast<int>((remaining.count() + 999) / 1000) : 0;
+      timeout = timeout < 0 ? wait : std::min(timeout, wait);
+    }
+    const bool hold = pending && mBackpressure.holdMotion();
+    if (hold)
+      timeout = 1;  // the consumer is behind, check again whether it took the previous motion
+    else if (mEventQueue.hasOverflow() && (timeout < 0 || timeout > 1))
+      timeout = 1;  // retry to hand over the overflowed events once the dispatcher made space
+    // a button event may queue the pending motion as well, so it needs two free slots. Without
+    // them the events stay with the devices until the dispatcher caught up, they are never
+    // dropped. The sources are level triggered, so only the wakeup pipe (and the jitter probe)
+    // are watched meanwhile.
+    epoll_event ready[kMaxDevices + 2];
+    int count;
+    if (mEventQueue.overflowSpace() >= 2) {
+      count = epoll_wait(epoll, ready, kMaxDevices + 2, timeout);
     } else {
-      moveEvent.axisX = axis[0] / moveEvent.angle;
-      moveEvent.axisY = axis[1] / moveEvent.angle;
-      moveEvent.axisZ = axis[2] / moveEvent.angle;
+      pollfd fds[2] = {{mReaderWakeup.fd(), POLLIN, 0}, {mJitterTimer, POLLIN, 0}};
+      count = poll(fds, mJitterTimer != -1 ? 2 : 1, timeout);
+      if (count > 0) {
+        count = 0;
+        for (uint32_t i = 0; i < 2; ++i) {
+          if ((fds[i].revents & POLLIN) == 0)
+            continue;
+          ready[count].events = EPOLLIN;
+          ready[count++].data.u32 = kMaxDevices + i;
+        }
+      }
+    }
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      SPACEMOUSE_LOG(SPML_ERROR, "epoll_wait on spacenav sources failed");
+      break;
     }
 
-    // call the callback with that event
-    mMoveCallback(std::move(moveEvent));
-  } else if (sev.type == SPNAV_EVENT_BUTTON) {
-    SpaceMouseButton bnum = SPMB_UNDEFINED;
-    switch (sev.button.bnum) {
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_TOP:
-        bnum = SPMB_TOP;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_RIGHT:
-        bnum = SPMB_RIGHT;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_FRONT:
-        bnum = SPMB_FRONT;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_LOCK_ROT:
-        bnum = SPMB_LOCK_ROT;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_ROLL_CW:
-        bnum = SPMB_ROLL_CW;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_1:
-        bnum = SPMB_1;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_2:
-        bnum = SPMB_2;
+    for (int i = 0; i < count && !closing; ++i) {
+      const int device = static_cast<int>(ready[i].data.u32);
+      if (device == kMaxDevices) {
+        closing = true;  // Close() requested
         break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_3:
-        bnum = SPMB_3;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_4:
-        bnum = SPMB_4;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_ESC:
-        bnum = SPMB_ESC;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_SHIFT:
-        bnum = SPMB_SHIFT;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_CTRL:
-        bnum = SPMB_CTRL;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_ALT:
-        bnum = SPMB_ALT;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_MENU:
-        bnum = SPMB_MENU;
-        break;
-      case SpaceMouseButtonSpnav::SPMB_SPNAV_FIT:
-        bnum = SPMB_FIT;
-        break;
-      default:
-        bnum = SPMB_UNDEFINED;
+      }
+      if (device == kMaxDevices + 1) {
+        ReadJitterProbe();
+        continue;
+      }
+      // drain every event that is pending on the source before sleeping again, motion events are
+      // merged until the coalescing window is over (or right away if there is no window). Each
+      // read fetches as many packets as we can queue for sure, usually all pending ones.
+      bool gone = (ready[i].events & EPOLLERR) != 0;
+      while (mEventQueue.overflowSpace() >= 2) {
+        const std::size_t maxPackets = mEventQueue.overflowSpace() / 2;
+        const SpaceMouseSpnavPacket *packets;
+        int received = Receive(device, packets, maxPackets);
+        if (received < 0)
+          gone = true;
+        else if (received > 0 && device == 0 && mRecording.load(std::memory_order_relaxed))
+          Record(packets, static_cast<std::size_t>(received));
+        SPACEMOUSE_STATS(const int64_t start = monotonicTime();)
+        for (int j = 0; j < received; ++j) ProcessEvent(packets[j], device);
+        SPACEMOUSE_STATS(if (received > 0) {
+          pipelineStats.record(SPMH_DECODE, monotonicTime() - start);
+          pipelineStats.countRead(SPMC_RECEIVED, static_cast<uint64_t>(received));
+        })
+        if (received < static_cast<int>(maxPackets))
+          break;
+      }
+      if (!gone)
+        continue;
+      // keep reading the other devices, passing on what we got before the connection broke
+      epoll_ctl(epoll, EPOLL_CTL_DEL, SourceFd(device), nullptr);
+      CloseSource(device);
+      if (device == 0) {
+        SPACEMOUSE_LOG(SPML_WARNING, "Lost connection to %s, reconnecting",
+                       mUseEvdev ? "the space mouse" : "spacenavd");
+        reconnectDelay = std::chrono::milliseconds(kMinReconnectDelay);
+        reconnectTime = std::chrono::steady_clock::now() + reconnectDelay;
+        reportFailure = true;
+      } else {
+        SPACEMOUSE_LOG(SPML_WARNING, "Lost connection to device %d", device);
+      }
+    }
+    if (closing)
+      break;
+    if (!mSources[0].open.load(std::memory_order_relaxed) &&
+        std::chrono::steady_clock::now() >= reconnectTime) {
+      if (Connect(reportFailure)) {
+        entry.data.u32 = 0;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, SourceFd(0), &entry);
+        reconnectDelay = std::chrono::milliseconds(kMinReconnectDelay);
+        reportFailure = true;
+      } else {
+        reconnectTime = std::chrono::steady_clock::now() + reconnectDelay;
+        reconnectDelay =
+            std::min(reconnectDelay * 2, std::chrono::milliseconds(kMaxReconnectDelay));
+        reportFailure = false;
+      }
+    }
+    // while the consumer is behind, keep merging until it took the previous motion event
+    if (!mBackpressure.holdMotion()) {
+      const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+      for (int device = 0; device < kMaxDevices; ++device) {
+        if (window.count() == 0 || end >= mSources[device].pendingSince + window)
+          FlushSource(device);
+      }
+    }
+    mEventQueue.flushOverflow();
+    mDispatchWakeup.notifyIfWaiting();
+  }
+  ::close(epoll);
+}
+
+void SpaceMouseSpnav::Replay() {
+  // traces only hold the packets of device 0
+  const Source &source = mSources[0];
+  const SpaceMouseTraceRecord *records = mTraceReader.records();
+  const std::size_t count = mTraceReader.recordCount();
+  // shift the recorded times to now
+  const int64_t offset = count > 0 ? monotonicTime() - records[0].timestamp : 0;
+
+  std::size_t i = 0;
+  while (i < count && !mStopReplay) {
+    if (mReplayRealTime) {
+      // pass on merged motion whose coalescing window ends before the next batch
+      const int64_t due = records[i].timestamp + offset;
+      const int64_t windowEnd =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              source.pendingSince.time_since_epoch()).count() +
+          static_cast<int64_t>(mCoalescingWindow.load()) * 1000000;
+      if (!source.pendingMotion.isEmpty() && windowEnd < due) {
+        if (!SleepUntil(windowEnd))
+          break;
+        FlushMotion();
+        mEventQueue.flushOverflow();
+        mDispatchWakeup.notifyIfWaiting();
+      }
+      if (!SleepUntil(due))
         break;
     }
-    if (sev.button.press) {
-      if (bnum == SPMB_SHIFT)
-        mModifiers.add(SpaceMouseModifierKey::SPMM_SHIFT);
-      else if (bnum == SPMB_CTRL)
-        mModifiers.add(SpaceMouseModifierKey::SPMM_CTRL);
-      else if (bnum == SPMB_ALT)
-        mModifiers.add(SpaceMouseModifierKey::SPMM_ALT);
-      mButtonPressCallback({bnum, mModifiers});
-    } else {
-      if (bnum == SPMB_SHIFT)
-        mModifiers.remove(SpaceMouseModifierKey::SPMM_SHIFT);
-      else if (bnum == SPMB_CTRL)
-        mModifiers.remove(SpaceMouseModifierKey::SPMM_CTRL);
-      else if (bnum == SPMB_ALT)
-        mModifiers.remove(SpaceMouseModifierKey::SPMM_ALT);
-      mButtonReleaseCallback({bnum, mModifiers});
+
+    // the records of one recv() share their timestamp, replay them as one batch like Run() does
+    const int64_t batch = records[i].timestamp;
+    while (i < count && records[i].timestamp == batch && !mStopReplay) {
+      if (mEventQueue.overflowSpace() < 2) {
+        // same as Run(): wait for the dispatcher instead of dropping anything
+        mEventQueue.flushOverflow();
+        mDispatchWakeup.notifyIfWaiting();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      ProcessEvent(records[i].packet);
+      SPACEMOUSE_STATS(pipelineStats.countRead(SPMC_RECEIVED);)
+      ++i;
     }
+    if (!mReplayRealTime || mCoalescingWindow.load() == 0)
+      FlushMotion();
+    mEventQueue.flushOverflow();
+    mDispatchWakeup.notifyIfWaiting();
+  }
+
+  FlushMotion();
+  while (mEventQueue.hasOverflow() && !mStopReplay) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    mEventQueue.flushOverflow();
+    mDispatchWakeup.notifyIfWaiting();
   }
+  mDispatchWakeup.notifyIfWaiting();
+  SPACEMOUSE_LOG(SPML_INFO, "Replay finished");
 }
 
-SpaceMouseSpnav &SpaceMouseSpnav::instance() {
-  static SpaceMouseSpnav pInstance;
-  return pInstance;
+bool SpaceMouseSpnav::SleepUntil(int64_t time) {
+  // sleep in slices, so that Close() does not have to wait for long pauses of the trace
+  const int64_t kSlice = 10000000;
+  int64_t now = monotonicTime();
+  while (now < time && !mStopReplay) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(time - now, kSlice)));
+    now = monotonicTime();
+  }
+  return !mStopReplay;
+}
+
+void SpaceMouseSpnav::Record(const SpaceMouseSpnavPacket *packets, std::size_t count) {
+  std::lock_guard<std::mutex> lock(mTraceMutex);
+  mTraceWriter.append(monotonicTime(), packets, count);
+}
+
+bool SpaceMouseSpnav::startRecording(const char *path) {
+  std::lock_guard<std::mutex> lock(mTraceMutex);
+  bool ok = mTraceWriter.open(path);
+  mRecording = ok;
+  return ok;
+}
+
+void SpaceMouseSpnav::stopRecording() {
+  mRecording = false;
+  std::lock_guard<std::mutex> lock(mTraceMutex);
+  mTraceWriter.close();
+}
+
+bool SpaceMouseSpnav::startReplay(const char *path, bool realTime) {
+  Close();
+  mReplayRealTime = realTime;
+  bool ok = mTraceReader.open(path);
+  if (!ok)
+    SPACEMOUSE_LOG(SPML_ERROR, "Could not read trace file");
+  // replays the trace if it could be opened, reconnects to spacenavd otherwise
+  Initialize();
+  return ok;
+}
+
+void SpaceMouseSpnav::waitForReplay() {
+  if (mTraceReader.isOpen() && mThread) {
+    mThread->join();
+    mThread.reset();
+  }
+}
+
+void SpaceMouseSpnav::stopReplay() {
+  if (!mTraceReader.isOpen())
+    return;
+  Close();
+  mTraceReader.close();
+  Initialize();
+}
+
+bool SpaceMouseSpnav::publishState(const char *name) {
+  // the reader thread is the only writer of the segment
+  const bool reading = static_cast<bool>(mThread);
+  if (reading)
+    StopReader();
+  mStatePublisher.close();
+  const bool ok = name == nullptr || mStatePublisher.open(name);
+  if (!ok)
+    SPACEMOUSE_LOG(SPML_WARNING, "Could not publish the device state to %s: %s", name,
+                   std::strerror(errno));
+  else if (name != nullptr)
+    SPACEMOUSE_LOG(SPML_INFO, "Publishing the device state to %s", name);
+  if (reading)
+    StartReader();
+  return ok;
+}
+
+bool SpaceMouseSpnav::useEvdev(const char *path) {
+  Close();
+  mUseEvdev = path != nullptr;
+  mSources[0].path = path != nullptr ? path : "";
+  // opened right away to tell whether the node works, the reader thread reopens it when lost
+  if (mUseEvdev && !OpenEvdev(0))
+    mUseEvdev = false;
+  Initialize();
+  return mUseEvdev;
+}
+
+bool SpaceMouseSpnav::Connect(bool report) {
+  if (mUseEvdev)
+    return OpenEvdev(0, report);
+  if (!mClient.open()) {
+    SPACEMOUSE_LOG(report ? SPML_WARNING : SPML_DEBUG,
+                   "Could not connect to spacenavd (%s), retrying", std::strerror(errno));
+    return false;
+  }
+  SPACEMOUSE_LOG(SPML_INFO, "Connected to spacenavd");
+  const SpaceMouseDeviceProfile *profile = findInputDevice(nullptr);
+  setDeviceProfile(profile != nullptr ? *profile : defaultDeviceProfile());
+  mSources[0].open = true;
+  return true;
+}
+
+bool SpaceMouseSpnav::OpenEvdev(int device, bool report) {
+  Source &source = mSources[device];
+  std::string path = source.path;
+  // do not pick a node another device reads already
+  auto isOpen = [this, device](const std::string &node) {
+    for (int other = 0; other < kMaxDevices; ++other)
+      if (other != device && mSources[other].open && mSources[other].node == node)
+        return true;
+    return false;
+  };
+  if (path.empty() && findInputDevice(&path, isOpen) == nullptr) {
+    SPACEMOUSE_LOG(report ? SPML_WARNING : SPML_DEBUG, "No space mouse found in /dev/input");
+    return false;
+  }
+  if (!source.evdev.open(path.c_str())) {
+    SPACEMOUSE_LOG(report ? SPML_WARNING : SPML_DEBUG, "Could not open %s: %s", path.c_str(),
+                   std::strerror(errno));
+    return false;
+  }
+  if (device == 0)
+    SPACEMOUSE_LOG(SPML_INFO, "Reading the space mouse from %s", path.c_str());
+  else
+    SPACEMOUSE_LOG(SPML_INFO, "Reading device %d from %s", device, path.c_str());
+  // further devices stick to the node found, device 0 searches again when reconnecting
+  if (device != 0)
+    source.path = path;
+  source.node = path;
+  const SpaceMouseDeviceProfile *profile =
+      findDeviceProfile(source.evdev.vendor(), source.evdev.product());
+  setDeviceProfile(profile != nullptr ? *profile : defaultDeviceProfile(), device);
+  source.open = true;
+  return true;
+}
+
+void SpaceMouseSpnav::CloseSource(int device) {
+  Source &source = mSources[device];
+  FlushSource(device);
+  if (device == 0)
+    mClient.close();
+  source.evdev.close();
+  source.open = false;
+  if (mStatePublisher.isOpen())
+    mStatePublisher.publishReset(device, monotonicTime());
+  std::fill(source.sampledAxes, source.sampledAxes + 6, 0);
+}
+
+int SpaceMouseSpnav::addDevice(const char *path) {
+  int device = 1;
+  while (device < kMaxDevices && hasDevice(device)) ++device;
+  if (device == kMaxDevices) {
+    SPACEMOUSE_LOG(SPML_WARNING, "Could not add device, too many devices");
+    return -1;
+  }
+  // the reader thread owns the sources, so it has to be stopped while they change. A replay
+  // only reads device 0, the device is read once it is over.
+  const bool reading = mInitialized && !mTraceReader.isOpen();
+  if (reading)
+    StopReader();
+  mSources[device].path = path;
+  mDevices[device].modifiers = SpaceMouseModifierKeys();
+  mDevices[device].filter.reset();
+  const bool ok = OpenEvdev(device);
+  if (!ok)
+    mSources[device].path.clear();
+  if (reading)
+    StartReader();
+  return ok ? device : -1;
+}
+
+bool SpaceMouseSpnav::removeDevice(int device) {
+  if (device == 0 || !hasDevice(device))
+    return false;
+  const bool reading = mInitialized && !mTraceReader.isOpen();
+  if (reading)
+    StopReader();
+  Source &source = mSources[device];
+  source.evdev.close();
+  source.open = false;
+  source.path.clear();
+  if (mStatePublisher.isOpen())
+    mStatePublisher.publishReset(device, monotonicTime());
+  source.node.clear();
+  source.pendingMotion.clear();
+  std::fill(source.sampledAxes, source.sampledAxes + 6, 0);
+  if (reading)
+    StartReader();
+  return true;
+}
+
+std::string SpaceMouseSpnav::deviceSource(int device) const {
+  if (!hasDevice(device))
+    return "";
+  if (device == 0 && !mUseEvdev)
+    return "spacenavd";
+  return mSources[device].node.empty() ? mSources[device].path : mSources[device].node;
+}
+
+void SpaceMouseSpnav::Dispatch() {
+  pollfd fds[1];
+  fds[0].fd = mDispatchWakeup.fd();
+  fds[0].events = POLLIN;
+
+  while (true) {
+    if (poll(fds, 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      SPACEMOUSE_LOG(SPML_ERROR, "poll on spacenav dispatch pipe failed");
+      return;
+    }
+    if (mStopDispatch)
+      return;
+    dispatchEvents();
+  }
+}
+
+void SpaceMouseSpnav::rearmEventFd() {
+  // consume the notifications and announce that we wait for the next one. Events queued before
+  // prepareWait() would not notify us, so keep the fd readable ourselves if there are any.
+  mDispatchWakeup.clear();
+  mDispatchWakeup.prepareWait();
+  if (!mEventQueue.isEmpty())
+    mDispatchWakeup.notify();
+}
+
+void SpaceMouseSpnav::StartDispatch() {
+  if (mDispatchThread)
+    return;
+  mStopDispatch = false;
+  rearmEventFd();
+  mDispatchThread =
+      std::unique_ptr<std::thread>(new std::thread(&SpaceMouseSpnav::Dispatch, this));
+}
+
+void SpaceMouseSpnav::StopDispatch() {
+  if (!mDispatchThread)
+    return;
+  mStopDispatch = true;
+  mDispatchWakeup.notify();
+  mDispatchThread->join();
+  mDispatchThread.reset();
+}
+
+void SpaceMouseSpnav::setPullMode(bool enabled) {
+  if (enabled == mPullMode)
+    return;
+  // the queue only has a single consumer, so the dispatcher has to be gone before we hand the
+  // events to drainEvents() (and vice versa)
+  if (enabled) {
+    StopDispatch();
+    mPullMode = true;
+    rearmEventFd();
+  } else {
+    mPullMode = false;
+    if (mInitialized)
+      StartDispatch();
+  }
 }
 
 void SpaceMouseSpnav::Initialize() {
-  #ifndef NDEBUG
-  logFun("Init Spnav");
-  #endif  // NDEBUG
+  SPACEMOUSE_LOG(SPML_DEBUG, "Init Spnav");
   if (!mInitialized) {
-    auto error = spnav_open();
-    mInitialized = (error != -1);
-    if (mInitialized) {
-      mThread = std::unique_ptr<std::thread>(new std::thread(
-          [](std::future<void> signalExit, std::function<void(spnav_event)> callback) {
-            spnav_event sev;
-            while (signalExit.wait_for(std::chrono::milliseconds(1)) ==
-                   std::future_status::timeout) {
-              if (spnav_poll_event(&sev)) {
-                callback(sev);
-              }
-            }
-          },
-          mSignalExit.get_future(),
-          std::bind(&SpaceMouseSpnav::ProcessEvent, this, std::placeholders::_1)));
+    // connecting is left to the reader thread, so that a missing spacenavd neither delays the
+    // caller nor stops us from connecting once it is started
+    mInitialized = mReaderWakeup.fd() != -1 && mDispatchWakeup.fd() != -1;
+    if (!mInitialized) {
+      SPACEMOUSE_LOG(SPML_ERROR, "Could not create wakeup pipes for spacenav threads");
+      CloseSources();
+      return;
+    }
+    if (!mPullMode)
+      StartDispatch();
+    for (SpaceMouseDeviceState &state : mDevices) state.filter.reset();
+    StartReader();
+  }
+}
+
+void SpaceMouseSpnav::StartReader() {
+  mStopReplay = false;
+  // the reader passes its kernel thread id, which its nice value is set for, before it starts
+  std::promise<pid_t> started;
+  std::future<pid_t> tid = started.get_future();
+  const bool replay = mTraceReader.isOpen();
+  mThread = std::unique_ptr<std::thread>(new std::thread([this, replay, &started]() {
+    started.set_value(static_cast<pid_t>(syscall(SYS_gettid)));
+    if (replay)
+      Replay();
+    else
+      Run();
+  }));
+  mReaderTid = tid.get();
+  errno = 0;
+  const int nice = getpriority(PRIO_PROCESS, 0);
+  mDefaultNice = errno == 0 ? nice : 0;
+  // leave the thread alone unless asked for, then nothing is logged either
+  if (mScheduling.policy != SPMP_DEFAULT || mScheduling.cpus != 0 || mScheduling.lockMemory)
+    ApplyScheduling();
+  else
+    mAppliedPolicy = SPMP_DEFAULT;
+}
+
+void SpaceMouseSpnav::StopReader() {
+  mStopReplay = true;
+  mReaderWakeup.notify();
+  if (mThread) {
+    mThread->join();
+    mThread.reset();
+  }
+  mReaderTid = 0;
+  if (mLockedStack != nullptr) {
+    // the stack is gone or cached for the next thread, which locks its own
+    munlock(mLockedStack, mLockedStackSize);
+    mLockedStack = nullptr;
+  }
+  mReaderWakeup.clear();
+}
+
+SpaceMouseSchedulingPolicy SpaceMouseSpnav::setReaderScheduling(
+    const SpaceMouseReaderScheduling &scheduling) {
+  mScheduling = scheduling;
+  if (mThread)
+    ApplyScheduling();
+  else
+    mAppliedPolicy = scheduling.policy;
+  return mAppliedPolicy;
+}
+
+void SpaceMouseSpnav::ApplyScheduling() {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (mScheduling.cpus != 0) {
+    for (int cpu = 0; cpu < 64; ++cpu)
+      if (((mScheduling.cpus >> cpu) & 1) != 0)
+        CPU_SET(cpu, &cpus);
+  } else if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+    CPU_ZERO(&cpus);
+  }
+  // the reader inherited the cpus of the thread starting it, which are restored when unpinning
+  const int error =
+      CPU_COUNT(&cpus) == 0 ? EINVAL
+                            : pthread_setaffinity_np(mThread->native_handle(), sizeof(cpus), &cpus);
+  if (error != 0)
+    SPACEMOUSE_LOG(SPML_WARNING, "Could not set the cpus of the spacenav reader thread: %s",
+                   strerror(error));
+  mAppliedPolicy = ApplyPolicy();
+  LockMemory(mScheduling.lockMemory);
+}
+
+SpaceMouseSchedulingPolicy SpaceMouseSpnav::ApplyPolicy() {
+  // nice value used if the thread may not get a real-time policy
+  const int kFallbackNice = -10;
+  const pthread_t thread = mThread->native_handle();
+  const SpaceMouseSchedulingPolicy policy = mScheduling.policy;
+  rlimit limit;
+  if (policy == SPMP_FIFO || policy == SPMP_RR) {
+    const int realTime = policy == SPMP_FIFO ? SCHED_FIFO : SCHED_RR;
+    sched_param param;
+    param.sched_priority =
+        std::min(std::max(mScheduling.priority, sched_get_priority_min(realTime)),
+                 sched_get_priority_max(realTime));
+    int error = pthread_setschedparam(thread, realTime, &param);
+    // without CAP_SYS_NICE the priority may be raised up to RLIMIT_RTPRIO
+    if (error == EPERM && getrlimit(RLIMIT_RTPRIO, &limit) == 0 &&
+        limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > 0 &&
+        static_cast<int>(limit.rlim_cur) < param.sched_priority) {
+      param.sched_priority = static_cast<int>(limit.rlim_cur);
+      error = pthread_setschedparam(thread, realTime, &param);
+    }
+    if (error == 0) {
+      SPACEMOUSE_LOG(SPML_INFO, "Spacenav reader thread runs with %s priority %d",
+                     policy == SPMP_FIFO ? "SCHED_FIFO" : "SCHED_RR", param.sched_priority);
+      return policy;
+    }
+    SPACEMOUSE_LOG(SPML_WARNING,
+                   "Could not give the spacenav reader thread real-time priority (%s), raising "
+                   "its nice value instead", strerror(error));
+  }
+
+  // back to the normal policy, for which the nice value counts (always permitted)
+  sched_param param;
+  param.sched_priority = 0;
+  pthread_setschedparam(thread, SCHED_OTHER, &param);
+  if (policy == SPMP_DEFAULT) {
+    setpriority(PRIO_PROCESS, static_cast<id_t>(mReaderTid), mDefaultNice);
+    return SPMP_DEFAULT;
+  }
+  const int nice = policy == SPMP_NICE ? std::min(std::max(mScheduling.priority, -20), 19)
+                                       : kFallbackNice;
+  int applied = nice;
+  int result = setpriority(PRIO_PROCESS, static_cast<id_t>(mReaderTid), nice);
+  int error = errno;
+  // without CAP_SYS_NICE the nice value may be lowered down to 20 - RLIMIT_NICE
+  if (result != 0 && error == EACCES && getrlimit(RLIMIT_NICE, &limit) == 0 &&
+      limit.rlim_cur != RLIM_INFINITY && 20 - static_cast<int>(limit.rlim_cur) < mDefaultNice) {
+    applied = std::max(20 - static_cast<int>(limit.rlim_cur), nice);
+    result = setpriority(PRIO_PROCESS, static_cast<id_t>(mReaderTid), applied);
+    error = errno;
+  }
+  if (result == 0) {
+    SPACEMOUSE_LOG(SPML_INFO, "Spacenav reader thread runs with nice value %d", applied);
+    return SPMP_NICE;
+  }
+  SPACEMOUSE_LOG(SPML_WARNING,
+                 "Could not raise the priority of the spacenav reader thread (%s), keeping the "
+                 "default", strerror(error));
+  setpriority(PRIO_PROCESS, static_cast<id_t>(mReaderTid), mDefaultNice);
+  return SPMP_DEFAULT;
+}
+
+void SpaceMouseSpnav::LockMemory(bool lock) {
+  // the reader thread only needs a few pages of its stack
+  const std::size_t kStackSize = 64 * 1024;
+  if (lock && !mLockedSelf) {
+    // the backend holds the queue, the packet buffers and the state of all devices
+    mLockedSelf = mlock(this, sizeof(*this)) == 0;
+    if (!mLockedSelf)
+      SPACEMOUSE_LOG(SPML_WARNING, "Could not lock the spacenav backend into memory: %s",
+                     strerror(errno));
+  } else if (!lock && mLockedSelf) {
+    munlock(this, sizeof(*this));
+    mLockedSelf = false;
+  }
+
+  if (lock && mLockedStack == nullptr && mThread) {
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(mThread->native_handle(), &attributes) == 0) {
+      void *stack;
+      std::size_t size;
+      if (pthread_attr_getstack(&attributes, &stack, &size) == 0) {
+        // the stack grows down from its end
+        const std::size_t locked = std::min(size, kStackSize);
+        char *begin = static_cast<char *>(stack) + size - locked;
+        if (mlock(begin, locked) == 0) {
+          mLockedStack = begin;
+          mLockedStackSize = locked;
+        } else {
+          SPACEMOUSE_LOG(SPML_WARNING,
+                         "Could not lock the stack of the spacenav reader thread into memory: %s",
+                         strerror(errno));
+        }
+      }
+      pthread_attr_destroy(&attributes);
     }
+  } else if (!lock && mLockedStack != nullptr) {
+    munlock(mLockedStack, mLockedStackSize);
+    mLockedStack = nullptr;
+  }
+}
+
+void SpaceMouseSpnav::setJitterProbe(int64_t interval) {
+  if (mJitterTimer == -1) {
+    SPACEMOUSE_LOG(SPML_ERROR, "Could not create the timer measuring the wakeup jitter");
+    return;
+  }
+  if (interval > 0)
+    mJitter.reset();
+  // the first expiry one interval from now, a zero interval disarms the timer
+  itimerspec timer;
+  timer.it_interval.tv_sec = interval > 0 ? static_cast<time_t>(interval / 1000000000) : 0;
+  timer.it_interval.tv_nsec = interval > 0 ? static_cast<long>(interval % 1000000000) : 0;
+  timer.it_value = timer.it_interval;
+  timerfd_settime(mJitterTimer, 0, &timer, nullptr);
+}
+
+void SpaceMouseSpnav::ReadJitterProbe() {
+  uint64_t expirations;
+  if (read(mJitterTimer, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return;  // disarmed meanwhile
+  itimerspec timer;
+  if (timerfd_gettime(mJitterTimer, &timer) != 0)
+    return;
+  const int64_t interval = timer.it_interval.tv_sec * 1000000000LL + timer.it_interval.tv_nsec;
+  const int64_t remaining = timer.it_value.tv_sec * 1000000000LL + timer.it_value.tv_nsec;
+  if (interval == 0)
+    return;
+  // the oldest of the expirations was that long ago, which is how late we woke up for it
+  mJitter.record(static_cast<int64_t>(expirations) * interval - remaining);
+}
+
+void SpaceMouseSpnav::CloseSources() {
+  mClient.close();
+  for (int device = 0; device < kMaxDevices; ++device) {
+    Source &source = mSources[device];
+    source.evdev.close();
+    source.open = false;
+    std::fill(source.sampledAxes, source.sampledAxes + 6, 0);
+    if (mStatePublisher.isOpen())
+      mStatePublisher.publishReset(device, monotonicTime());
   }
 }
 
 void SpaceMouseSpnav::Close() {
-  #ifndef NDEBUG
-  logFun("Close Spnav");
-  #endif  // NDEBUG
+  SPACEMOUSE_LOG(SPML_DEBUG, "Close Spnav");
   if (mInitialized) {
-    spnav_close();
+    // wake the reader thread and wait for it before closing the sources it polls, then stop the
+    // dispatcher
+    StopReader();
+    StopDispatch();
+
+    CloseSources();
     mInitialized = false;
-    mSignalExit.set_value();
-    mThread->join();
+    SPACEMOUSE_LOG(SPML_DEBUG, "Event queue: %llu overflows, %llu merged, %llu dropped",
+                   static_cast<unsigned long long>(mEventQueue.overflows()),
+                   static_cast<unsigned long long>(mEventQueue.merged()),
+                   static_cast<unsigned long long>(mEventQueue.dropped()));
   }
 }
 
-SpaceMouseSpnav::SpaceMouseSpnav() {}
+SpaceMouseSpnav::SpaceMouseSpnav()
+    : mUseEvdev(false),
+      mStopDispatch(false),
+      mRecording(false),
+      mReplayRealTime(false),
+      mStopReplay(false),
+      mAppliedPolicy(SPMP_DEFAULT),
+      mReaderTid(0),
+      mDefaultNice(0),
+      mLockedStack(nullptr),
+      mLockedStackSize(0),
+      mLockedSelf(false) {
+  // the pipes live as long as the backend, so that the event fd stays valid across reconnects
+  mReaderWakeup.open();
+  mDispatchWakeup.open();
+  // as does the probe timer, so that the jitter can be measured across reconnects
+  mJitterTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
 
 SpaceMouseSpnav::~SpaceMouseSpnav() {
   if (mInitialized) Close();
+  stopRecording();
+  LockMemory(false);
+  if (mJitterTimer != -1)
+    ::close(mJitterTimer);
 }
 #endif  // WITH_LIBSPACENAV
 
@@ -220,139 +1488,44 @@ void SpaceMouse3DX::handleMessage(unsigned int productID, unsigned int messageTy
   }
 }
 
-enum SpaceMouseButton3DX {
-  // buttons on the 3DConnexion Spacemouse Wireles Pro
-  SPMB_3DX_TOP = 4,
-  SPMB_3DX_RIGHT = 16,
-  SPMB_3DX_FRONT = 32,
-  SPMB_3DX_ROLL_CW = 256,
-  SPMB_3DX_LOCK_ROT = 67108864,
-  SPMB_3DX_1 = 4096,          // Not communicated by the api :(
-  SPMB_3DX_2 = 8192,          // Not communicated by the api :(
-  SPMB_3DX_3 = 16384,         // Not communicated by the api :(
-  SPMB_3DX_4 = 32768,         // Not communicated by the api :(
-  SPMB_3DX_ESC = 4194304,     // Not communicated by the api :(
-  SPMB_3DX_SHIFT = 16777216,  // Not communicated by the api :(
-  SPMB_3DX_CTRL = 33554432,   // Not communicated by the api :(
-  SPMB_3DX_ALT = 8388608,     // Not communicated by the api :(
-  SPMB_3DX_MENU = 1,
-  SPMB_3DX_FIT = 2
-
-  // if you own an other spacemouse feel free to add further buttons
-};
+// the button numbers of the device profiles are the bit positions in the button mask
+static const int kButtonMask3DX = 1 << 0 | 1 << 1 | 1 << 2 | 1 << 4 | 1 << 5;
 
 void SpaceMouse3DX::ProcessEvent(const ConnexionDeviceState *state) {
-  SpaceMouseMoveEvent moveEvent;
-  double axis[3];
-  SpaceMouseButton bnum = SPMB_UNDEFINED;
-  SpaceMouseButton3DX changedButton;
+  int axes[6];
+  int changedButtons;
+  int code;
   bool pressed;
   int buttonCfg;
 
-  // ignore buttons that are not passed through by the 3DX driver
-  int mask = SPMB_3DX_TOP | SPMB_3DX_RIGHT | SPMB_3DX_FRONT | SPMB_3DX_MENU | SPMB_3DX_FIT;
-
   switch (state->command) {
     case kConnexionCmdHandleAxis:
-      // set translation
-      moveEvent.tx = state->axis[0];
-      moveEvent.ty = state->axis[1];
-      moveEvent.tz = state->axis[2];
-
-      // compute and set angle = norm of the rotation axis
-      for (size_t i = 0; i < 3; ++i) axis[i] = state->axis[i + 3];
-      moveEvent.angle = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
-
-      // set (normalized) rotation axis
-      if (moveEvent.angle == 0) {
-        moveEvent.axisX = 0;
-        moveEvent.axisY = 0;
-        moveEvent.axisZ = 1;
-      } else {
-        moveEvent.axisX = axis[0] / moveEvent.angle;
-        moveEvent.axisY = axis[1] / moveEvent.angle;
-        moveEvent.axisZ = axis[2] / moveEvent.angle;
-      }
+      for (size_t i = 0; i < 6; ++i) axes[i] = state->axis[i];
+      if (!filterMotion(axes, monotonicTime()))
+        break;
 
       // call the callback with that event
-      mMoveCallback(std::move(moveEvent));
+      mMoveCallback(SpaceMouseMoveEvent::fromAxes(axes[0], axes[1], axes[2], axes[3], axes[4],
+                                                  axes[5]));
       break;
     case kConnexionCmdHandleButtons:
-      buttonCfg = state->buttons & mask;
+      // ignore buttons that are not passed through by the 3DX driver (menu, fit, top, right, and
+      // front)
+      buttonCfg = state->buttons & kButtonMask3DX;
 
       // extract the button that has changed:
-      changedButton = static_cast<SpaceMouseButton3DX>(mLastButtonConfig ^ buttonCfg);
+      changedButtons = mLastButtonConfig ^ buttonCfg;
+      code = changedButtons != 0 && (changedButtons & (changedButtons - 1)) == 0
+                 ? __builtin_ctz(changedButtons)
+                 : -1;
       // button was pressed if the bit of the button was set in state->buttons
-      pressed = ((changedButton & buttonCfg) != 0);
-      switch (changedButton) {
-        case SpaceMouseButton3DX::SPMB_3DX_TOP:
-          bnum = SPMB_TOP;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_RIGHT:
-          bnum = SPMB_RIGHT;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_FRONT:
-          bnum = SPMB_FRONT;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_LOCK_ROT:
-          bnum = SPMB_LOCK_ROT;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_ROLL_CW:
-          bnum = SPMB_ROLL_CW;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_1:
-          bnum = SPMB_1;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_2:
-          bnum = SPMB_2;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_3:
-          bnum = SPMB_3;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_4:
-          bnum = SPMB_4;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_ESC:
-          bnum = SPMB_ESC;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_SHIFT:
-          bnum = SPMB_SHIFT;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_CTRL:
-          bnum = SPMB_CTRL;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_ALT:
-          bnum = SPMB_ALT;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_MENU:
-          bnum = SPMB_MENU;
-          break;
-        case SpaceMouseButton3DX::SPMB_3DX_FIT:
-          bnum = SPMB_FIT;
-          break;
-        default:
-          bnum = SPMB_UNDEFINED;
-          break;
-      }
+      pressed = ((changedButtons & buttonCfg) != 0);
 
       mLastButtonConfig = buttonCfg;
-      if (pressed) {
-        if (bnum == SPMB_SHIFT)
-          mModifiers.add(SpaceMouseModifierKey::SPMM_SHIFT);
-        else if (bnum == SPMB_CTRL)
-          mModifiers.add(SpaceMouseModifierKey::SPMM_CTRL);
-        else if (bnum == SPMB_ALT)
-          mModifiers.add(SpaceMouseModifierKey::SPMM_ALT);
-        mButtonPressCallback({bnum, mModifiers});
-      } else {
-        if (bnum == SPMB_SHIFT)
-          mModifiers.remove(SpaceMouseModifierKey::SPMM_SHIFT);
-        else if (bnum == SPMB_CTRL)
-          mModifiers.remove(SpaceMouseModifierKey::SPMM_CTRL);
-        else if (bnum == SPMB_ALT)
-          mModifiers.remove(SpaceMouseModifierKey::SPMM_ALT);
-        mButtonReleaseCallback({bnum, mModifiers});
-      }
+      if (pressed)
+        mButtonPressCallback(buttonEvent(code, true));
+      else
+        mButtonReleaseCallback(buttonEvent(code, false));
       break;
     default:
       break;
@@ -365,9 +1538,7 @@ SpaceMouse3DX &SpaceMouse3DX::instance() {
 }
 
 void SpaceMouse3DX::Initialize() {
-  #ifndef NDEBUG
-  logFun("Init 3DX");
-  #endif  // NDEBUG
+  SPACEMOUSE_LOG(SPML_DEBUG, "Init 3DX");
   if (!mInitialized) {
     auto error = SetConnexionHandlers(handleMessage, nullptr, nullptr, false);
     mInitialized = (error == 0);
@@ -375,6 +1546,11 @@ void SpaceMouse3DX::Initialize() {
     uint8_t name[] = "test";
     mClientID = RegisterConnexionClient(kConnexionClientWildcard, (uint8_t *)name,
                                         kConnexionClientModeTakeOver, kConnexionMaskAll);
+    int32_t deviceID = 0;
+    const SpaceMouseDeviceProfile *profile = nullptr;
+    if (ConnexionClientControl(mClientID, kConnexionCtlGetDeviceID, 0, &deviceID) == 0)
+      profile = findDeviceProfile(static_cast<uint32_t>(deviceID) >> 16, deviceID & 0xffff);
+    setDeviceProfile(profile != nullptr ? *profile : defaultDeviceProfile());
     This = this;
   }
 }
@@ -386,9 +1562,7 @@ void SpaceMouse3DX::Initialize() {
  *
  */
 void SpaceMouse3DX::Close() {
-  #ifndef NDEBUG
-  logFun("Close 3DX");
-  #endif  // NDEBUG
+  SPACEMOUSE_LOG(SPML_DEBUG, "Close 3DX");
   UnregisterConnexionClient(mClientID);
   This = nullptr;
   CleanupConnexionHandlers();
@@ -413,26 +1587,12 @@ SpaceMouse3DX::~SpaceMouse3DX() {
 /*--------------------------------------------------------------------------*/
 /* Spacemouse support using 3DX Client API                                  */
 /*--------------------------------------------------------------------------*/
-enum SpaceMouseButton3DXWin {
-  // buttons on the 3DConnexion Spacemouse Wireles Pro
-  SPMB_3DX_WIN_TOP = 3,
-  SPMB_3DX_WIN_RIGHT = 5,
-  SPMB_3DX_WIN_FRONT = 6,
-  SPMB_3DX_WIN_ROLL_CW = 9,
-  SPMB_3DX_WIN_LOCK_ROT = -1, // Not communicated by the api :(
-  SPMB_3DX_WIN_1 = -2,        // Not communicated by the api :(
-  SPMB_3DX_WIN_2 = -3,        // Not communicated by the api :(
-  SPMB_3DX_WIN_3 = -4,        // Not communicated by the api :(
-  SPMB_3DX_WIN_4 = -5,        // Not communicated by the api :(
-  SPMB_3DX_WIN_ESC = -6,      // Not communicated by the api :(
-  SPMB_3DX_WIN_SHIFT = -7,    // Not communicated by the api :(
-  SPMB_3DX_WIN_CTRL = -8,     // Not communicated by the api :(
-  SPMB_3DX_WIN_ALT = -9,      // Not communicated by the api :(
-  SPMB_3DX_WIN_MENU = -10,     // Not communicated by the api :(
-  SPMB_3DX_WIN_FIT = 31
-
-  // if you own an other spacemouse feel free to add further buttons
-};
+// 3DxWare numbers the buttons of all models alike, but only reports some of them
+static constexpr SpaceMouseButtonCode kButtons3DXWin[] = {
+    {3, SPMB_TOP}, {5, SPMB_RIGHT}, {6, SPMB_FRONT}, {9, SPMB_ROLL_CW}, {31, SPMB_FIT}};
+
+static constexpr SpaceMouseDeviceProfile kDeviceProfile3DXWin = {
+    SPMD_PRO_WIRELESS, "3DxWare", makeButtonMap(kButtons3DXWin)};
 
 bool SpaceMouse3DXWin::processEvent(MSG msg) {
   if (!mInitialized)
@@ -446,37 +1606,20 @@ bool SpaceMouse3DXWin::processEvent(MSG msg) {
     return false;
   }
 
-  SpaceMouseMoveEvent moveEvent;
-  double axis[3];
+  int axes[6];
   int bNumPressed, bNumReleased;
-  SpaceMouseButton bnum = SPMB_UNDEFINED;
   int changedButton;
   bool pressed;
 
   switch (event.type) {
     case SI_MOTION_EVENT:
-      // set translation
-      moveEvent.tx = event.u.spwData.mData[SI_TX];
-      moveEvent.ty = event.u.spwData.mData[SI_TY];
-      moveEvent.tz = event.u.spwData.mData[SI_TZ];
-
-      // compute and set angle = norm of the rotation axis
-      for (size_t i = 0; i < 3; ++i) axis[i] = event.u.spwData.mData[SI_RX + i];
-      moveEvent.angle = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
-
-      // set (normalized) rotation axis
-      if (moveEvent.angle == 0) {
-        moveEvent.axisX = 0;
-        moveEvent.axisY = 0;
-        moveEvent.axisZ = 1;
-      } else {
-        moveEvent.axisX = axis[0] / moveEvent.angle;
-        moveEvent.axisY = axis[1] / moveEvent.angle;
-        moveEvent.axisZ = axis[2] / moveEvent.angle;
-      }
+      for (size_t i = 0; i < 6; ++i) axes[i] = event.u.spwData.mData[SI_TX + i];
+      if (!filterMotion(axes, monotonicTime()))
+        break;
 
       // call the callback with that event
-      mMoveCallback(std::move(moveEvent));
+      mMoveCallback(SpaceMouseMoveEvent::fromAxes(axes[0], axes[1], axes[2], axes[3], axes[4],
+                                                  axes[5]));
       break;
     case SI_BUTTON_EVENT:
       bNumPressed = SiButtonPressed(&event);
@@ -487,74 +1630,10 @@ bool SpaceMouse3DXWin::processEvent(MSG msg) {
 
       changedButton = (pressed ? bNumPressed : bNumReleased);
 
-      switch (changedButton) {
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_TOP:
-          bnum = SPMB_TOP;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_RIGHT:
-          bnum = SPMB_RIGHT;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_FRONT:
-          bnum = SPMB_FRONT;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_LOCK_ROT:
-          bnum = SPMB_LOCK_ROT;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_ROLL_CW:
-          bnum = SPMB_ROLL_CW;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_1:
-          bnum = SPMB_1;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_2:
-          bnum = SPMB_2;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_3:
-          bnum = SPMB_3;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_4:
-          bnum = SPMB_4;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_ESC:
-          bnum = SPMB_ESC;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_SHIFT:
-          bnum = SPMB_SHIFT;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_CTRL:
-          bnum = SPMB_CTRL;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_ALT:
-          bnum = SPMB_ALT;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_MENU:
-          bnum = SPMB_MENU;
-          break;
-        case SpaceMouseButton3DXWin::SPMB_3DX_WIN_FIT:
-          bnum = SPMB_FIT;
-          break;
-        default:
-          bnum = SPMB_UNDEFINED;
-          break;
-      }
-
-      if (pressed) {
-        if (bnum == SPMB_SHIFT)
-          mModifiers.add(SpaceMouseModifierKey::SPMM_SHIFT);
-        else if (bnum == SPMB_CTRL)
-          mModifiers.add(SpaceMouseModifierKey::SPMM_CTRL);
-        else if (bnum == SPMB_ALT)
-          mModifiers.add(SpaceMouseModifierKey::SPMM_ALT);
-        mButtonPressCallback({bnum, mModifiers});
-      } else {
-        if (bnum == SPMB_SHIFT)
-          mModifiers.remove(SpaceMouseModifierKey::SPMM_SHIFT);
-        else if (bnum == SPMB_CTRL)
-          mModifiers.remove(SpaceMouseModifierKey::SPMM_CTRL);
-        else if (bnum == SPMB_ALT)
-          mModifiers.remove(SpaceMouseModifierKey::SPMM_ALT);
-        mButtonReleaseCallback({bnum, mModifiers});
-      }
+      if (pressed)
+        mButtonPressCallback(buttonEvent(changedButton, true));
+      else
+        mButtonReleaseCallback(buttonEvent(changedButton, false));
       break;
     default:
       break;
@@ -568,32 +1647,27 @@ SpaceMouse3DXWin &SpaceMouse3DXWin::instance() {
 }
 
 void SpaceMouse3DXWin::Initialize() {
-  #ifndef NDEBUG
-  logFun("Init 3DX");
-  #endif  // NDEBUG
+  SPACEMOUSE_LOG(SPML_DEBUG, "Init 3DX");
   if (!mInitialized) {
     auto error = SiInitialize();
     mInitialized = (error == SPW_NO_ERROR);
     if (!mInitialized)
-      logFun("SiInitialize failed!");
+      SPACEMOUSE_LOG(SPML_ERROR, "SiInitialize failed!");
     char name[] = "Cura";
     SiOpenData oData;
-    char buffer[50];
-    sprintf(buffer, "SiOpenWinInit: Window handle: %p", mWinID);
-    logFun(buffer);
+    SPACEMOUSE_LOG(SPML_DEBUG, "SiOpenWinInit: Window handle: %p", static_cast<void *>(mWinID));
     SiOpenWinInit(&oData, mWinID);
     if ((mDeviceHandle = SiOpen(name, SI_ANY_DEVICE, SI_NO_MASK, SI_EVENT, &oData))
         == NULL) {
       SiTerminate();
       mInitialized = false;
-      logFun("SiOpen failed");
+      SPACEMOUSE_LOG(SPML_ERROR, "SiOpen failed");
       return;
     } else {
       SiDeviceName deviceName;
       SiGetDeviceName(mDeviceHandle, &deviceName);
-      char buffer[50];
-      sprintf(buffer, "SiOpen succeeded: Device: %s", deviceName.name);
-      logFun(buffer);
+      SPACEMOUSE_LOG(SPML_INFO, "SiOpen succeeded: Device: %s", deviceName.name);
+      setDeviceProfile(kDeviceProfile3DXWin);
     }
   }
 }
@@ -605,9 +1679,7 @@ void SpaceMouse3DXWin::Initialize() {
  *
  */
 void SpaceMouse3DXWin::Close() {
-  #ifndef NDEBUG
-  logFun("Close 3DX");
-  #endif  // NDEBUG
+  SPACEMOUSE_LOG(SPML_DEBUG, "Close 3DX");
   SiClose(mDeviceHandle);
   SiTerminate();
   mInitialized = false;
@@ -4,12 +4,36 @@
 #ifndef SPACEMOUSE_HPP
 #define SPACEMOUSE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
+
+#include "SpaceMouseFilter.hpp"
+#include "SpaceMouseFrameSampler.hpp"
+#include "SpaceMouseLog.hpp"
+#include "SpaceMouseRcu.hpp"
+#include "SpaceMouseRing.hpp"
+#include "SpaceMouseStats.hpp"
 
 namespace spacemouse {
 
-extern std::function<void(const char*)> logFun;
+/** Maximal number of devices a backend reads at the same time, see SpaceMouseEvent::device */
+const int kMaxDevices = 8;
+
+/**
+ * @brief Current time of the monotonic clock in nanoseconds (CLOCK_MONOTONIC on Linux, i.e. the
+ * clock of python's time.monotonic_ns())
+ */
+inline int64_t monotonicTime() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
 /*--------------------------------------------------------------------------*/
 /* Spacemouse events                                                        */
@@ -21,7 +45,21 @@ struct SpaceMouseMoveEvent {
   SpaceMouseMoveEvent() = default;
   SpaceMouseMoveEvent(int tx, int ty, int tz, double angle, double axisX, double axisY,
                       double axisZ)
-      : tx(tx), ty(ty), tz(tz), angle(angle), axisX(axisX), axisY(axisY), axisZ(axisZ) {}
+      : tx(tx),
+        ty(ty),
+        tz(tz),
+        angle(angle),
+        axisX(axisX),
+        axisY(axisY),
+        axisZ(axisZ),
+        device(0) {}
+  /**
+   * @brief Creates a move event of device 0 from raw translation and rotation axes. The angle is
+   * the norm of the rotation vector and the axis its normalization (or the z axis if there is no
+   * rotation)
+   */
+  static SpaceMouseMoveEvent fromAxes(int tx, int ty, int tz, double rx, double ry, double rz);
+
   int tx; /**< Translation x coordinate */
   int ty; /**< Translation y coordinate */
   int tz; /**< Translation z coordinate */
@@ -30,6 +68,8 @@ struct SpaceMouseMoveEvent {
   double axisX; /**< Rotation axis x coordinate */
   double axisY; /**< Rotation axis y coordinate */
   double axisZ; /**< Rotation axis z coordinate */
+
+  int device; /**< Device that moved, see SpaceMouseEvent::device */
 };
 
 /**
@@ -54,14 +94,14 @@ enum SpaceMouseButton {
   SPMB_SHIFT = 10, /**< Shift key */
   SPMB_CTRL = 11,  /**< Control key */
   SPMB_ALT = 12,   /**< Alternate key */
-  // menu button
-  SPMB_MENU = 12, /**< Menu button */
   // fit to screen button
   SPMB_FIT = 13, /**< Fit shown objects to screen */
+  // menu button
+  SPMB_MENU = 14, /**< Menu button */
   // if you own another spacemouse feel free to add further buttons
 
   // undefined button
-  SPMB_UNDEFINED = 14 /**< Undefined button */
+  SPMB_UNDEFINED = 15 /**< Undefined button */
 };
 
 
@@ -74,6 +114,7 @@ enum class SpaceMouseModifierKey : int {
 class SpaceMouseModifierKeys {
  public:
   SpaceMouseModifierKeys() : mModifiers(SpaceMouseModifierKey(0)) {}
+  explicit SpaceMouseModifierKeys(SpaceMouseModifierKey modifiers) : mModifiers(modifiers) {}
   void add(SpaceMouseModifierKey key) {
     mModifiers = SpaceMouseModifierKey(static_cast<int>(mModifiers) | static_cast<int>(key));
   }
@@ -89,6 +130,18 @@ class SpaceMouseModifierKeys {
   SpaceMouseModifierKey modifiers() const {
     return mModifiers;
   }
+  /** @brief Adds or removes the modifier key of button, if it is one */
+  void update(SpaceMouseButton button, bool pressed) {
+    static const int kKeys[SPMB_UNDEFINED + 1] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        static_cast<int>(SpaceMouseModifierKey::SPMM_SHIFT),
+        static_cast<int>(SpaceMouseModifierKey::SPMM_CTRL),
+        static_cast<int>(SpaceMouseModifierKey::SPMM_ALT),
+        0, 0, 0};
+    const int key = kKeys[button];
+    const int modifiers = static_cast<int>(mModifiers);
+    mModifiers = SpaceMouseModifierKey(pressed ? (modifiers | key) : (modifiers & ~key));
+  }
 
  private:
   SpaceMouseModifierKey mModifiers;
@@ -99,7 +152,387 @@ class SpaceMouseModifierKeys {
  */
 struct SpaceMouseButtonEvent {
   SpaceMouseButton button; /**< The pressed button */
-  SpaceMouseModifierKeys modifierKeys;
+  SpaceMouseModifierKeys modifierKeys; /**< Modifier keys held down on the same device */
+  int device; /**< Device of the button, see SpaceMouseEvent::device */
+};
+
+/*--------------------------------------------------------------------------*/
+/* Button decoding                                                          */
+/*--------------------------------------------------------------------------*/
+/** @brief Raw code a device or driver reports for a button */
+struct SpaceMouseButtonCode {
+  int code;
+  SpaceMouseButton button;
+};
+
+/**
+ * @brief Lookup table from raw button codes [0, kCodes) to SpaceMouseButton. Build it at compile
+ * time from a list of SpaceMouseButtonCode with makeButtonMap().
+ */
+struct SpaceMouseButtonMap {
+  static const int kCodes = 32;
+  SpaceMouseButton buttons[kCodes];
+
+  /** @brief The button of code, SPMB_UNDEFINED for unknown codes */
+  SpaceMouseButton decode(int code) const {
+    return static_cast<unsigned>(code) < static_cast<unsigned>(kCodes) ? buttons[code]
+                                                                        : SPMB_UNDEFINED;
+  }
+};
+
+namespace detail {
+template <int... I>
+struct Indices {};
+template <int N, int... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template <int... I>
+struct MakeIndices<0, I...> {
+  typedef Indices<I...> type;
+};
+
+constexpr SpaceMouseButton findButton(const SpaceMouseButtonCode *codes, std::size_t count,
+                                      int code) {
+  return count == 0 ? SPMB_UNDEFINED
+                    : codes->code == code ? codes->button : findButton(codes + 1, count - 1, code);
+}
+
+template <std::size_t N, int... I>
+constexpr SpaceMouseButtonMap makeButtonMap(const SpaceMouseButtonCode (&codes)[N],
+                                            Indices<I...>) {
+  return SpaceMouseButtonMap{{findButton(codes, N, I)...}};
+}
+}  // namespace detail
+
+/** @brief Expands a list of button codes into a SpaceMouseButtonMap */
+template <std::size_t N>
+constexpr SpaceMouseButtonMap makeButtonMap(const SpaceMouseButtonCode (&codes)[N]) {
+  return detail::makeButtonMap(codes, detail::MakeIndices<SpaceMouseButtonMap::kCodes>::type());
+}
+
+/**
+ * @brief Enumerates the device models with a known button layout
+ */
+enum SpaceMouseDeviceModel {
+  SPMD_SPACENAVIGATOR = 0,
+  SPMD_COMPACT = 1,
+  SPMD_WIRELESS = 2,
+  SPMD_PRO = 3,
+  SPMD_PRO_WIRELESS = 4,
+  SPMD_ENTERPRISE = 5
+};
+
+/**
+ * @brief Button layout of a device model. The raw codes are the button numbers of the device as
+ * reported by spacenavd, which match the bit positions of the button mask of the 3DX driver on
+ * macOS.
+ */
+struct SpaceMouseDeviceProfile {
+  SpaceMouseDeviceModel model;
+  const char *name;
+  SpaceMouseButtonMap buttons;
+};
+
+/**
+ * @brief Profile of the device with the given USB ids
+ * @return The profile or nullptr if the device is no space mouse known to the plugin
+ */
+const SpaceMouseDeviceProfile *findDeviceProfile(unsigned vendorId, unsigned productId);
+/**
+ * @brief Profile used while the device is unknown, the SpaceMouse Pro (Wireless), for which the
+ * plugin was written
+ */
+const SpaceMouseDeviceProfile &defaultDeviceProfile();
+
+/**
+ * @brief Sums up raw motion samples so that a burst of them can be delivered as a single
+ * SpaceMouseMoveEvent.
+ * Translations and rotation vectors are added up, hence the merged event moves the camera as far
+ * as the individual events would have done one after another.
+ */
+class SpaceMouseMotionAccumulator {
+ public:
+  SpaceMouseMotionAccumulator() { clear(); }
+  void add(const int axes[6]) { add(axes[0], axes[1], axes[2], axes[3], axes[4], axes[5]); }
+  /** @brief Adds the axes of samples samples that were summed up already */
+  void add(const int axes[6], int samples) {
+    for (int i = 0; i < 6; ++i) mAxes[i] += axes[i];
+    mCount += samples;
+  }
+  void add(int tx, int ty, int tz, int rx, int ry, int rz) {
+    mAxes[0] += tx;
+    mAxes[1] += ty;
+    mAxes[2] += tz;
+    mAxes[3] += rx;
+    mAxes[4] += ry;
+    mAxes[5] += rz;
+    ++mCount;
+  }
+  void clear() {
+    for (int i = 0; i < 6; ++i) mAxes[i] = 0;
+    mCount = 0;
+  }
+  bool isEmpty() const { return mCount == 0; }
+  /** Number of samples merged since the last clear() */
+  int count() const { return mCount; }
+  SpaceMouseMoveEvent moveEvent() const {
+    return SpaceMouseMoveEvent::fromAxes(mAxes[0], mAxes[1], mAxes[2], mAxes[3], mAxes[4],
+                                         mAxes[5]);
+  }
+  /** Raw (summed) tx, ty, tz, rx, ry, rz */
+  const int *axes() const { return mAxes; }
+
+ private:
+  int mAxes[6];
+  int mCount;
+};
+
+/*--------------------------------------------------------------------------*/
+/* Queue passing events from the device thread to the consumer             */
+/*--------------------------------------------------------------------------*/
+enum SpaceMouseEventType {
+  SPME_MOTION = 0,         /**< Translation and/or rotation */
+  SPME_BUTTON_PRESS = 1,   /**< A button was pressed */
+  SPME_BUTTON_RELEASE = 2  /**< A button was released */
+};
+
+/**
+ * @brief Event as it is queued between the thread reading the device and the thread calling the
+ * callbacks
+ */
+struct alignas(32) SpaceMouseEvent {
+  int64_t timestamp; /**< Time the event was read, see monotonicTime() */
+  int16_t axes[6];   /**< Raw tx, ty, tz, rx, ry, rz of a motion event, see saturateAxis() */
+  uint8_t type;      /**< SpaceMouseEventType */
+  uint8_t button;    /**< SpaceMouseButton of a button event */
+  uint8_t modifiers; /**< SpaceMouseModifierKey flags held down during a button event */
+  uint8_t device;    /**< Device the event was read from, 0 to kMaxDevices - 1 */
+  uint8_t reserved[8];
+
+  /** @brief Creates a motion event from raw (summed) axes */
+  static SpaceMouseEvent motion(int64_t timestamp, const int axes[6], int device = 0);
+  /** @brief Creates a button press or release event */
+  static SpaceMouseEvent buttonEvent(SpaceMouseEventType type, int64_t timestamp,
+                                     const SpaceMouseButtonEvent &buttonEvent);
+  /** @brief Button and modifiers of a button event as passed to the callbacks */
+  SpaceMouseButtonEvent buttonEvent() const;
+};
+static_assert(sizeof(SpaceMouseEvent) == 32, "SpaceMouseEvent has to fill half a cache line");
+
+/**
+ * @brief Clamps a raw (summed) axis to the range of SpaceMouseEvent::axes. A single sample is
+ * always in range (spacenavd reports at most a few hundred), only motion merged over a long
+ * backlog may saturate.
+ */
+inline int16_t saturateAxis(int value) {
+  return static_cast<int16_t>(std::min(std::max(value, -32768), 32767));
+}
+
+/**
+ * @brief Bounded single-producer/single-consumer event queue with a per-type overflow policy.
+ *
+ * Events are handed over through a lock-free ring of fixed size. If the consumer falls behind
+ * and the ring is full, the producer keeps further events in a small overflow buffer that it
+ * moves to the ring as soon as there is space again:
+ * - motion follows "latest wins/merge", i.e. it is merged into a directly preceding overflowed
+ *   motion event of the same device instead of taking up another slot,
+ * - button events are never merged and keep their order relative to the motion. A producer that
+ *   must not lose them stops reading its device while overflowSpace() is low, and leaves the
+ *   backlog to the operating system. Events pushed into a full overflow buffer are counted in
+ *   dropped().
+ * Neither side allocates or blocks.
+ */
+class SpaceMouseEventQueue {
+ public:
+  static const std::size_t kCapacity = 256;
+  static const std::size_t kOverflowCapacity = 64;
+
+  SpaceMouseEventQueue();
+
+  /**
+   * @brief Appends an event (producer only)
+   * @return true if the event got its own slot, false if it was merged into the last overflowed
+   * motion or dropped
+   */
+  bool push(const SpaceMouseEvent &event);
+  /**
+   * @brief Moves overflowed events to the ring as far as there is space (producer only)
+   * @return true if no overflowed events are left
+   */
+  bool flushOverflow();
+  /** @brief Checks whether there are events waiting in the overflow buffer (producer only) */
+  bool hasOverflow() const { return mOverflowCount != 0; }
+  /** @brief Number of events that still fit into the overflow buffer (producer only) */
+  std::size_t overflowSpace() const { return kOverflowCapacity - mOverflowCount; }
+
+  /** @brief Removes the oldest event (consumer only) */
+  bool pop(SpaceMouseEvent &event) { return mRing.tryPop(event); }
+  /**
+   * @brief Removes up to maxEvents of the oldest events with a bulk copy (consumer only)
+   * @return The number of events written
+   */
+  std::size_t pop(SpaceMouseEvent *events, std::size_t maxEvents) {
+    return mRing.tryPopMany(events, maxEvents);
+  }
+  bool isEmpty() const { return mRing.isEmpty(); }
+
+  /** Number of events that did not fit into the ring */
+  uint64_t overflows() const { return mOverflows.load(std::memory_order_relaxed); }
+  /** Number of motion events merged into an already overflowed one */
+  uint64_t merged() const { return mMerged.load(std::memory_order_relaxed); }
+  /** Number of events that were lost */
+  uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+ private:
+  SpaceMouseRing<SpaceMouseEvent, kCapacity> mRing;
+
+  // producer side only
+  SpaceMouseEvent mOverflow[kOverflowCapacity];
+  std::size_t mOverflowHead;
+  std::size_t mOverflowCount;
+
+  std::atomic<uint64_t> mOverflows;
+  std::atomic<uint64_t> mMerged;
+  std::atomic<uint64_t> mDropped;
+
+  SpaceMouseEventQueue(const SpaceMouseEventQueue &);             // not implemented
+  SpaceMouseEventQueue &operator=(const SpaceMouseEventQueue &);  // not implemented
+};
+
+/**
+ * @brief Structure-of-arrays copy of up to kCapacity events for processing them in bulk, e.g. the
+ * axes of a run of motion events are summed with one vectorizable loop per axis.
+ */
+class SpaceMouseEventBatch {
+ public:
+  static const std::size_t kCapacity = SpaceMouseEventQueue::kCapacity;
+
+  SpaceMouseEventBatch() : mSize(0) {}
+
+  void clear() { mSize = 0; }
+  std::size_t size() const { return mSize; }
+  /**
+   * @brief Appends (transposes) events as far as there is space
+   * @return The number of events appended
+   */
+  std::size_t append(const SpaceMouseEvent *events, std::size_t count);
+  /** @brief Copies event i back into the record layout */
+  SpaceMouseEvent event(std::size_t i) const;
+
+  const int64_t *timestamps() const { return mTimestamps; }
+  /** Values of axis 0 (tx) to 5 (rz) */
+  const int16_t *axis(int axis) const { return mAxes[axis]; }
+  const uint8_t *types() const { return mTypes; }
+  const uint8_t *buttons() const { return mButtons; }
+  const uint8_t *modifiers() const { return mModifiers; }
+  const uint8_t *devices() const { return mDevices; }
+
+  /** @brief End of the run of consecutive motion events of one device starting at begin */
+  std::size_t motionEnd(std::size_t begin) const;
+  /** @brief Sums up the axes of the events [begin, end) */
+  void sumAxes(std::size_t begin, std::size_t end, int sums[6]) const;
+
+ private:
+  alignas(kCacheLineSize) int64_t mTimestamps[kCapacity];
+  alignas(kCacheLineSize) int16_t mAxes[6][kCapacity];
+  alignas(kCacheLineSize) uint8_t mTypes[kCapacity];
+  uint8_t mButtons[kCapacity];
+  uint8_t mModifiers[kCapacity];
+  uint8_t mDevices[kCapacity];
+  std::size_t mSize;
+};
+
+/*--------------------------------------------------------------------------*/
+/* Backpressure between the device thread and the consumer                  */
+/*--------------------------------------------------------------------------*/
+enum SpaceMouseDeliveryMode {
+  /** Motion is queued as it arrives (honoring the coalescing window) */
+  SPMD_PER_EVENT = 0,
+  /**
+   * The consumer falls behind, motion is merged on the device thread for as long as the previous
+   * motion event was not taken from the queue, so that at most one is waiting
+   */
+  SPMD_MERGED = 1
+};
+
+/**
+ * @brief Watches whether the consumer keeps up with the motion of the device and picks the
+ * SpaceMouseDeliveryMode accordingly.
+ *
+ * The device thread reports the arrival of motion samples (recordSample()) and of motion events
+ * in the queue (motionQueued()), the consumer the motion events it took (motionTaken()) and how
+ * long it needed for them (recordDelivery()). The consumer is behind if the move callback takes
+ * longer than the interval between the samples or if the motion is older than two intervals when
+ * it is delivered, and has recovered once both are below half of that. All averages are
+ * exponential moving averages with a weight of 1/8.
+ */
+class SpaceMouseBackpressure {
+ public:
+  /** Intervals between samples longer than this (ns) are pauses and do not count */
+  static const int64_t kMaxInterval = 100000000;
+  static const unsigned kTimingPeriod = 8;
+
+  SpaceMouseBackpressure();
+
+  /** @brief Notes the arrival of a motion sample (device thread only) */
+  void recordSample(int64_t timestamp);
+  /** @brief Notes that a motion event was queued (device thread only) */
+  void motionQueued() {
+    mQueuedMotion.store(mQueuedMotion.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+  }
+  /** @brief Notes that count motion events were taken from the queue (consumer only) */
+  void motionTaken(uint64_t count) {
+    mTakenMotion.store(mTakenMotion.load(std::memory_order_relaxed) + count,
+                       std::memory_order_relaxed);
+  }
+  /**
+   * @brief Whether the consumer should time the next move callback for recordDelivery(). Reading
+   * the clock is not free, hence only every kTimingPeriod-th callback is timed while the consumer
+   * keeps up, but every one while it is behind, to notice quickly when it recovered.
+   */
+  bool timeNextDelivery() {
+    return mMode.load(std::memory_order_relaxed) == SPMD_MERGED ||
+           ++mDeliveries % kTimingPeriod == 0;
+  }
+  /**
+   * @brief Notes the delivery of motion to the consumer and updates the mode (consumer only)
+   * @param callbackTime Time spent in the move callback in ns, 0 if there is none (drainEvents)
+   * @param lag          Time between the arrival of the newest delivered sample and the delivery
+   * @return true if the mode changed
+   */
+  bool recordDelivery(int64_t callbackTime, int64_t lag);
+
+  /**
+   * @brief Whether the device thread should keep merging the motion instead of queueing it
+   */
+  bool holdMotion() const {
+    return mMode.load(std::memory_order_relaxed) == SPMD_MERGED &&
+           mQueuedMotion.load(std::memory_order_relaxed) !=
+               mTakenMotion.load(std::memory_order_relaxed);
+  }
+  SpaceMouseDeliveryMode mode() const { return mMode.load(std::memory_order_relaxed); }
+  /** Average time in ns between two motion samples */
+  int64_t sampleInterval() const { return mSampleInterval.load(std::memory_order_relaxed); }
+  /** Average time in ns spent in the move callback */
+  int64_t callbackTime() const { return mCallbackTime.load(std::memory_order_relaxed); }
+  /** Average age in ns of the motion when it is delivered */
+  int64_t lag() const { return mLag.load(std::memory_order_relaxed); }
+  /** Number of times the mode changed */
+  uint64_t switches() const { return mSwitches.load(std::memory_order_relaxed); }
+
+ private:
+  // device thread
+  int64_t mLastSample;
+  std::atomic<int64_t> mSampleInterval;
+  /** Motion events queued and taken so far, each written by one side only */
+  std::atomic<uint64_t> mQueuedMotion;
+  // consumer
+  std::atomic<uint64_t> mTakenMotion;
+  unsigned mDeliveries;
+  std::atomic<int64_t> mCallbackTime;
+  std::atomic<int64_t> mLag;
+  std::atomic<SpaceMouseDeliveryMode> mMode;
+  std::atomic<uint64_t> mSwitches;
 };
 }  // namespace spacemouse
 
@@ -107,6 +540,21 @@ namespace spacemouse {
 /*--------------------------------------------------------------------------*/
 /* Abstract base class defining core functionality of spacemouse            */
 /*--------------------------------------------------------------------------*/
+/**
+ * @brief State a backend keeps for each device it reads, so that the buttons and motion of one
+ * device do not affect another. Only touched by the thread reading the devices.
+ */
+struct SpaceMouseDeviceState {
+  SpaceMouseDeviceState() : profile(&defaultDeviceProfile()) {}
+
+  /** Button layout of the device, set by the reader thread when it connects */
+  std::atomic<const SpaceMouseDeviceProfile *> profile;
+  /** Modifier keys held down on the device */
+  SpaceMouseModifierKeys modifiers;
+  /** Filter chain with the history of the motion of the device */
+  SpaceMouseFilterChain filter;
+};
+
 class SpaceMouseAbstract {
  public:
   /**
@@ -129,68 +577,496 @@ class SpaceMouseAbstract {
   bool isInitialized() const { return mInitialized; }
   /** @brief Sets the callback for move (i.e. translate and rotate) events
    *  @note The callback might get called from another thread then the one that
-   *  instantiated the daemon
+   *  instantiated the daemon. It may be replaced at any time, also while it is being called, the
+   *  previous one is deleted once it returned (see SpaceMouseCallback). The same holds for the
+   *  button callbacks.
    */
   void setMoveCallback(std::function<void(SpaceMouseMoveEvent)> callback) {
-    mMoveCallback = callback;
+    mMoveCallback.set(callback);
   }
   /** @brief Sets the callback for button pressed events
    *  @note The callback might get called from another thread then the one that
    *  instantiated the daemon
    */
   void setButtonPressCallback(std::function<void(SpaceMouseButtonEvent)> callback) {
-    mButtonPressCallback = callback;
+    mButtonPressCallback.set(callback);
   }
   /** @brief Sets the callback for button released events
    *  @note The callback might get called from another thread then the one that
    *  instantiated the daemon
    */
   void setButtonReleaseCallback(std::function<void(SpaceMouseButtonEvent)> callback) {
-    mButtonReleaseCallback = callback;
+    mButtonReleaseCallback.set(callback);
   }
+  /** @brief Sets the window in milliseconds during which consecutive move events are merged into
+   *  a single one before the move callback is called. With a window of 0 only the move events
+   *  that piled up while the callback was still busy are merged.
+   *  @note Only backends with a reader thread (libspacenav) coalesce events, the others deliver
+   *  them as they are handed over by the driver.
+   */
+  void setCoalescingWindow(int milliseconds) { mCoalescingWindow = milliseconds; }
+  /**
+   * @brief Replaces the chain of filters every motion sample passes on the thread reading the
+   * device, see SpaceMouseFilterChain. Samples the chain turns into all zeros are dropped. Every
+   * device passes its own copy of the chain.
+   * @return false if the stages are invalid, then the current chain is kept
+   */
+  bool setFilterChain(const SpaceMouseFilterStage *stages, int count);
+  /**
+   * @brief Switches between queueing the motion as move events (default) and integrating it for
+   * sampleMotion(), which the consumer calls once per rendered frame. Button events are queued
+   * either way. While sampling, the event fd (see eventFd()) also becomes readable when the device
+   * starts moving after sampleMotion() reported it at rest.
+   * @note Only backends with a reader thread (libspacenav) support sampling, the others always
+   * call the move callback.
+   */
+  void setFrameSampling(bool enabled) {
+    mFrameSampler.reset();
+    mFrameSampling = enabled;
+  }
+  bool isFrameSampling() const { return mFrameSampling; }
+  /**
+   * @brief Fetches the motion since the previous call, extrapolated to the time the frame is
+   * presented (frame sampling only, see SpaceMouseFrameSampler::sample)
+   * @note Must only be called from one thread at a time (the consumer)
+   */
+  bool sampleMotion(int64_t frameTime, double delta[6]) {
+    return mFrameSampler.sample(frameTime, delta);
+  }
+
+  /**
+   * @brief Whether the consumer keeps up with the motion, see SpaceMouseBackpressure
+   * @note Only backends with a reader thread (libspacenav) queue events and adapt to the consumer
+   */
+  const SpaceMouseBackpressure &backpressure() const { return mBackpressure; }
+
+  /**
+   * @brief Calls the callbacks for all events in the event queue. Consecutive move events are
+   * merged into one call of the move callback.
+   * @note Must only be called from one thread at a time (the consumer of the queue)
+   */
+  void dispatchEvents();
+
+  /**
+   * @brief Switches between calling the callbacks (default) and leaving the queued events to
+   * be fetched with drainEvents().
+   * @note Only backends with a reader thread (libspacenav) queue their events, the others always
+   * call the callbacks.
+   */
+  virtual void setPullMode(bool enabled) { mPullMode = enabled; }
+  bool isPullMode() const { return mPullMode; }
+  /**
+   * @brief Moves up to maxEvents queued events into events (pull mode only)
+   * @return The number of events written
+   */
+  std::size_t drainEvents(SpaceMouseEvent *events, std::size_t maxEvents);
+  /**
+   * @brief File descriptor that is readable while events are waiting in pull mode. Watch it with
+   * poll(), QSocketNotifier, or similar and call dispatchEvents() or drainEvents() on the thread
+   * that should handle the events.
+   * @return The descriptor, or -1 if the backend does not support it
+   */
+  virtual int eventFd() const { return -1; }
 
  protected:
   SpaceMouseAbstract();
   virtual ~SpaceMouseAbstract();
+  /**
+   * @brief Called by the consumer after it emptied the event queue, so that it is notified of
+   * the next event again (see eventFd())
+   */
+  virtual void rearmEventFd() {}
+  /**
+   * @brief Calls the move callback for the merged motion
+   * @param timestamp Arrival time of the newest sample in it, see monotonicTime()
+   * @param device    Device the motion came from
+   */
+  void dispatchMotion(const SpaceMouseMotionAccumulator &motion, int64_t timestamp, int device);
+  /** @brief Logs a change of the delivery mode */
+  void logDeliveryMode();
+  /**
+   * @brief Passes a motion sample of a device through its filter chain (device thread only)
+   * @return false if the sample is to be dropped
+   */
+  bool filterMotion(int axes[6], int64_t timestamp, int device = 0);
+  /** @brief Switches the button layout of a device, e.g. when connecting to it */
+  void setDeviceProfile(const SpaceMouseDeviceProfile &profile, int device = 0);
+  /**
+   * @brief Decodes a raw button code with the profile of the device and updates the modifier
+   * keys of the device accordingly
+   * @return The event to pass on, carrying the modifiers after the update
+   */
+  SpaceMouseButtonEvent buttonEvent(int code, bool pressed, int device = 0) {
+    SpaceMouseDeviceState &state = mDevices[device];
+    const SpaceMouseButton button =
+        state.profile.load(std::memory_order_relaxed)->buttons.decode(code);
+    state.modifiers.update(button, pressed);
+    return {button, state.modifiers, device};
+  }
+
   bool mInitialized;
-  SpaceMouseModifierKeys mModifiers;
-  std::function<void(SpaceMouseMoveEvent)> mMoveCallback;
-  std::function<void(SpaceMouseButtonEvent)> mButtonPressCallback;
-  std::function<void(SpaceMouseButtonEvent)> mButtonReleaseCallback;
+  bool mPullMode;
+  /** Events waiting for dispatchEvents() (only used by backends with a reader thread) */
+  SpaceMouseEventQueue mEventQueue;
+  /** Events being dispatched by dispatchEvents() */
+  SpaceMouseEventBatch mDispatchBatch;
+  std::atomic<int> mCoalescingWindow;
+  /** Button layouts, modifiers and filters of the devices, indexed by SpaceMouseEvent::device */
+  SpaceMouseDeviceState mDevices[kMaxDevices];
+  /** Chain set by setFilterChain(), picked up by the device thread while mFilterChanged is set */
+  SpaceMouseFilterChain mPendingFilter;
+  std::mutex mFilterMutex;
+  std::atomic<bool> mFilterChanged;
+  /** Motion integrated by the device thread while mFrameSampling is set */
+  SpaceMouseFrameSampler mFrameSampler;
+  std::atomic<bool> mFrameSampling;
+  /** Decides whether the device thread queues or merges the motion */
+  SpaceMouseBackpressure mBackpressure;
+  SpaceMouseCallback<SpaceMouseMoveEvent> mMoveCallback;
+  SpaceMouseCallback<SpaceMouseButtonEvent> mButtonPressCallback;
+  SpaceMouseCallback<SpaceMouseButtonEvent> mButtonReleaseCallback;
 };
 }  // namespace spacemouse
 
 #ifdef WITH_LIBSPACENAV
 /*--------------------------------------------------------------------------*/
-/* Spacemouse support using libspacenav                                     */
+/* Spacemouse support using spacenavd                                       */
 /*--------------------------------------------------------------------------*/
-#include <X11/Xlib.h>
-#include <spnav.h>
+#include <sys/types.h>
 
-#include <future>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 
+#include "SpaceMouseEvdevClient.hpp"
+#include "SpaceMouseSharedState.hpp"
+#include "SpaceMouseSpnavClient.hpp"
+#include "SpaceMouseTrace.hpp"
+
 namespace spacemouse {
+/**
+ * @brief Wakes up a thread that sleeps in poll() on fd() using a non-blocking self-pipe
+ */
+class SpaceMouseWakeup {
+ public:
+  SpaceMouseWakeup();
+  ~SpaceMouseWakeup();
+  bool open();
+  void close();
+  /** File descriptor that becomes readable when notified */
+  int fd() const { return mPipe[0]; }
+  /** @brief Wakes the waiting thread */
+  void notify();
+  /** @brief Wakes the waiting thread, but only if it announced to sleep with prepareWait() */
+  void notifyIfWaiting();
+  /**
+   * @brief Announces that the calling thread is about to sleep on fd(). Check for work after
+   * calling this and before actually sleeping, otherwise a notification may be missed.
+   */
+  void prepareWait();
+  /** @brief Withdraws prepareWait() and consumes pending notifications */
+  void clear();
+
+ private:
+  int mPipe[2];
+  std::atomic<bool> mWaiting;
+
+  SpaceMouseWakeup(const SpaceMouseWakeup &);             // not implemented
+  SpaceMouseWakeup &operator=(const SpaceMouseWakeup &);  // not implemented
+};
+
+/*--------------------------------------------------------------------------*/
+/* Scheduling of the reader thread                                          */
+/*--------------------------------------------------------------------------*/
+enum SpaceMouseSchedulingPolicy {
+  SPMP_DEFAULT = 0, /**< Whatever the thread that started the reader had */
+  SPMP_NICE = 1,    /**< SCHED_OTHER with a raised (i.e. lower) nice value */
+  SPMP_FIFO = 2,    /**< Real-time SCHED_FIFO */
+  SPMP_RR = 3       /**< Real-time SCHED_RR */
+};
+
+/**
+ * @brief How the reader thread is scheduled, so that input stays responsive while the
+ * application keeps all cores busy (e.g. Cura slicing in the background)
+ */
+struct SpaceMouseReaderScheduling {
+  SpaceMouseReaderScheduling() : policy(SPMP_DEFAULT), priority(0), cpus(0), lockMemory(false) {}
+
+  SpaceMouseSchedulingPolicy policy;
+  /** Real-time priority (1 to 99) for SPMP_FIFO and SPMP_RR, the nice value for SPMP_NICE */
+  int priority;
+  /** Bit i allows the reader thread to run on cpu i, 0 for the cpus of the process */
+  uint64_t cpus;
+  /**
+   * Locks the memory the reader thread works on (the backend and the top of its stack) into RAM,
+   * so that it does not page fault on a swapped out page after sleeping for a long time
+   */
+  bool lockMemory;
+};
+
+/**
+ * @brief Backend reading spacenavd (or evdev nodes) on a reader thread and calling the callbacks
+ * on a dispatch thread (or the consumer in pull mode).
+ *
+ * Device 0 is spacenavd, or the evdev node set with useEvdev(). spacenavd merges all devices it
+ * handles into one stream, hence further devices are added with addDevice() and read from their
+ * evdev nodes. The reader thread waits for all of them with a single epoll set and queues their
+ * events in the same queue, tagged with the device (SpaceMouseEvent::device). Each device has its
+ * own button layout, modifier keys, filter history and coalescing of its motion, the order of the
+ * events is kept per device.
+ */
 class SpaceMouseSpnav : public SpaceMouseAbstract {
  public:
+  /** Delay in ms before the first attempt to reconnect, doubled after every failed attempt */
+  static const int kMinReconnectDelay = 250;
+  /** Longest delay in ms between two attempts to reconnect */
+  static const int kMaxReconnectDelay = 8000;
+
   static SpaceMouseSpnav &instance();
+  /**
+   * @brief Starts the reader and dispatch threads without waiting for the device. The reader
+   * thread connects to spacenavd (or opens the evdev node of device 0) and reconnects whenever
+   * the connection is lost, retrying with exponential backoff. isDeviceOpen(0) tells whether it
+   * is connected.
+   */
   void Initialize();
   void Close();
+  void setPullMode(bool enabled);
+  int eventFd() const { return mDispatchWakeup.fd(); }
+
+  /**
+   * @brief Starts appending every packet received from spacenavd to a trace file
+   * (see SpaceMouseTrace.hpp), replacing a running recording
+   * @return false if the file could not be created
+   */
+  bool startRecording(const char *path);
+  /** @brief Stops the recording and closes the trace file */
+  void stopRecording();
+  /**
+   * @brief Disconnects from spacenavd and feeds the packets of a trace file through the usual
+   * pipeline instead, i.e. ProcessEvent(), the event queue and the callbacks (or drainEvents())
+   * @param realTime Whether the packets are replayed with their recorded timing (honoring the
+   *                 coalescing window) or as fast as possible, in which case motion is only merged
+   *                 within the batches of the recording
+   * @return false if the trace could not be read, then the connection to spacenavd is restored
+   */
+  bool startReplay(const char *path, bool realTime);
+  /** @brief Waits until all packets of the trace were queued (not necessarily dispatched) */
+  void waitForReplay();
+  /** @brief Stops replaying and reconnects to spacenavd */
+  void stopReplay();
+
+  /**
+   * @brief Starts publishing the latest state of all devices (filtered axes, buttons and
+   * modifiers) to a shared memory segment that other processes sample with a
+   * SpaceMouseSharedStateReader, see SpaceMouseSharedState.hpp. The reader thread writes the
+   * segment, so it is restarted, which starts a running replay over.
+   * @param name Name of the segment as for shm_open(), or nullptr to stop publishing
+   * @return false if the segment could not be created or another process publishes to it
+   */
+  bool publishState(const char *name);
+
+  /**
+   * @brief Reconnects, reading the device directly from its evdev node instead of from spacenavd
+   * (see SpaceMouseEvdevClient), which saves the hop through the daemon process
+   * @param path The evdev node (or a pipe delivering input events), an empty string to use the
+   *             first space mouse in /dev/input, or nullptr to go back to spacenavd
+   * @return false if the node could not be opened, then spacenavd is used again
+   */
+  bool useEvdev(const char *path);
+  /** Whether the device is read from its evdev node */
+  bool isEvdev() const { return mUseEvdev; }
+
+  /**
+   * @brief Adds a device read from its evdev node besides device 0
+   * @param path The evdev node (or a pipe delivering input events), or an empty string to use a
+   *             space mouse in /dev/input that is not read yet
+   * @return The id of the device (see SpaceMouseEvent::device), or -1 if the node could not be
+   *         opened or there are kMaxDevices devices already
+   */
+  int addDevice(const char *path);
+  /** @brief Stops reading a device added with addDevice(), false if there is no such device */
+  bool removeDevice(int device);
+  /** Whether there is a device with this id (device 0 always exists) */
+  bool hasDevice(int device) const {
+    return device == 0 || (device > 0 && device < kMaxDevices && !mSources[device].path.empty());
+  }
+  /** Whether the device is being read, i.e. it was neither closed nor unplugged */
+  bool isDeviceOpen(int device) const {
+    return hasDevice(device) && mSources[device].open.load(std::memory_order_relaxed);
+  }
+  /** Evdev node of the device, "spacenavd", or "" if there is no such device */
+  std::string deviceSource(int device) const;
+  /** Button layout of the device */
+  const SpaceMouseDeviceProfile &deviceProfile(int device) const {
+    return *mDevices[hasDevice(device) ? device : 0].profile.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Changes the scheduling of the reader thread, right away if it runs and otherwise when
+   * it is started. Without permission for a real-time policy the nice value is raised instead
+   * (as far as RLIMIT_NICE allows), without permission for that the thread keeps the default.
+   * Failures are logged, the affinity and memory locking are applied independently.
+   * @return The policy the running reader thread got, or the requested one if it is not running
+   */
+  SpaceMouseSchedulingPolicy setReaderScheduling(const SpaceMouseReaderScheduling &scheduling);
+  /** The requested scheduling, see setReaderScheduling() */
+  const SpaceMouseReaderScheduling &readerScheduling() const { return mScheduling; }
+  /** The policy the reader thread got, which differs from the requested one after a fallback */
+  SpaceMouseSchedulingPolicy readerPolicy() const { return mAppliedPolicy; }
+
+  /**
+   * @brief Starts measuring the wakeup jitter of the reader thread, i.e. how late it wakes up
+   * for a timer expiring every interval nanoseconds (like cyclictest does), or stops it if the
+   * interval is 0. The timer is watched by the same epoll set as the devices, so the measured
+   * delay is what an event arriving at a random time suffers on top of the time it takes to
+   * read it. Starting clears wakeupJitter().
+   */
+  void setJitterProbe(int64_t interval);
+  /** Wakeup delays in nanoseconds measured since setJitterProbe() started the probe */
+  const SpaceMouseHistogram &wakeupJitter() const { return mJitter; }
 
  protected:
   SpaceMouseSpnav();
+  void rearmEventFd();
   virtual ~SpaceMouseSpnav();
 
+  // protected rather than private so that the microbenchmarks (src/bench) can drive them
+  /**
+   * @brief Processes a spacenavd packet of a device calling the appropriate callbacks for
+   * move, button press and button release events
+   */
+  void ProcessEvent(const SpaceMouseSpnavPacket &packet, int device = 0);
+  /**
+   * @brief Queues the pending (merged) motion of all devices, if there is any
+   */
+  void FlushMotion();
+
  private:
+  /** Input of a device, owned by the reader thread while it runs */
+  struct Source {
+    Source() : open(false), pendingTimestamp(0) { std::fill(sampledAxes, sampledAxes + 6, 0); }
+
+    /** Evdev node, empty for device 0 to search one (or if a further device is unused) */
+    std::string path;
+    /** Evdev node opened last, so that a search does not pick it for another device */
+    std::string node;
+    SpaceMouseEvdevClient evdev;
+    /** Whether the reader thread reads the device */
+    std::atomic<bool> open;
+    /** Motion received but not yet passed to the move callback */
+    SpaceMouseMotionAccumulator pendingMotion;
+    /** Arrival time of the oldest motion in pendingMotion */
+    std::chrono::steady_clock::time_point pendingSince;
+    /** Arrival time of the newest motion in pendingMotion, see monotonicTime() */
+    int64_t pendingTimestamp;
+    /** Last motion sample, summed up over all devices while frame sampling */
+    int sampledAxes[6];
+  };
+
+  /** Connection to spacenavd, read by the reader thread as device 0 unless mUseEvdev is set */
+  SpaceMouseSpnavClient mClient;
+  /** Device 0 is read from mSources[0].evdev instead of mClient */
+  bool mUseEvdev;
+  /** Inputs of the devices, indexed by SpaceMouseEvent::device */
+  Source mSources[kMaxDevices];
   std::unique_ptr<std::thread> mThread;
-  std::promise<void> mSignalExit;
+  /** Used by Close() to wake the reader thread blocking in poll() */
+  SpaceMouseWakeup mReaderWakeup;
+  /** Thread calling the callbacks for the events queued by the reader thread */
+  std::unique_ptr<std::thread> mDispatchThread;
+  /** Readable while there are queued events, watched by the dispatch thread or in pull mode */
+  SpaceMouseWakeup mDispatchWakeup;
+  std::atomic<bool> mStopDispatch;
+  /** Trace file the reader thread records to while mRecording is set */
+  SpaceMouseTraceWriter mTraceWriter;
+  std::mutex mTraceMutex;
+  std::atomic<bool> mRecording;
+  /** Device state shared with other processes, written by the reader thread while open */
+  SpaceMouseSharedStatePublisher mStatePublisher;
+  /** Trace replayed instead of reading from spacenavd, if open */
+  SpaceMouseTraceReader mTraceReader;
+  bool mReplayRealTime;
+  std::atomic<bool> mStopReplay;
+  /** Requested scheduling of the reader thread and the policy it actually got */
+  SpaceMouseReaderScheduling mScheduling;
+  SpaceMouseSchedulingPolicy mAppliedPolicy;
+  /** Kernel thread id of the reader thread (for its nice value), 0 if it is not running */
+  pid_t mReaderTid;
+  /** Nice value of the thread that started the reader, which the reader inherited */
+  int mDefaultNice;
+  /** Range of the reader's stack locked into RAM, nullptr if none */
+  void *mLockedStack;
+  std::size_t mLockedStackSize;
+  /** Whether the backend itself is locked into RAM */
+  bool mLockedSelf;
+  /** Timer expiring every probe interval while the jitter is measured, in the reader's epoll set */
+  int mJitterTimer;
+  SpaceMouseHistogram mJitter;
 
   /**
-   * @brief Processes a spacenav event calling the appropriate callbacks for
-   * move, button press and button release events
+   * @brief Opens the evdev node of a device (set by useEvdev() for device 0), searching for one
+   * if the path is empty
+   * @param report Whether a failure is logged as warning (or only for debugging)
+   */
+  bool OpenEvdev(int device, bool report = true);
+  /**
+   * @brief Connects device 0 to spacenavd or opens its evdev node (reader thread only)
+   * @param report Whether a failure is logged as warning (or only for debugging)
+   */
+  bool Connect(bool report);
+  /** @brief Stops reading a device, passing on its pending motion (reader thread only) */
+  void CloseSource(int device);
+  /** @brief Closes the sources of all devices while the reader thread is stopped */
+  void CloseSources();
+  /** File descriptor the packets of a device are read from, see SpaceMouseSpnavClient::fd() */
+  int SourceFd(int device) const {
+    return device == 0 && !mUseEvdev ? mClient.fd() : mSources[device].evdev.fd();
+  }
+  /** @brief Reads the pending packets of a device, see SpaceMouseSpnavClient::receive() */
+  int Receive(int device, const SpaceMouseSpnavPacket *&packets, std::size_t maxPackets) {
+    return device == 0 && !mUseEvdev ? mClient.receive(packets, maxPackets)
+                                     : mSources[device].evdev.receive(packets, maxPackets);
+  }
+  /** @brief Queues the pending (merged) motion of a device, if there is any */
+  void FlushSource(int device);
+  /**
+   * @brief Body of the reader thread. Sleeps in epoll_wait() on the sources of all devices and
+   * the wakeup pipe and drains all pending events of a device when it becomes readable. Connects
+   * device 0 while it is not connected, see Initialize().
+   */
+  void Run();
+  /**
+   * @brief Body of the reader thread while replaying a trace, see startReplay()
+   */
+  void Replay();
+  /**
+   * @brief Sleeps until the given monotonicTime(), false if the replay was stopped meanwhile
+   */
+  bool SleepUntil(int64_t time);
+  /** @brief Appends received packets to the trace file (if recording) */
+  void Record(const SpaceMouseSpnavPacket *packets, std::size_t count);
+  /**
+   * @brief Body of the dispatch thread. Sleeps on the event fd and calls the callbacks for the
+   * queued events whenever it becomes readable.
    */
-  void ProcessEvent(spnav_event sev);
+  void Dispatch();
+  void StartDispatch();
+  void StopDispatch();
+  /** @brief Starts the reader thread, reading the devices or replaying the trace */
+  void StartReader();
+  /** @brief Wakes up the reader thread and waits until it finished */
+  void StopReader();
+  /** @brief Applies mScheduling to the running reader thread, sets mAppliedPolicy */
+  void ApplyScheduling();
+  /** @brief Sets the scheduling policy (and priority or nice value) of the reader thread */
+  SpaceMouseSchedulingPolicy ApplyPolicy();
+  /** @brief Locks or unlocks the memory of the reader thread, see lockMemory */
+  void LockMemory(bool lock);
+  /** @brief Records how late the jitter probe timer woke up the reader thread */
+  void ReadJitterProbe();
 
   SpaceMouseSpnav(const SpaceMouseSpnav &);
   SpaceMouseSpnav &operator=(const SpaceMouseSpnav &);
@@ -259,9 +1135,7 @@ class SpaceMouse3DXWin : public SpaceMouseAbstract {
   void Close();
   void setWindowHandle(HWND winID) {
     mWinID = winID;
-    char buffer[50];
-    sprintf(buffer, "Window handle: %p", mWinID);
-    logFun(buffer);
+    SPACEMOUSE_LOG(SPML_DEBUG, "Window handle: %p", static_cast<void *>(mWinID));
     if(!mInitialized)
       Initialize();
   }
@@ -324,6 +1198,123 @@ class SpaceMouseDaemon {
   void setButtonReleaseCallback(std::function<void(SpaceMouseButtonEvent)> callback) {
     spaceMouse->setButtonReleaseCallback(callback);
   }
+  /** @brief Sets the window in milliseconds during which consecutive move events are merged
+   *  @see SpaceMouseAbstract::setCoalescingWindow
+   */
+  void setCoalescingWindow(int milliseconds) { spaceMouse->setCoalescingWindow(milliseconds); }
+  /** @brief Replaces the chain of filters applied to the motion samples
+   *  @see SpaceMouseAbstract::setFilterChain
+   */
+  bool setFilterChain(const SpaceMouseFilterStage *stages, int count) {
+    return spaceMouse->setFilterChain(stages, count);
+  }
+
+  /** @brief Switches between queueing the motion and sampling it once per frame
+   *  @see SpaceMouseAbstract::setFrameSampling
+   */
+  void setFrameSampling(bool enabled) { spaceMouse->setFrameSampling(enabled); }
+  /** @brief Fetches the motion since the previous call, extrapolated to frameTime
+   *  @see SpaceMouseAbstract::sampleMotion
+   */
+  bool sampleMotion(int64_t frameTime, double delta[6]) {
+    return spaceMouse->sampleMotion(frameTime, delta);
+  }
+
+  /** @see SpaceMouseAbstract::backpressure */
+  const SpaceMouseBackpressure &backpressure() const { return spaceMouse->backpressure(); }
+
+  /** @brief Switches between calling the callbacks and fetching the events with drainEvents()
+   *  @see SpaceMouseAbstract::setPullMode
+   */
+  void setPullMode(bool enabled) { spaceMouse->setPullMode(enabled); }
+  /** @brief Moves up to maxEvents queued events into events (pull mode only)
+   *  @see SpaceMouseAbstract::drainEvents
+   */
+  std::size_t drainEvents(SpaceMouseEvent *events, std::size_t maxEvents) {
+    return spaceMouse->drainEvents(events, maxEvents);
+  }
+  /** @brief Calls the callbacks for the queued events on the calling thread (pull mode only)
+   *  @see SpaceMouseAbstract::dispatchEvents
+   */
+  void dispatchEvents() {
+    if (spaceMouse->isPullMode())
+      spaceMouse->dispatchEvents();
+  }
+  /** @brief File descriptor that is readable while events are waiting in pull mode
+   *  @see SpaceMouseAbstract::eventFd
+   */
+  int eventFd() const { return spaceMouse->eventFd(); }
+
+#ifdef WITH_LIBSPACENAV
+  /** @see SpaceMouseSpnav::startRecording */
+  bool startRecording(const char *path) {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->startRecording(path);
+  }
+  /** @see SpaceMouseSpnav::stopRecording */
+  void stopRecording() { static_cast<SpaceMouseSpnav *>(spaceMouse)->stopRecording(); }
+  /** @see SpaceMouseSpnav::startReplay */
+  bool startReplay(const char *path, bool realTime) {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->startReplay(path, realTime);
+  }
+  /** @see SpaceMouseSpnav::waitForReplay */
+  void waitForReplay() { static_cast<SpaceMouseSpnav *>(spaceMouse)->waitForReplay(); }
+  /** @see SpaceMouseSpnav::stopReplay */
+  void stopReplay() { static_cast<SpaceMouseSpnav *>(spaceMouse)->stopReplay(); }
+  /** @see SpaceMouseSpnav::publishState */
+  bool publishState(const char *name) {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->publishState(name);
+  }
+  /** @see SpaceMouseSpnav::useEvdev */
+  bool useEvdev(const char *path) {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->useEvdev(path);
+  }
+  /** @see SpaceMouseSpnav::isEvdev */
+  bool isEvdev() const { return static_cast<SpaceMouseSpnav *>(spaceMouse)->isEvdev(); }
+  /** @see SpaceMouseSpnav::addDevice */
+  int addDevice(const char *path) {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->addDevice(path);
+  }
+  /** @see SpaceMouseSpnav::removeDevice */
+  bool removeDevice(int device) {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->removeDevice(device);
+  }
+  /** @see SpaceMouseSpnav::hasDevice */
+  bool hasDevice(int device) const {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->hasDevice(device);
+  }
+  /** @see SpaceMouseSpnav::isDeviceOpen */
+  bool isDeviceOpen(int device) const {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->isDeviceOpen(device);
+  }
+  /** @see SpaceMouseSpnav::deviceSource */
+  std::string deviceSource(int device) const {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->deviceSource(device);
+  }
+  /** @see SpaceMouseSpnav::deviceProfile */
+  const SpaceMouseDeviceProfile &deviceProfile(int device) const {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->deviceProfile(device);
+  }
+  /** @see SpaceMouseSpnav::setReaderScheduling */
+  SpaceMouseSchedulingPolicy setReaderScheduling(const SpaceMouseReaderScheduling &scheduling) {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->setReaderScheduling(scheduling);
+  }
+  /** @see SpaceMouseSpnav::readerScheduling */
+  const SpaceMouseReaderScheduling &readerScheduling() const {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->readerScheduling();
+  }
+  /** @see SpaceMouseSpnav::readerPolicy */
+  SpaceMouseSchedulingPolicy readerPolicy() const {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->readerPolicy();
+  }
+  /** @see SpaceMouseSpnav::setJitterProbe */
+  void setJitterProbe(int64_t interval) {
+    static_cast<SpaceMouseSpnav *>(spaceMouse)->setJitterProbe(interval);
+  }
+  /** @see SpaceMouseSpnav::wakeupJitter */
+  const SpaceMouseHistogram &wakeupJitter() const {
+    return static_cast<SpaceMouseSpnav *>(spaceMouse)->wakeupJitter();
+  }
+#endif  // WITH_LIBSPACENAV
 
 #ifdef WITH_LIB3DX_WIN
   void setWindowHandle(HWND winID) {
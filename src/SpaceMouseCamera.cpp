@@ -0,0 +1,309 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#include "SpaceMouseCamera.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SPACEMOUSE_FIT_SSE
+#endif
+
+namespace spacemouse {
+
+namespace {
+const double kPi = 3.14159265358979323846;
+/** Minimal angle between the camera ray and the poles of the constrained orbit */
+const double kPoleClearance = 0.1;
+
+double dot(const double a[3], const double b[3]) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+void cross(const double a[3], const double b[3], double result[3]) {
+  result[0] = a[1] * b[2] - a[2] * b[1];
+  result[1] = a[2] * b[0] - a[0] * b[2];
+  result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/** Same as UM.Math.Vector.normalized(): vectors of length 0 are left as they are */
+void normalize(double v[3]) {
+  double length = std::sqrt(dot(v, v));
+  if (length != 0) {
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+  }
+}
+
+/** result = a * b for row-major 4x4 matrices, result must not alias a or b */
+void multiply(const double a[16], const double b[16], double result[16]) {
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 4; ++j)
+      result[4 * i + j] = a[4 * i] * b[j] + a[4 * i + 1] * b[4 + j] + a[4 * i + 2] * b[8 + j] +
+                          a[4 * i + 3] * b[12 + j];
+}
+
+/** Same as UM.Math.Matrix.setByRotationAxis(angle, direction, point) */
+void rotationAroundAxis(double angle, const double direction[3], const double point[3],
+                        double result[16]) {
+  const double sina = std::sin(angle);
+  const double cosa = std::cos(angle);
+  const double length = std::sqrt(dot(direction, direction));
+  const double d[3] = {direction[0] / length, direction[1] / length, direction[2] / length};
+
+  double r[3][3];
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j) r[i][j] = (i == j ? cosa : 0.0) + d[i] * d[j] * (1.0 - cosa);
+  r[0][1] -= d[2] * sina;
+  r[0][2] += d[1] * sina;
+  r[1][0] += d[2] * sina;
+  r[1][2] -= d[0] * sina;
+  r[2][0] -= d[1] * sina;
+  r[2][1] += d[0] * sina;
+
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) result[4 * i + j] = r[i][j];
+    // rotation around point instead of the origin
+    result[4 * i + 3] = point[i] - (r[i][0] * point[0] + r[i][1] * point[1] + r[i][2] * point[2]);
+  }
+  result[12] = result[13] = result[14] = 0.0;
+  result[15] = 1.0;
+}
+
+/** Minimal number of vertices handed to one thread of the fit reduction */
+const std::size_t kFitVerticesPerThread = 1 << 16;
+
+/**
+ * Four planes that bound the selection in view space in the form n.x * x + n.y * y + n.z * z + d,
+ * stored column-wise (all x coefficients, all y coefficients, ...) as needed for the SIMD loop
+ */
+struct FitPlanes {
+  float columns[4][4];
+};
+
+/**
+ * Maximizes the four plane functions over the vertices [begin, end) of one mesh
+ * @param maxima In: maxima so far, out: updated maxima
+ */
+void reduceVertices(const FitPlanes &planes, const float *vertices, std::size_t begin,
+                    std::size_t end, float maxima[4]) {
+#ifdef SPACEMOUSE_FIT_SSE
+  const __m128 cx = _mm_loadu_ps(planes.columns[0]);
+  const __m128 cy = _mm_loadu_ps(planes.columns[1]);
+  const __m128 cz = _mm_loadu_ps(planes.columns[2]);
+  const __m128 cw = _mm_loadu_ps(planes.columns[3]);
+  // two accumulators to hide the latency of the max
+  __m128 acc0 = _mm_loadu_ps(maxima);
+  __m128 acc1 = acc0;
+  std::size_t i = begin;
+  for (; i + 2 <= end; i += 2) {
+    const float *v = vertices + 3 * i;
+    __m128 p0 = _mm_add_ps(_mm_mul_ps(cx, _mm_load1_ps(v)), cw);
+    __m128 p1 = _mm_add_ps(_mm_mul_ps(cx, _mm_load1_ps(v + 3)), cw);
+    p0 = _mm_add_ps(_mm_mul_ps(cy, _mm_load1_ps(v + 1)), p0);
+    p1 = _mm_add_ps(_mm_mul_ps(cy, _mm_load1_ps(v + 4)), p1);
+    p0 = _mm_add_ps(_mm_mul_ps(cz, _mm_load1_ps(v + 2)), p0);
+    p1 = _mm_add_ps(_mm_mul_ps(cz, _mm_load1_ps(v + 5)), p1);
+    acc0 = _mm_max_ps(acc0, p0);
+    acc1 = _mm_max_ps(acc1, p1);
+  }
+  if (i < end) {
+    const float *v = vertices + 3 * i;
+    __m128 p = _mm_add_ps(_mm_mul_ps(cx, _mm_load1_ps(v)), cw);
+    p = _mm_add_ps(_mm_mul_ps(cy, _mm_load1_ps(v + 1)), p);
+    p = _mm_add_ps(_mm_mul_ps(cz, _mm_load1_ps(v + 2)), p);
+    acc0 = _mm_max_ps(acc0, p);
+  }
+  _mm_storeu_ps(maxima, _mm_max_ps(acc0, acc1));
+#else
+  for (std::size_t i = begin; i < end; ++i) {
+    const float *v = vertices + 3 * i;
+    for (int k = 0; k < 4; ++k) {
+      const float p = planes.columns[0][k] * v[0] + planes.columns[1][k] * v[1] +
+                      planes.columns[2][k] * v[2] + planes.columns[3][k];
+      maxima[k] = std::max(maxima[k], p);
+    }
+  }
+#endif
+}
+
+/**
+ * Maximizes the four plane functions over the vertices [begin, end) of the concatenation of all
+ * meshes
+ */
+void reduceRange(const SpaceMouseFitMesh *meshes, const FitPlanes *planes, std::size_t meshCount,
+                 std::size_t begin, std::size_t end, float maxima[4]) {
+  std::size_t offset = 0;
+  for (std::size_t m = 0; m < meshCount && offset < end; ++m) {
+    const std::size_t count = meshes[m].vertexCount;
+    if (offset + count > begin) {
+      const std::size_t first = begin > offset ? begin - offset : 0;
+      const std::size_t last = std::min(count, end - offset);
+      reduceVertices(planes[m], meshes[m].vertices, first, last, maxima);
+    }
+    offset += count;
+  }
+}
+}  // namespace
+
+void orbitCameraFree(double matrix[16], const double origin[3], const double rotation[3],
+                     double scale) {
+  const double angle = std::sqrt(dot(rotation, rotation));
+  if (angle == 0)
+    return;  // rotation by 0 around (0, 0, 1)
+
+  // compute axis in view space:
+  // space mouse system: x: right, y: front, z: down
+  // camera system:     x: right, y: up,    z: front
+  const double axisInViewSpace[3] = {-rotation[0] / angle, rotation[2] / angle,
+                                     -rotation[1] / angle};
+
+  // rotate axis into world space (the translation of the camera cancels out)
+  double axisInWorldSpace[3];
+  for (int i = 0; i < 3; ++i)
+    axisInWorldSpace[i] = matrix[4 * i] * axisInViewSpace[0] +
+                          matrix[4 * i + 1] * axisInViewSpace[1] +
+                          matrix[4 * i + 2] * axisInViewSpace[2];
+
+  double rotMat[16];
+  rotationAroundAxis(angle * scale, axisInWorldSpace, origin, rotMat);
+
+  const double oldMatrix[16] = {matrix[0],  matrix[1],  matrix[2],  matrix[3],
+                                matrix[4],  matrix[5],  matrix[6],  matrix[7],
+                                matrix[8],  matrix[9],  matrix[10], matrix[11],
+                                matrix[12], matrix[13], matrix[14], matrix[15]};
+  multiply(rotMat, oldMatrix, matrix);
+}
+
+bool orbitCameraConstrained(double matrix[16], const double origin[3], const double rotation[3],
+                            double scale) {
+  const double angleAzim = rotation[2] * scale;
+  const double angleIncl = rotation[0] * scale;
+  const double up[3] = {0.0, 1.0, 0.0};
+
+  const double oldEye[3] = {matrix[3], matrix[7], matrix[11]};
+  double camToTarget[3] = {origin[0] - oldEye[0], origin[1] - oldEye[1], origin[2] - oldEye[2]};
+  normalize(camToTarget);
+
+  // compute angle between up axis and current camera ray
+  const double cosToY = dot(up, camToTarget);
+  if (!(cosToY >= -1.0 && cosToY <= 1.0))
+    return false;
+  const double angleToY = std::acos(cosToY);
+
+  // compute new position of camera
+  double rotMat[16];
+  rotationAroundAxis(angleAzim, up, origin, rotMat);
+  // prevent camera from rotating to close to the poles
+  if ((angleToY > kPoleClearance || angleIncl > 0) &&
+      (angleToY < kPi - kPoleClearance || angleIncl < 0)) {
+    double inclAxis[3];
+    cross(up, camToTarget, inclAxis);
+    normalize(inclAxis);
+    double inclMat[16];
+    rotationAroundAxis(angleIncl, inclAxis, origin, inclMat);
+    double azimMat[16];
+    for (int i = 0; i < 16; ++i) azimMat[i] = rotMat[i];
+    multiply(azimMat, inclMat, rotMat);
+  }
+  double newEye[3];
+  for (int i = 0; i < 3; ++i)
+    newEye[i] = rotMat[4 * i] * oldEye[0] + rotMat[4 * i + 1] * oldEye[1] +
+                rotMat[4 * i + 2] * oldEye[2] + rotMat[4 * i + 3];
+
+  // look at (from UM.Scene.SceneNode)
+  double f[3] = {origin[0] - newEye[0], origin[1] - newEye[1], origin[2] - newEye[2]};
+  normalize(f);
+  double s[3];
+  cross(f, up, s);
+  normalize(s);
+  double u[3];
+  cross(s, f, u);
+  normalize(u);
+
+  // new matrix for camera including the new position and orientation from looking at the
+  // rotation center
+  for (int i = 0; i < 3; ++i) {
+    matrix[4 * i] = s[i];
+    matrix[4 * i + 1] = u[i];
+    matrix[4 * i + 2] = -f[i];
+    matrix[4 * i + 3] = newEye[i];
+  }
+  matrix[12] = matrix[13] = matrix[14] = 0.0;
+  matrix[15] = 1.0;
+  return true;
+}
+
+bool fitCamera(const SpaceMouseFitMesh *meshes, std::size_t meshCount, const double viewMatrix[16],
+               const SpaceMouseFitParameters &parameters, SpaceMouseFitResult &result) {
+  // Perspective: a vertex at view-space (x, y, z) is inside the frustum of the camera moved by
+  // (cx, cy, t) iff |x - cx| <= tanHalfFovX * (t - z), i.e. iff both x / tanHalfFovX + z and
+  // -x / tanHalfFovX + z are bounded by t -+ cx / tanHalfFovX (same for y). Hence the four maxima
+  // of these functions over all vertices determine the optimal shift and distance. Orthographic:
+  // the maxima of x, -x, y and -y are the extents of the selection.
+  const double scale = 1.0 + 2.0 * parameters.border;
+  double a = 1.0, b = 1.0, c = 0.0;
+  if (parameters.perspective) {
+    a = scale / parameters.tanHalfFovX;
+    b = scale / parameters.tanHalfFovY;
+    c = 1.0;
+  }
+  const double factors[4][2] = {{a, 0.0}, {-a, 0.0}, {0.0, b}, {0.0, -b}};
+
+  std::vector<FitPlanes> planes(meshCount);
+  std::size_t totalCount = 0;
+  for (std::size_t m = 0; m < meshCount; ++m) {
+    // transformation from local mesh coordinates into view space
+    double modelView[16];
+    multiply(viewMatrix, meshes[m].transformation, modelView);
+    for (int k = 0; k < 4; ++k)
+      for (int j = 0; j < 4; ++j)
+        planes[m].columns[j][k] = static_cast<float>(factors[k][0] * modelView[j] +
+                                                     factors[k][1] * modelView[4 + j] +
+                                                     c * modelView[8 + j]);
+    totalCount += meshes[m].vertexCount;
+  }
+  if (totalCount == 0)
+    return false;
+
+  std::size_t threadCount = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                                  totalCount / kFitVerticesPerThread);
+  threadCount = std::max<std::size_t>(threadCount, 1);
+  const std::size_t chunk = (totalCount + threadCount - 1) / threadCount;
+
+  std::vector<float> maxima(4 * threadCount, -std::numeric_limits<float>::infinity());
+  std::vector<std::thread> workers;
+  for (std::size_t t = 1; t < threadCount; ++t)
+    workers.push_back(std::thread(reduceRange, meshes, planes.data(), meshCount, t * chunk,
+                                  std::min(totalCount, (t + 1) * chunk), &maxima[4 * t]));
+  reduceRange(meshes, planes.data(), meshCount, 0, std::min(totalCount, chunk), &maxima[0]);
+  for (std::size_t t = 0; t < workers.size(); ++t) {
+    workers[t].join();
+    for (int k = 0; k < 4; ++k) maxima[k] = std::max(maxima[k], maxima[4 * (t + 1) + k]);
+  }
+
+  const double maxX = maxima[0], minusMinX = maxima[1];
+  const double maxY = maxima[2], minusMinY = maxima[3];
+  if (parameters.perspective) {
+    result.translation[0] = (maxX - minusMinX) / 2.0 / a;
+    result.translation[1] = (maxY - minusMinY) / 2.0 / b;
+    result.translation[2] = std::max(maxX + minusMinX, maxY + minusMinY) / 2.0;
+    result.zoomFactor = 0.0;
+  } else {
+    result.translation[0] = (maxX - minusMinX) / 2.0;
+    result.translation[1] = (maxY - minusMinY) / 2.0;
+    result.translation[2] = 0.0;
+    // set zoom factor in such a way, that the width or height with border fills the width or
+    // height of the viewport, respectively
+    const double zoomFactorHor = scale * (maxX + minusMinX) / 2.0 / parameters.viewportWidth - 0.5;
+    const double zoomFactorVer = scale * (maxY + minusMinY) / 2.0 / parameters.viewportHeight - 0.5;
+    result.zoomFactor = std::max(zoomFactorHor, zoomFactorVer);
+  }
+  return true;
+}
+
+}  // namespace spacemouse
@@ -0,0 +1,105 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSECAMERA_HPP
+#define SPACEMOUSECAMERA_HPP
+
+#include <cstddef>
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Camera kernels                                                           */
+/*--------------------------------------------------------------------------*/
+/*
+ * The kernels operate on the camera transformation as stored by Uranium's Matrix, i.e. a row-major
+ * 4x4 matrix acting on column vectors with the camera position in the last column. They reproduce
+ * the orbit models of SpaceMouseTool.py (_rotateCameraFree and _rotateCameraConstrained) with the
+ * same floating point operations, assuming the camera is a direct child of the scene root (local
+ * and world transformation coincide), which is the case in Cura.
+ */
+
+/**
+ * @brief Rotates the camera freely around origin
+ * @param matrix   Camera transformation, updated in place
+ * @param origin   Rotation center in world space
+ * @param rotation Raw rotation vector (rx, ry, rz) of the space mouse, its norm is the angle and
+ *                 its direction the axis in space mouse coordinates
+ * @param scale    Factor converting the raw angle into radians
+ */
+void orbitCameraFree(double matrix[16], const double origin[3], const double rotation[3],
+                     double scale);
+
+/**
+ * @brief Rotates the camera on a constrained orbit around origin, i.e. by an azimuth around the
+ * world y axis and an inclination that stops close to the poles, keeping the camera looking at
+ * origin
+ * @param matrix   Camera transformation, updated in place
+ * @param origin   Rotation center in world space
+ * @param rotation Raw rotation vector (rx, ry, rz) of the space mouse, rz drives the azimuth and rx
+ *                 the inclination
+ * @param scale    Factor converting the raw angles into radians
+ * @return false if the camera was left unchanged because its orientation was degenerate
+ */
+bool orbitCameraConstrained(double matrix[16], const double origin[3], const double rotation[3],
+                            double scale);
+
+/*--------------------------------------------------------------------------*/
+/* Fit to selection                                                         */
+/*--------------------------------------------------------------------------*/
+/** @brief Vertex buffer of one mesh as stored by Uranium's MeshData */
+struct SpaceMouseFitMesh {
+  /** Tightly packed x, y, z triples in local coordinates of the mesh */
+  const float *vertices;
+  std::size_t vertexCount;
+  /** World transformation of the mesh, row-major like the camera matrix */
+  const double *transformation;
+};
+
+/** @brief View parameters of the camera the selection is fitted into */
+struct SpaceMouseFitParameters {
+  bool perspective;
+  /** Tangents of the horizontal and vertical half field of view (perspective only) */
+  double tanHalfFovX;
+  double tanHalfFovY;
+  /** Viewport size in pixels (orthographic only) */
+  double viewportWidth;
+  double viewportHeight;
+  /** Border around the fitted selection relative to its extents on each side */
+  double border;
+};
+
+/** @brief Camera change that fits the selection */
+struct SpaceMouseFitResult {
+  /** Translation of the camera in its own (view) coordinate system */
+  double translation[3];
+  /** New zoom factor (orthographic only) */
+  double zoomFactor;
+};
+
+/**
+ * @brief Computes how the camera has to be moved such that all given vertices are visible and
+ * fill the view as far as possible
+ *
+ * In perspective views the camera is shifted in its view plane and moved along its view direction
+ * such that every vertex is inside the frustum, with the selection touching the border on both
+ * sides of the tighter direction. In orthographic views the camera is shifted onto the center of
+ * the view-space extents and the zoom factor is chosen as in _fitSelection of SpaceMouseTool.py.
+ * The view direction of the camera is never changed.
+ *
+ * The vertices are reduced in one pass with SIMD where available, and large selections are split
+ * across threads.
+ *
+ * @param meshes     Meshes to fit
+ * @param meshCount  Number of meshes
+ * @param viewMatrix Inverse world transformation of the camera
+ * @param parameters View parameters of the camera
+ * @param result     Set to the camera change on success
+ * @return false if there are no vertices to fit
+ */
+bool fitCamera(const SpaceMouseFitMesh *meshes, std::size_t meshCount, const double viewMatrix[16],
+               const SpaceMouseFitParameters &parameters, SpaceMouseFitResult &result);
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSECAMERA_HPP
@@ -0,0 +1,226 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#include "SpaceMouseEvdevClient.hpp"
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace spacemouse {
+
+const std::size_t SpaceMouseEvdevClient::kMaxEvents;
+const int SpaceMouseEvdevClient::kAxisMap[6] = {0, 2, 1, 3, 5, 4};
+const int SpaceMouseEvdevClient::kAxisSign[6] = {1, -1, -1, 1, -1, -1};
+
+namespace {
+/** Number of buttons, i.e. BTN_0 to BTN_0 + 31, as in SpaceMouseButtonMap */
+const int kButtons = 32;
+
+int64_t eventMilliseconds(const input_event &event) {
+#ifdef input_event_sec
+  return static_cast<int64_t>(event.input_event_sec) * 1000 + event.input_event_usec / 1000;
+#else
+  return static_cast<int64_t>(event.time.tv_sec) * 1000 + event.time.tv_usec / 1000;
+#endif  // input_event_sec
+}
+}  // namespace
+
+SpaceMouseEvdevClient::SpaceMouseEvdevClient()
+    : mFd(-1),
+      mVendor(0),
+      mProduct(0),
+      mPartialOffset(0),
+      mPartialSize(0),
+      mPacketCount(0),
+      mPacketCapacity(0),
+      mRelativeAxes(0),
+      mMotion(false),
+      mDropping(false),
+      mStale(false),
+      mButtons(0),
+      mLastMotion(0) {
+  std::fill(mAxes, mAxes + 6, 0);
+}
+
+SpaceMouseEvdevClient::~SpaceMouseEvdevClient() { close(); }
+
+bool SpaceMouseEvdevClient::open(const char *path) {
+  close();
+  int fd = ::open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  mFd = fd;
+  input_id id;
+  if (ioctl(fd, EVIOCGID, &id) == 0) {
+    mVendor = id.vendor;
+    mProduct = id.product;
+    // start with the buttons and axes as they are right now
+    mStale = true;
+  }
+  return true;
+}
+
+void SpaceMouseEvdevClient::close() {
+  if (mFd != -1) {
+    ::close(mFd);
+    mFd = -1;
+  }
+  mVendor = mProduct = 0;
+  mPartialOffset = mPartialSize = 0;
+  std::fill(mAxes, mAxes + 6, 0);
+  mRelativeAxes = 0;
+  mMotion = mDropping = mStale = false;
+  mButtons = 0;
+  mLastMotion = 0;
+}
+
+int SpaceMouseEvdevClient::receive(const SpaceMouseSpnavPacket *&packets,
+                                   std::size_t maxPackets) {
+  packets = mPackets;
+  mPacketCount = 0;
+  if (mFd == -1)
+    return -1;
+  mPacketCapacity = std::min(maxPackets, kMaxEvents);
+  if (mStale)
+    resync();
+  // every event results in at most one packet
+  const std::size_t maxEvents = mPacketCapacity - mPacketCount;
+  if (maxEvents == 0)
+    return static_cast<int>(mPacketCount);
+
+  // the kernel only hands out whole events, but a pipe may split them. Events left over by the
+  // previous call, as their packets did not fit, are kept in front of the partial one.
+  char *bytes = reinterpret_cast<char *>(mEvents);
+  if (mPartialSize > 0 && mPartialOffset > 0)
+    std::memmove(bytes, bytes + mPartialOffset, mPartialSize);
+  mPartialOffset = 0;
+
+  std::size_t size = mPartialSize;
+  const std::size_t capacity = maxEvents * sizeof(input_event);
+  if (size < capacity) {
+    ssize_t received;
+    do {
+      received = read(mFd, bytes + size, capacity - size);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0 && errno != EAGAIN)
+      return -1;  // ENODEV: unplugged
+    if (received == 0 && size < sizeof(input_event))
+      return -1;  // end of the file or pipe, and no events left over
+    if (received > 0)
+      size += static_cast<std::size_t>(received);
+  }
+
+  const std::size_t count = size / sizeof(input_event);
+  std::size_t processed = 0;
+  while (processed < count && process(mEvents[processed])) ++processed;
+  mPartialOffset = processed * sizeof(input_event);
+  mPartialSize = size - mPartialOffset;
+  return static_cast<int>(mPacketCount);
+}
+
+bool SpaceMouseEvdevClient::process(const input_event &event) {
+  if (mDropping) {
+    // the kernel lost events, whatever came since the last report is incomplete
+    if (event.type == EV_SYN && event.code == SYN_REPORT) {
+      mDropping = false;
+      mMotion = false;
+      resync();
+    }
+    return true;
+  }
+
+  switch (event.type) {
+    case EV_KEY: {
+      const int index = event.code - BTN_0;
+      if (index < 0 || index >= kButtons || event.value == 2)
+        break;  // no button of ours, or auto repeat
+      const uint32_t bit = uint32_t(1) << index;
+      const bool pressed = event.value != 0;
+      if (pressed == ((mButtons & bit) != 0))
+        break;
+      if (mPacketCount == mPacketCapacity)
+        return false;
+      mButtons ^= bit;
+      SpaceMouseSpnavPacket &packet = mPackets[mPacketCount++];
+      std::memset(&packet, 0, sizeof(packet));
+      packet.type = pressed ? SPNAV_PACKET_PRESS : SPNAV_PACKET_RELEASE;
+      packet.data[0] = index;
+      break;
+    }
+    case EV_REL:
+    case EV_ABS:
+      if (event.code < 6) {
+        mAxes[event.code] = event.value;
+        if (event.type == EV_REL)
+          mRelativeAxes |= 1u << event.code;
+        else
+          mRelativeAxes &= ~(1u << event.code);
+        mMotion = true;
+      }
+      break;
+    case EV_SYN:
+      if (event.code == SYN_REPORT)
+        return flushMotion(event);
+      if (event.code == SYN_DROPPED)
+        mDropping = true;
+      break;
+  }
+  return true;
+}
+
+bool SpaceMouseEvdevClient::flushMotion(const input_event &event) {
+  if (!mMotion)
+    return true;
+  if (mPacketCount == mPacketCapacity)
+    return false;
+  mMotion = false;
+  SpaceMouseSpnavPacket &packet = mPackets[mPacketCount++];
+  packet.type = SPNAV_PACKET_MOTION;
+  for (int axis = 0; axis < 6; ++axis) packet.data[axis] = kAxisSign[axis] * mAxes[kAxisMap[axis]];
+  const int64_t now = eventMilliseconds(event);
+  packet.data[6] = mLastMotion == 0 ? 0 : static_cast<int32_t>(now - mLastMotion);
+  mLastMotion = now;
+  // relative axes that are not reported in the next report are 0
+  for (int axis = 0; axis < 6; ++axis)
+    if ((mRelativeAxes & (1u << axis)) != 0)
+      mAxes[axis] = 0;
+  return true;
+}
+
+void SpaceMouseEvdevClient::resync() {
+  mStale = false;
+  unsigned char keys[KEY_MAX / 8 + 1];
+  std::memset(keys, 0, sizeof(keys));
+  if (ioctl(mFd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+    for (int index = 0; index < kButtons; ++index) {
+      const int code = BTN_0 + index;
+      const bool pressed = ((keys[code / 8] >> (code % 8)) & 1) != 0;
+      const uint32_t bit = uint32_t(1) << index;
+      if (pressed == ((mButtons & bit) != 0))
+        continue;
+      if (mPacketCount == mPacketCapacity) {
+        mStale = true;  // pass on the rest with the next receive()
+        break;
+      }
+      mButtons ^= bit;
+      SpaceMouseSpnavPacket &packet = mPackets[mPacketCount++];
+      std::memset(&packet, 0, sizeof(packet));
+      packet.type = pressed ? SPNAV_PACKET_PRESS : SPNAV_PACKET_RELEASE;
+      packet.data[0] = index;
+    }
+  }
+  for (int axis = 0; axis < 6; ++axis) {
+    input_absinfo info;
+    if ((mRelativeAxes & (1u << axis)) == 0 && ioctl(mFd, EVIOCGABS(axis), &info) >= 0) {
+      mAxes[axis] = info.value;
+      mMotion = true;  // passed on with the next report
+    }
+  }
+}
+
+}  // namespace spacemouse
@@ -0,0 +1,122 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSEEVDEVCLIENT_HPP
+#define SPACEMOUSEEVDEVCLIENT_HPP
+
+#include <linux/input.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "SpaceMouseSpnavClient.hpp"
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Direct access to the evdev node of the device                            */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Reads the input events of a space mouse from its /dev/input/event* node, bypassing
+ * spacenavd, and turns them into the packets spacenavd would have sent for them.
+ *
+ * Like spacenavd, button events (EV_KEY, numbered from BTN_0) are passed on right away, while the
+ * axes (EV_REL or EV_ABS, x, y, z, rx, ry, rz) are collected until the SYN_REPORT closing the
+ * report and then passed on as one motion packet. Absolute axes keep their value until it changes,
+ * relative ones are 0 unless reported, as the kernel does not pass on relative events of value 0.
+ * The axes are converted to the coordinate system of spacenavd (y up, z towards the user). After
+ * a SYN_DROPPED (the kernel buffer overflowed) the rest of the report is discarded and the buttons
+ * and absolute axes are read back from the device.
+ *
+ * Any file delivering struct input_event works, e.g. a pipe replaying the bytes recorded with
+ * `cat /dev/input/eventN > file`. Reading the node requires read access to it, usually granted to
+ * the logged-in user by a udev rule (TAG+="uaccess").
+ */
+class SpaceMouseEvdevClient {
+ public:
+  /** Maximal number of input events read (and packets returned) by one call to receive() */
+  static const std::size_t kMaxEvents = 64;
+  /**
+   * spacenavd axis i is the device axis kAxisMap[i] times kAxisSign[i]: the devices report y
+   * towards the user and z down, spacenavd (like 3dxsrv) y up and z towards the user
+   */
+  static const int kAxisMap[6];
+  static const int kAxisSign[6];
+
+  SpaceMouseEvdevClient();
+  ~SpaceMouseEvdevClient();
+
+  /**
+   * @brief Opens an evdev node (or any other file delivering input events)
+   * @return false if the file could not be opened
+   */
+  bool open(const char *path);
+  void close();
+  bool isOpen() const { return mFd != -1; }
+  /** File to poll() for incoming events, -1 if not open */
+  int fd() const { return mFd; }
+  /** USB vendor and product id of the device, 0 if the file is no evdev node */
+  unsigned vendor() const { return mVendor; }
+  unsigned product() const { return mProduct; }
+
+  /**
+   * @brief Reads the pending input events without blocking and converts them into packets
+   * @param packets    Set to the resulting packets, valid until the next call to receive()
+   * @param maxPackets Maximal number of packets to return (at most kMaxEvents)
+   * @return Number of packets in packets (0 if nothing is pending or the events read did not
+   *         complete a report) or -1 if the device was removed or the file ended
+   */
+  int receive(const SpaceMouseSpnavPacket *&packets, std::size_t maxPackets);
+
+ private:
+  /**
+   * @brief Handles one input event, appending the resulting packets
+   * @return false if there is no room for its packet, the event is then handled by the next
+   *         receive()
+   */
+  bool process(const input_event &event);
+  /** @brief Appends the motion packet of the finished report, false if there is no room */
+  bool flushMotion(const input_event &event);
+  /** @brief Reads the state of the buttons and absolute axes back after a SYN_DROPPED */
+  void resync();
+
+  int mFd;
+  unsigned mVendor;
+  unsigned mProduct;
+  /**
+   * Events read by the last read(), followed by a partial event if it was split. The events
+   * not handled as their packets did not fit are kept for the next receive().
+   */
+  input_event mEvents[kMaxEvents];
+  /** Start of the bytes in mEvents kept for the next receive() */
+  std::size_t mPartialOffset;
+  /** Number of bytes kept for the next receive(), left over events and a partial one */
+  std::size_t mPartialSize;
+  SpaceMouseSpnavPacket mPackets[kMaxEvents];
+  /** Number of packets in mPackets */
+  std::size_t mPacketCount;
+  /** Maximal number of packets in mPackets during this receive() */
+  std::size_t mPacketCapacity;
+
+  /** Raw device values of x, y, z, rx, ry, rz */
+  int mAxes[6];
+  /** Bit i is set if axis i is reported as EV_REL */
+  unsigned mRelativeAxes;
+  /** Whether the current report changed any axis */
+  bool mMotion;
+  /** Events are discarded until the next SYN_REPORT */
+  bool mDropping;
+  /** Buttons and absolute axes have to be read back before the next report */
+  bool mStale;
+  /** Bit i is set while the button BTN_0 + i is held down */
+  uint32_t mButtons;
+  /** Time of the previous motion packet in ms, for its period field */
+  int64_t mLastMotion;
+
+  SpaceMouseEvdevClient(const SpaceMouseEvdevClient &);             // not implemented
+  SpaceMouseEvdevClient &operator=(const SpaceMouseEvdevClient &);  // not implemented
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSEEVDEVCLIENT_HPP
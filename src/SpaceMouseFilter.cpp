@@ -0,0 +1,120 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#include "SpaceMouseFilter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace spacemouse {
+
+static const double kPi = 3.14159265358979323846;
+
+/**
+ * Bounds of the time step of the One-Euro filter. Without them the first sample after a pause
+ * would pass unfiltered, and a burst of samples read at once would not move at all.
+ */
+static const double kMinTimeStep = 1e-4;
+static const double kMaxTimeStep = 0.1;
+
+/** @brief Smoothing factor of a low pass with the given cutoff frequency */
+static double lowPassAlpha(double cutoff, double timeStep) {
+  const double tau = 1.0 / (2.0 * kPi * cutoff);
+  return 1.0 / (1.0 + tau / timeStep);
+}
+
+SpaceMouseFilterChain::SpaceMouseFilterChain() : mCount(0), mLastTimestamp(0) { reset(); }
+
+bool SpaceMouseFilterChain::configure(const SpaceMouseFilterStage *stages, int count) {
+  if (count < 0 || count > kMaxStages)
+    return false;
+  for (int i = 0; i < count; ++i) {
+    const double *p = stages[i].parameters;
+    bool valid = false;
+    switch (stages[i].type) {
+      case SPMF_DEADZONE:
+        valid = p[0] >= 0 && p[1] >= 0 && p[1] <= p[0];
+        break;
+      case SPMF_EMA:
+        valid = p[0] > 0 && p[0] <= 1;
+        break;
+      case SPMF_ONE_EURO:
+        valid = p[0] > 0 && p[1] >= 0 && p[2] > 0;
+        break;
+    }
+    if (!valid)
+      return false;
+  }
+  std::copy(stages, stages + count, mStages);
+  mCount = count;
+  reset();
+  return true;
+}
+
+void SpaceMouseFilterChain::reset() {
+  for (int i = 0; i < kMaxStages; ++i) {
+    for (int axis = 0; axis < 6; ++axis) {
+      mState[i].value[axis] = 0;
+      mState[i].derivative[axis] = 0;
+      mState[i].active[axis] = false;
+    }
+  }
+  mLastTimestamp = 0;
+}
+
+bool SpaceMouseFilterChain::apply(int axes[6], int64_t timestamp) {
+  if (mCount == 0)
+    return true;
+  const double timeStep =
+      mLastTimestamp == 0
+          ? kMaxTimeStep
+          : std::min(std::max((timestamp - mLastTimestamp) * 1e-9, kMinTimeStep), kMaxTimeStep);
+  mLastTimestamp = timestamp;
+
+  double values[6];
+  for (int axis = 0; axis < 6; ++axis) values[axis] = axes[axis];
+
+  for (int i = 0; i < mCount; ++i) {
+    const double *p = mStages[i].parameters;
+    State &state = mState[i];
+    switch (mStages[i].type) {
+      case SPMF_DEADZONE:
+        for (int axis = 0; axis < 6; ++axis) {
+          const double magnitude = std::fabs(values[axis]);
+          if (state.active[axis])
+            state.active[axis] = magnitude >= p[0] - p[1];
+          else
+            state.active[axis] = magnitude >= p[0] && magnitude > 0;
+          if (!state.active[axis])
+            values[axis] = 0;
+        }
+        break;
+      case SPMF_EMA:
+        for (int axis = 0; axis < 6; ++axis) {
+          state.value[axis] += p[0] * (values[axis] - state.value[axis]);
+          values[axis] = state.value[axis];
+        }
+        break;
+      case SPMF_ONE_EURO: {
+        const double derivativeAlpha = lowPassAlpha(p[2], timeStep);
+        for (int axis = 0; axis < 6; ++axis) {
+          const double speed = (values[axis] - state.value[axis]) / timeStep;
+          state.derivative[axis] += derivativeAlpha * (speed - state.derivative[axis]);
+          const double cutoff = p[0] + p[1] * std::fabs(state.derivative[axis]);
+          state.value[axis] += lowPassAlpha(cutoff, timeStep) * (values[axis] - state.value[axis]);
+          values[axis] = state.value[axis];
+        }
+        break;
+      }
+    }
+  }
+
+  bool empty = true;
+  for (int axis = 0; axis < 6; ++axis) {
+    axes[axis] = static_cast<int>(std::lround(values[axis]));
+    empty = empty && axes[axis] == 0;
+  }
+  return !empty;
+}
+
+}  // namespace spacemouse
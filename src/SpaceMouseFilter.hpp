@@ -0,0 +1,85 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSEFILTER_HPP
+#define SPACEMOUSEFILTER_HPP
+
+#include <cstdint>
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Filters shaping the raw motion samples                                   */
+/*--------------------------------------------------------------------------*/
+enum SpaceMouseFilterType {
+  /**
+   * Sets an axis to 0 until its magnitude reaches parameters[0] (threshold), and again once it
+   * falls below threshold - parameters[1] (hysteresis). Values in between keep the previous state,
+   * so that an axis resting close to the threshold does not flicker.
+   */
+  SPMF_DEADZONE = 0,
+  /** Exponential moving average with the smoothing factor parameters[0] in (0, 1] */
+  SPMF_EMA = 1,
+  /**
+   * One-Euro filter (Casiez et al., CHI 2012): a low pass whose cutoff frequency grows with the
+   * speed of the axis, i.e. smooth at rest and responsive when moving fast. The parameters are
+   * the minimum cutoff in Hz, beta (the cutoff added per unit/s of speed), and the cutoff of the
+   * speed estimate in Hz.
+   */
+  SPMF_ONE_EURO = 2
+};
+
+/** @brief Type and parameters of one stage of a SpaceMouseFilterChain */
+struct SpaceMouseFilterStage {
+  SpaceMouseFilterType type;
+  double parameters[3];
+};
+
+/**
+ * @brief Chain of filters that every motion sample passes axis by axis before it is queued.
+ *
+ * The stages run in the order they were configured on the thread reading the device, i.e. at the
+ * rate of the device. A sample whose filtered axes all round to 0 is reported as empty, so that
+ * noise at rest does not cause any callbacks (and redraws) at all. An empty chain passes the
+ * samples on unchanged.
+ */
+class SpaceMouseFilterChain {
+ public:
+  static const int kMaxStages = 8;
+
+  SpaceMouseFilterChain();
+
+  /**
+   * @brief Replaces the stages and resets the filter state
+   * @return false if there are too many stages or a parameter is out of range, then the chain is
+   *         left unchanged
+   */
+  bool configure(const SpaceMouseFilterStage *stages, int count);
+  bool isEmpty() const { return mCount == 0; }
+  /** @brief Forgets the history of all stages, e.g. after the device was reconnected */
+  void reset();
+
+  /**
+   * @brief Filters one motion sample in place
+   * @param axes      Raw tx, ty, tz, rx, ry, rz, replaced by the filtered (rounded) values
+   * @param timestamp Time of the sample in nanoseconds, see monotonicTime()
+   * @return false if all filtered axes are 0 and the sample should be dropped
+   */
+  bool apply(int axes[6], int64_t timestamp);
+
+ private:
+  struct State {
+    double value[6];      /**< Previous output (EMA, One-Euro) */
+    double derivative[6]; /**< Smoothed speed (One-Euro) */
+    bool active[6];       /**< Whether the axis left the deadzone */
+  };
+
+  SpaceMouseFilterStage mStages[kMaxStages];
+  State mState[kMaxStages];
+  int mCount;
+  int64_t mLastTimestamp;
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSEFILTER_HPP
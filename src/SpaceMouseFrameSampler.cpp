@@ -0,0 +1,104 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#include "SpaceMouseFrameSampler.hpp"
+
+#include <algorithm>
+
+namespace spacemouse {
+
+const int64_t SpaceMouseFrameSampler::kHoldTime;
+
+SpaceMouseFrameSampler::SpaceMouseFrameSampler()
+    : mTimestamp(0), mSequence(0), mPublishedTimestamp(0), mIdle(true), mSampledValid(true) {
+  for (int axis = 0; axis < 6; ++axis) {
+    mIntegral[axis] = 0;
+    mAxes[axis] = 0;
+    mPublishedIntegral[axis].store(0, std::memory_order_relaxed);
+    mPublishedAxes[axis].store(0, std::memory_order_relaxed);
+    mSampled[axis] = 0;
+  }
+}
+
+bool SpaceMouseFrameSampler::add(const int axes[6], int64_t timestamp) {
+  // the previous deflection was held until now
+  const int64_t held =
+      mTimestamp == 0 ? 0 : std::min(std::max<int64_t>(timestamp - mTimestamp, 0), kHoldTime);
+  const double seconds = held * 1e-9;
+  bool moving = false;
+  for (int axis = 0; axis < 6; ++axis) {
+    mIntegral[axis] += mAxes[axis] * seconds;
+    mAxes[axis] = axes[axis];
+    moving = moving || axes[axis] != 0;
+  }
+  mTimestamp = timestamp;
+
+  const uint32_t sequence = mSequence.load(std::memory_order_relaxed);
+  mSequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (int axis = 0; axis < 6; ++axis) {
+    mPublishedIntegral[axis].store(mIntegral[axis], std::memory_order_relaxed);
+    mPublishedAxes[axis].store(mAxes[axis], std::memory_order_relaxed);
+  }
+  mPublishedTimestamp.store(mTimestamp, std::memory_order_relaxed);
+  mSequence.store(sequence + 2, std::memory_order_release);
+
+  return moving && mIdle.exchange(false);
+}
+
+uint32_t SpaceMouseFrameSampler::load(Snapshot &snapshot) const {
+  uint32_t sequence;
+  do {
+    sequence = mSequence.load(std::memory_order_acquire);
+    for (int axis = 0; axis < 6; ++axis) {
+      snapshot.integral[axis] = mPublishedIntegral[axis].load(std::memory_order_relaxed);
+      snapshot.axes[axis] = mPublishedAxes[axis].load(std::memory_order_relaxed);
+    }
+    snapshot.timestamp = mPublishedTimestamp.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) != 0 || mSequence.load(std::memory_order_relaxed) != sequence);
+  return sequence;
+}
+
+void SpaceMouseFrameSampler::extrapolate(const Snapshot &snapshot, int64_t time,
+                                         double integral[6]) {
+  const double seconds =
+      std::min(std::max<int64_t>(time - snapshot.timestamp, 0), kHoldTime) * 1e-9;
+  for (int axis = 0; axis < 6; ++axis)
+    integral[axis] = snapshot.integral[axis] + snapshot.axes[axis] * seconds;
+}
+
+bool SpaceMouseFrameSampler::sample(int64_t frameTime, double delta[6]) {
+  Snapshot snapshot;
+  const uint32_t sequence = load(snapshot);
+  if (!mSampledValid) {
+    extrapolate(snapshot, snapshot.timestamp, mSampled);
+    mSampledValid = true;
+  }
+
+  double integral[6];
+  extrapolate(snapshot, frameTime, integral);
+  bool moved = false;
+  bool deflected = false;
+  for (int axis = 0; axis < 6; ++axis) {
+    delta[axis] = integral[axis] - mSampled[axis];
+    mSampled[axis] = integral[axis];
+    moved = moved || delta[axis] != 0;
+    deflected = deflected || snapshot.axes[axis] != 0;
+  }
+  if (moved || (deflected && frameTime - snapshot.timestamp < kHoldTime))
+    return true;
+
+  // at rest: ask add() to wake us up. A sample added before it could see the flag would not do
+  // so, hence keep sampling if one arrived meanwhile.
+  mIdle.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (load(snapshot) == sequence)
+    return false;
+  mIdle.store(false);
+  return true;
+}
+
+void SpaceMouseFrameSampler::reset() { mSampledValid = false; }
+
+}  // namespace spacemouse
@@ -0,0 +1,89 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSEFRAMESAMPLER_HPP
+#define SPACEMOUSEFRAMESAMPLER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Motion integrated over time and sampled once per rendered frame          */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Integrates the motion samples of the device over time, so that the consumer can fetch
+ * exactly one motion delta per rendered frame instead of one per packet.
+ *
+ * The axes of a motion sample are deflections of the cap, i.e. velocities. A deflection is held
+ * until the next sample arrives, but at most kHoldTime, after which the device is assumed to be at
+ * rest (a device that stopped reporting, or whose zero sample was lost). sample() extrapolates the
+ * integral from the newest sample to the given presentation time of the frame with the current
+ * deflection. Any error of that guess is corrected by the next sample(), as it only returns the
+ * difference to what was handed out before.
+ *
+ * add() is called by the thread reading the device and sample() by the consumer. The state is
+ * published with a sequence lock, so the reader never waits for the consumer; the consumer retries
+ * in the rare case that it read while add() was writing.
+ */
+class SpaceMouseFrameSampler {
+ public:
+  /** Time in nanoseconds the last deflection is assumed to be held without new samples */
+  static const int64_t kHoldTime = 50000000;
+
+  SpaceMouseFrameSampler();
+
+  /**
+   * @brief Integrates a (filtered) motion sample, zero samples included (device thread only)
+   * @param axes      Raw tx, ty, tz, rx, ry, rz
+   * @param timestamp Time of the sample in nanoseconds, see monotonicTime()
+   * @return true if the consumer went idle waiting for motion and should be woken up
+   */
+  bool add(const int axes[6], int64_t timestamp);
+
+  /**
+   * @brief Fetches the motion since the previous call, extrapolated to frameTime (consumer only)
+   * @param frameTime Time the frame is presented in nanoseconds, see monotonicTime()
+   * @param delta     Receives the integrated tx, ty, tz, rx, ry, rz in raw units times seconds
+   * @return false if the device is at rest, then the consumer should stop sampling until add()
+   *         asks to wake it up
+   */
+  bool sample(int64_t frameTime, double delta[6]);
+
+  /** @brief Forgets the integrated motion, e.g. when switching sampling on (consumer only) */
+  void reset();
+
+ private:
+  struct Snapshot {
+    double integral[6];
+    int axes[6];
+    int64_t timestamp;
+  };
+  /** @brief Reads a consistent copy of the published state, returns its sequence number */
+  uint32_t load(Snapshot &snapshot) const;
+  /** @brief Integral of snapshot extrapolated to time */
+  static void extrapolate(const Snapshot &snapshot, int64_t time, double integral[6]);
+
+  // device thread: state up to the newest sample
+  double mIntegral[6];
+  int mAxes[6];
+  int64_t mTimestamp;
+
+  // published copy, written between two increments of mSequence (odd while writing)
+  std::atomic<uint32_t> mSequence;
+  std::atomic<double> mPublishedIntegral[6];
+  std::atomic<int> mPublishedAxes[6];
+  std::atomic<int64_t> mPublishedTimestamp;
+
+  /** Set by the consumer when it stops sampling, cleared by the sample that wakes it */
+  std::atomic<bool> mIdle;
+
+  // consumer: extrapolated integral handed out by sample() so far
+  double mSampled[6];
+  bool mSampledValid;
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSEFRAMESAMPLER_HPP
@@ -0,0 +1,133 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSELOG_HPP
+#define SPACEMOUSELOG_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "SpaceMouseRcu.hpp"
+#include "SpaceMouseRing.hpp"
+
+/**
+ * Messages below this level are not compiled at all, including the evaluation of their arguments.
+ * Defaults to SPML_INFO (1) in release builds (NDEBUG) and to SPML_DEBUG (0) otherwise.
+ */
+#ifndef SPACEMOUSE_LOG_LEVEL
+#ifdef NDEBUG
+#define SPACEMOUSE_LOG_LEVEL 1
+#else
+#define SPACEMOUSE_LOG_LEVEL 0
+#endif  // NDEBUG
+#endif  // SPACEMOUSE_LOG_LEVEL
+
+/**
+ * Logs a printf style message with the given level through spacemouse::logRing, if the level
+ * passes the compile time (SPACEMOUSE_LOG_LEVEL) and the runtime filter (setLevel()).
+ */
+#define SPACEMOUSE_LOG(level, ...)                                                \
+  do {                                                                            \
+    if ((level) >= SPACEMOUSE_LOG_LEVEL && ::spacemouse::logRing.enabled(level)) \
+      ::spacemouse::logRing.log(level, __VA_ARGS__);                              \
+  } while (false)
+
+#ifdef __GNUC__
+#define SPACEMOUSE_PRINTF_FORMAT(formatIndex, firstArgument) \
+  __attribute__((format(printf, formatIndex, firstArgument)))
+#else
+#define SPACEMOUSE_PRINTF_FORMAT(formatIndex, firstArgument)
+#endif  // __GNUC__
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Asynchronous logging                                                     */
+/*--------------------------------------------------------------------------*/
+enum SpaceMouseLogLevel {
+  SPML_DEBUG = 0,   /**< Details for tracking down problems */
+  SPML_INFO = 1,    /**< What the library does, e.g. which device it reads */
+  SPML_WARNING = 2, /**< Something did not work, but the library carries on */
+  SPML_ERROR = 3    /**< Something did not work and the device cannot be used */
+};
+
+/** @brief A formatted log message */
+struct SpaceMouseLogRecord {
+  /** Longest message including the terminating 0, longer ones are truncated */
+  static const std::size_t kTextSize = 236;
+
+  int64_t timestamp; /**< When it was logged, see monotonicTime() */
+  int32_t level;     /**< SpaceMouseLogLevel */
+  char text[kTextSize];
+};
+
+/**
+ * @brief Bounded lock-free queue of log messages from any thread, handed to logFun in batches by
+ * flush() on the thread that owns the logger (the python main thread).
+ *
+ * Logging thus never waits for the logger (or the GIL), so that it is cheap enough for the
+ * threads reading the device. A message is formatted right into a fixed-size slot of the ring, it
+ * is dropped if all slots are taken (counted and reported by the next flush()). Producers claim
+ * their slot with a compare-and-swap on the tail, each slot carries a sequence number telling
+ * whether it is free, being written or ready (the bounded queue by D. Vyukov).
+ */
+class SpaceMouseLogRing {
+ public:
+  /** Number of messages that can wait for flush(), a power of two */
+  static const std::size_t kCapacity = 256;
+
+  SpaceMouseLogRing();
+
+  /** Whether messages of this level pass the runtime filter */
+  bool enabled(int level) const { return level >= mLevel.load(std::memory_order_relaxed); }
+  /** @brief Drops messages below level from now on (the compile time filter still applies) */
+  void setLevel(SpaceMouseLogLevel level) { mLevel.store(level, std::memory_order_relaxed); }
+  SpaceMouseLogLevel level() const {
+    return static_cast<SpaceMouseLogLevel>(mLevel.load(std::memory_order_relaxed));
+  }
+
+  /** @brief Queues a printf style message, never blocks (any thread) */
+  void log(int level, const char *format, ...) SPACEMOUSE_PRINTF_FORMAT(3, 4);
+
+  /**
+   * @brief Passes the queued messages to logFun in the order they were queued, on the calling
+   * thread. Returns right away if another flush() is running (on another thread or from inside
+   * the logger), which then passes them on.
+   * @return Number of messages passed on
+   */
+  std::size_t flush();
+  /** Number of messages dropped because the ring was full */
+  uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+ private:
+  struct alignas(kCacheLineSize) Slot {
+    /** Position the slot is free for, position + 1 once its record is ready */
+    std::atomic<std::size_t> sequence;
+    SpaceMouseLogRecord record;
+  };
+
+  Slot mSlots[kCapacity];
+  /** Next position to write, claimed by the producers */
+  alignas(kCacheLineSize) std::atomic<std::size_t> mTail;
+  std::atomic<uint64_t> mDropped;
+  std::atomic<int> mLevel;
+  /** Next position to flush, only touched while holding mFlushMutex */
+  alignas(kCacheLineSize) std::size_t mHead;
+  uint64_t mReportedDropped;
+  std::mutex mFlushMutex;
+
+  SpaceMouseLogRing(const SpaceMouseLogRing &);             // not implemented
+  SpaceMouseLogRing &operator=(const SpaceMouseLogRing &);  // not implemented
+};
+
+/** The messages of the library, see SPACEMOUSE_LOG */
+extern SpaceMouseLogRing logRing;
+
+/** Logger that SpaceMouseLogRing::flush() passes the messages to, may be replaced at any time */
+extern SpaceMouseCallback<const SpaceMouseLogRecord &> logFun;
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSELOG_HPP
@@ -0,0 +1,198 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSERCU_HPP
+#define SPACEMOUSERCU_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "SpaceMouseRing.hpp"
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Read-copy-update of objects shared with the event threads                */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Epoch based read-copy-update: objects published through a SpaceMouseRcuPointer are read
+ * without locks, while a writer may replace them at any time. The replaced object is deleted once
+ * no reader can still be using it.
+ *
+ * Readers enter a read section (ReadGuard) by incrementing the reader count of the current epoch
+ * and leave it by decrementing the same count. Only the counts of two consecutive epochs are
+ * kept, indexed by the parity of the epoch: the epoch is only advanced once all readers of the
+ * previous one left, so that every reader belongs to the current or the previous epoch. An object
+ * replaced during epoch e is invisible to readers entering from epoch e + 1 on, hence it is freed
+ * as soon as the epoch reached e + 2.
+ *
+ * Writers never wait for readers. retire() advances the epoch as far as the readers allow and
+ * frees what became safe to free, the rest waits for a later retire() or reclaim(). Read sections
+ * may nest and may be entered by any number of threads.
+ */
+class SpaceMouseRcu {
+ public:
+  /** @brief Read section, the objects loaded inside stay valid until it ends */
+  class ReadGuard {
+   public:
+    explicit ReadGuard(SpaceMouseRcu &rcu) : mRcu(rcu), mEpoch(rcu.enter()) {}
+    ~ReadGuard() { mRcu.leave(mEpoch); }
+
+   private:
+    SpaceMouseRcu &mRcu;
+    uint64_t mEpoch;
+
+    ReadGuard(const ReadGuard &);             // not implemented
+    ReadGuard &operator=(const ReadGuard &);  // not implemented
+  };
+
+  SpaceMouseRcu() : mEpoch(2), mRetiredCount(0) {
+    mReaders[0].store(0, std::memory_order_relaxed);
+    mReaders[1].store(0, std::memory_order_relaxed);
+  }
+  /** Frees everything that is left, there must not be any readers anymore */
+  ~SpaceMouseRcu() {
+    for (const Retired &retired : mRetired) retired.destroy(retired.object);
+  }
+
+  /** @brief Enters a read section, returns the epoch to pass to leave() */
+  uint64_t enter() {
+    for (;;) {
+      const uint64_t epoch = mEpoch.load(std::memory_order_seq_cst);
+      mReaders[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+      // the epoch advanced meanwhile, then its count may already have been checked
+      if (mEpoch.load(std::memory_order_seq_cst) == epoch)
+        return epoch;
+      mReaders[epoch & 1].fetch_sub(1, std::memory_order_release);
+    }
+  }
+  void leave(uint64_t epoch) { mReaders[epoch & 1].fetch_sub(1, std::memory_order_release); }
+
+  /** @brief Deletes an object that readers can no longer load, as soon as none uses it anymore */
+  template <typename T>
+  void retire(T *object) {
+    std::lock_guard<std::mutex> lock(mWriteMutex);
+    mRetired.push_back({object, &destroy<T>, mEpoch.load(std::memory_order_relaxed)});
+    mRetiredCount.store(mRetired.size(), std::memory_order_relaxed);
+    Collect();
+  }
+  /** @brief Frees the retired objects no reader uses anymore, unless another thread does so */
+  void reclaim() {
+    std::unique_lock<std::mutex> lock(mWriteMutex, std::try_to_lock);
+    if (lock.owns_lock())
+      Collect();
+  }
+  /** Whether there are retired objects waiting to be freed */
+  bool hasRetired() const { return mRetiredCount.load(std::memory_order_relaxed) != 0; }
+
+ private:
+  struct Retired {
+    void *object;
+    void (*destroy)(void *);
+    uint64_t epoch;
+  };
+  template <typename T>
+  static void destroy(void *object) {
+    delete static_cast<T *>(object);
+  }
+
+  /** @brief Advances the epoch as far as possible and frees what became safe (writer lock held) */
+  void Collect() {
+    // two steps at most are needed to free everything retired so far
+    for (int step = 0; step < 2; ++step) {
+      const uint64_t epoch = mEpoch.load(std::memory_order_relaxed);
+      // the readers of the previous epoch share the count of the next one
+      if (mReaders[(epoch + 1) & 1].load(std::memory_order_seq_cst) != 0)
+        break;
+      mEpoch.store(epoch + 1, std::memory_order_seq_cst);
+    }
+    const uint64_t epoch = mEpoch.load(std::memory_order_relaxed);
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < mRetired.size(); ++i) {
+      if (mRetired[i].epoch + 2 <= epoch)
+        mRetired[i].destroy(mRetired[i].object);
+      else
+        mRetired[kept++] = mRetired[i];
+    }
+    mRetired.resize(kept);
+    mRetiredCount.store(kept, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> mEpoch;
+  /** Readers in even and odd epochs, written by every reader, hence on their own cache line */
+  alignas(kCacheLineSize) std::atomic<long> mReaders[2];
+  alignas(kCacheLineSize) std::mutex mWriteMutex;
+  std::vector<Retired> mRetired;
+  std::atomic<std::size_t> mRetiredCount;
+
+  SpaceMouseRcu(const SpaceMouseRcu &);             // not implemented
+  SpaceMouseRcu &operator=(const SpaceMouseRcu &);  // not implemented
+};
+
+/**
+ * @brief Owning pointer that is published to readers through a SpaceMouseRcu
+ */
+template <typename T>
+class SpaceMouseRcuPointer {
+ public:
+  SpaceMouseRcuPointer(SpaceMouseRcu &rcu, T *object) : mRcu(rcu), mObject(object) {}
+  /** Deletes the current object right away, there must not be any readers anymore */
+  ~SpaceMouseRcuPointer() { delete mObject.load(std::memory_order_relaxed); }
+
+  /** @brief The current object, only valid until the enclosing ReadGuard ends */
+  T *load() const { return mObject.load(std::memory_order_acquire); }
+  /** @brief Publishes object, the previous one is deleted once no reader uses it anymore */
+  void store(T *object) {
+    T *previous = mObject.exchange(object, std::memory_order_seq_cst);
+    if (previous != nullptr)
+      mRcu.retire(previous);
+  }
+
+ private:
+  SpaceMouseRcu &mRcu;
+  std::atomic<T *> mObject;
+
+  SpaceMouseRcuPointer(const SpaceMouseRcuPointer &);             // not implemented
+  SpaceMouseRcuPointer &operator=(const SpaceMouseRcuPointer &);  // not implemented
+};
+
+/** Domain of the callbacks and the logger, see SpaceMouseCallback */
+extern SpaceMouseRcu callbackRcu;
+
+/**
+ * @brief Callback that may be replaced at any time, also while other threads call it. A call
+ * finishes with the function it started with, which is deleted afterwards if it was replaced.
+ */
+template <typename Arg>
+class SpaceMouseCallback {
+ public:
+  typedef std::function<void(Arg)> Function;
+
+  explicit SpaceMouseCallback(const Function &function = Function())
+      : mFunction(callbackRcu, new Function(function)) {}
+
+  /** @brief Replaces the function, an empty one turns calls into no-ops */
+  void set(const Function &function) { mFunction.store(new Function(function)); }
+  SpaceMouseCallback &operator=(const Function &function) {
+    set(function);
+    return *this;
+  }
+
+  void operator()(Arg arg) const {
+    SpaceMouseRcu::ReadGuard guard(callbackRcu);
+    const Function &function = *mFunction.load();
+    if (function)
+      function(arg);
+  }
+
+ private:
+  SpaceMouseRcuPointer<Function> mFunction;
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSERCU_HPP
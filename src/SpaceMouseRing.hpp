@@ -0,0 +1,110 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSERING_HPP
+#define SPACEMOUSERING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+namespace spacemouse {
+
+/** Size of a cache line, used to keep producer and consumer data apart */
+static const std::size_t kCacheLineSize = 64;
+
+/*--------------------------------------------------------------------------*/
+/* Lock-free single-producer/single-consumer ring buffer                    */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Bounded lock-free ring buffer for exactly one producer and one consumer thread.
+ *
+ * The ring has a fixed capacity and never allocates. The indices owned by the producer and the
+ * consumer live on separate cache lines, and each side keeps a cached copy of the other side's
+ * index so that it only touches the shared one when the ring looks full (or empty).
+ *
+ * @tparam T        Element type, has to be copy assignable
+ * @tparam Capacity Number of slots, has to be a power of two
+ */
+template <typename T, std::size_t Capacity>
+class SpaceMouseRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity of SpaceMouseRing has to be a power of two");
+
+ public:
+  SpaceMouseRing() : mHead(0), mCachedTail(0), mTail(0), mCachedHead(0) {}
+
+  /**
+   * @brief Appends an element (producer only)
+   * @return false if the ring is full, in which case nothing was written
+   */
+  bool tryPush(const T &element) {
+    const std::size_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mCachedHead == Capacity) {
+      mCachedHead = mHead.load(std::memory_order_acquire);
+      if (tail - mCachedHead == Capacity)
+        return false;
+    }
+    mSlots[tail & (Capacity - 1)] = element;
+    mTail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Removes the oldest element (consumer only)
+   * @return false if the ring is empty, in which case element is left untouched
+   */
+  bool tryPop(T &element) {
+    const std::size_t head = mHead.load(std::memory_order_relaxed);
+    if (head == mCachedTail) {
+      mCachedTail = mTail.load(std::memory_order_acquire);
+      if (head == mCachedTail)
+        return false;
+    }
+    element = mSlots[head & (Capacity - 1)];
+    mHead.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Removes up to maxCount of the oldest elements at once (consumer only). The elements
+   * are copied in at most two contiguous runs, i.e. two memcpy for trivially copyable types.
+   * @return The number of elements written to elements
+   */
+  std::size_t tryPopMany(T *elements, std::size_t maxCount) {
+    const std::size_t head = mHead.load(std::memory_order_relaxed);
+    if (mCachedTail - head < maxCount)
+      mCachedTail = mTail.load(std::memory_order_acquire);
+    const std::size_t count = std::min(mCachedTail - head, maxCount);
+    const std::size_t start = head & (Capacity - 1);
+    const std::size_t first = std::min(count, Capacity - start);
+    std::copy(mSlots + start, mSlots + start + first, elements);
+    std::copy(mSlots, mSlots + (count - first), elements + first);
+    mHead.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  /** @brief Checks whether there is nothing to pop (exact only on the consumer side) */
+  bool isEmpty() const {
+    return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+  }
+
+  static std::size_t capacity() { return Capacity; }
+
+ private:
+  // consumer side
+  alignas(kCacheLineSize) std::atomic<std::size_t> mHead;
+  std::size_t mCachedTail;
+  // producer side
+  alignas(kCacheLineSize) std::atomic<std::size_t> mTail;
+  std::size_t mCachedHead;
+
+  alignas(kCacheLineSize) T mSlots[Capacity];
+
+  SpaceMouseRing(const SpaceMouseRing &);             // not implemented
+  SpaceMouseRing &operator=(const SpaceMouseRing &);  // not implemented
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSERING_HPP
@@ -0,0 +1,192 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#include "SpaceMouseSharedState.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace spacemouse {
+
+const int SpaceMouseSharedStateReader::kMaxAttempts;
+
+namespace {
+const char kSharedStateMagic[8] = {'S', 'M', 'S', 'T', 'A', 'T', 'E', '\0'};
+}  // namespace
+
+/*--------------------------------------------------------------------------*/
+/* SpaceMouseSharedStatePublisher                                           */
+/*--------------------------------------------------------------------------*/
+SpaceMouseSharedStatePublisher::SpaceMouseSharedStatePublisher() : mState(nullptr), mFd(-1) {
+  std::memset(mLatest, 0, sizeof(mLatest));
+}
+
+SpaceMouseSharedStatePublisher::~SpaceMouseSharedStatePublisher() { close(); }
+
+bool SpaceMouseSharedStatePublisher::open(const char *name) {
+  close();
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return false;
+  // a second publisher would break the seqlocks, the lock goes away with the process
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1 || ftruncate(fd, sizeof(SpaceMouseSharedState)) == -1) {
+    ::close(fd);
+    return false;
+  }
+  void *data =
+      mmap(nullptr, sizeof(SpaceMouseSharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+  mState = static_cast<SpaceMouseSharedState *>(data);
+  mFd = fd;
+  mName = name;
+
+  SpaceMouseSharedStateHeader &header = mState->header;
+  std::memcpy(header.magic, kSharedStateMagic, sizeof(kSharedStateMagic));
+  header.version = kSharedStateVersion;
+  header.deviceCount = kSharedStateDevices;
+  header.stateSize = sizeof(SpaceMouseSharedDeviceState);
+  // a previous publisher may have died while writing, its readers keep their mapping and would
+  // take a sequence starting over for no change
+  for (int device = 0; device < kSharedStateDevices; ++device) {
+    std::atomic<uint64_t> &sequence = mState->devices[device].sequence;
+    const uint64_t previous = sequence.load(std::memory_order_relaxed);
+    sequence.store(previous + (previous & 1), std::memory_order_relaxed);
+    publishReset(device, 0);
+  }
+  return true;
+}
+
+void SpaceMouseSharedStatePublisher::close() {
+  if (mState == nullptr)
+    return;
+  // readers must not keep moving with the last deflection
+  for (int device = 0; device < kSharedStateDevices; ++device)
+    publishReset(device, mLatest[device].timestamp);
+  munmap(mState, sizeof(SpaceMouseSharedState));
+  ::close(mFd);
+  mState = nullptr;
+  mFd = -1;
+  mName.clear();
+  std::memset(mLatest, 0, sizeof(mLatest));
+}
+
+void SpaceMouseSharedStatePublisher::publishMotion(int device, int64_t timestamp,
+                                                   const int axes[6]) {
+  SpaceMouseSharedStateSample &latest = mLatest[device];
+  latest.timestamp = timestamp;
+  for (int i = 0; i < 6; ++i) latest.axes[i] = axes[i];
+  Publish(device);
+}
+
+void SpaceMouseSharedStatePublisher::publishButton(int device, int64_t timestamp, int button,
+                                                   bool pressed, int modifiers) {
+  SpaceMouseSharedStateSample &latest = mLatest[device];
+  const uint32_t bit = uint32_t(1) << button;
+  latest.timestamp = timestamp;
+  latest.buttons = pressed ? (latest.buttons | bit) : (latest.buttons & ~bit);
+  latest.modifiers = modifiers;
+  Publish(device);
+}
+
+void SpaceMouseSharedStatePublisher::publishReset(int device, int64_t timestamp) {
+  SpaceMouseSharedStateSample &latest = mLatest[device];
+  latest.timestamp = timestamp;
+  std::memset(latest.axes, 0, sizeof(latest.axes));
+  latest.buttons = 0;
+  latest.modifiers = 0;
+  Publish(device);
+}
+
+void SpaceMouseSharedStatePublisher::Publish(int device) {
+  SpaceMouseSharedDeviceState &state = mState->devices[device];
+  SpaceMouseSharedStateSample &latest = mLatest[device];
+  const uint64_t sequence = state.sequence.load(std::memory_order_relaxed);
+  // the odd sequence has to be visible before any of the fields changes
+  state.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  state.timestamp.store(latest.timestamp, std::memory_order_relaxed);
+  for (int i = 0; i < 6; ++i) state.axes[i].store(latest.axes[i], std::memory_order_relaxed);
+  state.buttons.store(latest.buttons, std::memory_order_relaxed);
+  state.modifiers.store(latest.modifiers, std::memory_order_relaxed);
+  state.sequence.store(sequence + 2, std::memory_order_release);
+  latest.sequence = (sequence + 2) / 2;
+}
+
+/*--------------------------------------------------------------------------*/
+/* SpaceMouseSharedStateReader                                              */
+/*--------------------------------------------------------------------------*/
+SpaceMouseSharedStateReader::SpaceMouseSharedStateReader() : mState(nullptr) {}
+
+SpaceMouseSharedStateReader::~SpaceMouseSharedStateReader() { close(); }
+
+bool SpaceMouseSharedStateReader::open(const char *name) {
+  close();
+  int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) == -1 ||
+      static_cast<std::size_t>(info.st_size) < sizeof(SpaceMouseSharedState)) {
+    ::close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, sizeof(SpaceMouseSharedState), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);  // the mapping stays valid
+  if (data == MAP_FAILED)
+    return false;
+  mState = static_cast<const SpaceMouseSharedState *>(data);
+
+  const SpaceMouseSharedStateHeader &header = mState->header;
+  if (std::memcmp(header.magic, kSharedStateMagic, sizeof(kSharedStateMagic)) != 0 ||
+      header.version != kSharedStateVersion ||
+      header.deviceCount != static_cast<uint32_t>(kSharedStateDevices) ||
+      header.stateSize != sizeof(SpaceMouseSharedDeviceState)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void SpaceMouseSharedStateReader::close() {
+  if (mState != nullptr)
+    munmap(const_cast<SpaceMouseSharedState *>(mState), sizeof(SpaceMouseSharedState));
+  mState = nullptr;
+}
+
+uint64_t SpaceMouseSharedStateReader::sequence(int device) const {
+  if (mState == nullptr || device < 0 || device >= kSharedStateDevices)
+    return 0;
+  return mState->devices[device].sequence.load(std::memory_order_acquire) / 2;
+}
+
+bool SpaceMouseSharedStateReader::read(int device, SpaceMouseSharedStateSample &sample) const {
+  if (mState == nullptr || device < 0 || device >= kSharedStateDevices)
+    return false;
+  const SpaceMouseSharedDeviceState &state = mState->devices[device];
+  for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+    const uint64_t begin = state.sequence.load(std::memory_order_acquire);
+    if ((begin & 1) != 0)
+      continue;  // being written, which takes a few nanoseconds
+    sample.timestamp = state.timestamp.load(std::memory_order_relaxed);
+    for (int i = 0; i < 6; ++i) sample.axes[i] = state.axes[i].load(std::memory_order_relaxed);
+    sample.buttons = state.buttons.load(std::memory_order_relaxed);
+    sample.modifiers = state.modifiers.load(std::memory_order_relaxed);
+    // the copy has to be complete before the sequence is checked again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (state.sequence.load(std::memory_order_relaxed) == begin) {
+      sample.sequence = begin / 2;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace spacemouse
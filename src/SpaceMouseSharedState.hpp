@@ -0,0 +1,157 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSESHAREDSTATE_HPP
+#define SPACEMOUSESHAREDSTATE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "SpaceMouseRing.hpp"
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Device state shared with other processes                                 */
+/*--------------------------------------------------------------------------*/
+/*
+ * The publisher (the reader thread of the plugin) keeps the latest state of every device in a
+ * POSIX shared memory segment: a SpaceMouseSharedStateHeader followed by one
+ * SpaceMouseSharedDeviceState per device, in native byte order. Each device state is guarded by
+ * a seqlock, i.e. its sequence is odd while the publisher writes it. Readers copy the state and
+ * retry if the sequence was odd or changed meanwhile, so that sampling the state takes neither
+ * locks nor syscalls and readers never hold up the publisher.
+ */
+
+// the atomics are shared between processes, which only works if they do not need a lock
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "the shared device state needs lock-free atomics");
+
+/** Number of device states in a segment, at least kMaxDevices */
+static const int kSharedStateDevices = 8;
+static const uint32_t kSharedStateVersion = 1;
+
+/** @brief Header at the start of the segment, written once by the publisher */
+struct alignas(kCacheLineSize) SpaceMouseSharedStateHeader {
+  char magic[8];        /**< "SMSTATE" followed by a zero byte */
+  uint32_t version;     /**< kSharedStateVersion */
+  uint32_t deviceCount; /**< kSharedStateDevices */
+  uint32_t stateSize;   /**< sizeof(SpaceMouseSharedDeviceState) */
+};
+
+/** @brief Latest state of a device, on its own cache line */
+struct alignas(kCacheLineSize) SpaceMouseSharedDeviceState {
+  /** Twice the number of updates, incremented before and after each update */
+  std::atomic<uint64_t> sequence;
+  /** Time of the last update, see monotonicTime() */
+  std::atomic<int64_t> timestamp;
+  /** Filtered deflection: translation x, y, z and rotation x, y, z */
+  std::atomic<int32_t> axes[6];
+  /** Buttons held down, bit i for SpaceMouseButton i */
+  std::atomic<uint32_t> buttons;
+  /** Modifier keys held down, see SpaceMouseModifierKey */
+  std::atomic<int32_t> modifiers;
+};
+static_assert(sizeof(SpaceMouseSharedDeviceState) == kCacheLineSize,
+              "shared device states have to fill one cache line");
+
+/** @brief The whole segment */
+struct SpaceMouseSharedState {
+  SpaceMouseSharedStateHeader header;
+  SpaceMouseSharedDeviceState devices[kSharedStateDevices];
+};
+
+/** @brief Consistent copy of a SpaceMouseSharedDeviceState */
+struct SpaceMouseSharedStateSample {
+  uint64_t sequence; /**< Number of updates so far, changes with every update */
+  int64_t timestamp; /**< Time of the last update, see monotonicTime() */
+  int axes[6];       /**< Filtered deflection: translation x, y, z and rotation x, y, z */
+  uint32_t buttons;  /**< Buttons held down, bit i for SpaceMouseButton i */
+  int modifiers;     /**< Modifier keys held down, see SpaceMouseModifierKey */
+};
+
+/**
+ * @brief Writes the state of the devices to a shared memory segment. Only one publisher may use
+ * a segment at a time, and all updates have to come from the same thread.
+ *
+ * The segment is kept when the publisher is closed (with all devices at rest), so that readers
+ * survive a restart of the publisher. It lives in /dev/shm and is gone after a reboot.
+ */
+class SpaceMouseSharedStatePublisher {
+ public:
+  SpaceMouseSharedStatePublisher();
+  ~SpaceMouseSharedStatePublisher();
+
+  /**
+   * @brief Creates the segment (or takes over an existing one) and publishes all devices at rest
+   * @param name Name of the segment as for shm_open(), e.g. "/spacemousetool"
+   * @return false if it could not be created or another publisher uses it
+   */
+  bool open(const char *name);
+  /** @brief Publishes all devices at rest and unmaps the segment */
+  void close();
+  bool isOpen() const { return mState != nullptr; }
+  /** Name of the open segment */
+  const std::string &name() const { return mName; }
+
+  /** @brief Publishes the filtered deflection of a device */
+  void publishMotion(int device, int64_t timestamp, const int axes[6]);
+  /** @brief Publishes the press or release of a button and the modifiers after it */
+  void publishButton(int device, int64_t timestamp, int button, bool pressed, int modifiers);
+  /** @brief Publishes a device at rest, e.g. after it was unplugged */
+  void publishReset(int device, int64_t timestamp);
+
+ private:
+  /** @brief Writes mLatest[device] to the segment */
+  void Publish(int device);
+
+  SpaceMouseSharedState *mState;
+  /** Keeps the lock telling other publishers that the segment is taken */
+  int mFd;
+  std::string mName;
+  /** What was published last, updated field by field and then published as a whole */
+  SpaceMouseSharedStateSample mLatest[kSharedStateDevices];
+
+  SpaceMouseSharedStatePublisher(const SpaceMouseSharedStatePublisher &);  // not implemented
+  SpaceMouseSharedStatePublisher &operator=(
+      const SpaceMouseSharedStatePublisher &);  // not implemented
+};
+
+/**
+ * @brief Samples the state of the devices from a segment of a SpaceMouseSharedStatePublisher.
+ * Any number of readers in any number of processes may share a segment.
+ */
+class SpaceMouseSharedStateReader {
+ public:
+  /** Attempts of read() before it gives up on a publisher that seems to have died while writing */
+  static const int kMaxAttempts = 1000;
+
+  SpaceMouseSharedStateReader();
+  ~SpaceMouseSharedStateReader();
+
+  /** @brief Maps the segment read-only, false if it does not exist or is no device state */
+  bool open(const char *name);
+  void close();
+  bool isOpen() const { return mState != nullptr; }
+
+  /** Number of updates of the device so far, cheap enough to poll for changes */
+  uint64_t sequence(int device) const;
+  /**
+   * @brief Copies the latest state of a device
+   * @return false if the segment is not open, there is no such device, or the publisher did not
+   *         finish writing within kMaxAttempts
+   */
+  bool read(int device, SpaceMouseSharedStateSample &sample) const;
+
+ private:
+  const SpaceMouseSharedState *mState;
+
+  SpaceMouseSharedStateReader(const SpaceMouseSharedStateReader &);             // not implemented
+  SpaceMouseSharedStateReader &operator=(const SpaceMouseSharedStateReader &);  // not implemented
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSESHAREDSTATE_HPP
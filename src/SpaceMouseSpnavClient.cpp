@@ -0,0 +1,93 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#include "SpaceMouseSpnavClient.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace spacemouse {
+
+namespace {
+const char *kDefaultSocketPath = "/var/run/spnav.sock";
+}  // namespace
+
+SpaceMouseSpnavClient::SpaceMouseSpnavClient() : mFd(-1), mPartialOffset(0), mPartialSize(0) {}
+
+SpaceMouseSpnavClient::~SpaceMouseSpnavClient() { close(); }
+
+bool SpaceMouseSpnavClient::open(const char *path) {
+  close();
+  if (path == nullptr)
+    path = std::getenv("SPNAV_SOCKET");
+  if (path == nullptr || path[0] == '\0')
+    path = kDefaultSocketPath;
+
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(address.sun_path))
+    return false;
+  std::strcpy(address.sun_path, path);
+
+  // connecting a unix socket does not wait for the daemon to accept, but it would wait while its
+  // backlog is full
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return false;
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1) {
+    ::close(fd);
+    return false;
+  }
+  mFd = fd;
+  mPartialOffset = mPartialSize = 0;
+  return true;
+}
+
+void SpaceMouseSpnavClient::close() {
+  if (mFd != -1) {
+    ::close(mFd);
+    mFd = -1;
+  }
+  mPartialOffset = mPartialSize = 0;
+}
+
+int SpaceMouseSpnavClient::receive(const SpaceMouseSpnavPacket *&packets, std::size_t maxPackets) {
+  packets = mBuffer;
+  if (mFd == -1)
+    return -1;
+  if (maxPackets > kMaxPackets)
+    maxPackets = kMaxPackets;
+  if (maxPackets == 0)
+    return 0;
+
+  // spacenavd writes whole packets, but a stream socket may still split them. Move the start of
+  // a split packet to the front and complete it with this recv().
+  char *bytes = reinterpret_cast<char *>(mBuffer);
+  if (mPartialSize > 0 && mPartialOffset > 0)
+    std::memmove(bytes, bytes + mPartialOffset, mPartialSize);
+  mPartialOffset = 0;
+
+  const std::size_t capacity = maxPackets * sizeof(SpaceMouseSpnavPacket);
+  ssize_t received;
+  do {
+    received = recv(mFd, bytes + mPartialSize, capacity - mPartialSize, MSG_DONTWAIT);
+  } while (received < 0 && errno == EINTR);
+  if (received < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  if (received == 0)
+    return -1;  // spacenavd closed the connection
+
+  const std::size_t size = mPartialSize + static_cast<std::size_t>(received);
+  const std::size_t count = size / sizeof(SpaceMouseSpnavPacket);
+  mPartialOffset = count * sizeof(SpaceMouseSpnavPacket);
+  mPartialSize = size - mPartialOffset;
+  return static_cast<int>(count);
+}
+
+}  // namespace spacemouse
@@ -0,0 +1,85 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSESPNAVCLIENT_HPP
+#define SPACEMOUSESPNAVCLIENT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* spacenavd socket protocol                                                */
+/*--------------------------------------------------------------------------*/
+/** Packet types sent by spacenavd */
+enum SpaceMouseSpnavPacketType {
+  SPNAV_PACKET_MOTION = 0,
+  SPNAV_PACKET_PRESS = 1,
+  SPNAV_PACKET_RELEASE = 2
+};
+
+/**
+ * @brief One event as sent by spacenavd over its AF_UNIX socket (protocol 0, the one every
+ * spacenavd version speaks to clients that do not negotiate): eight native int32 values.
+ */
+struct SpaceMouseSpnavPacket {
+  int32_t type; /**< One of SpaceMouseSpnavPacketType */
+  /**
+   * Motion: x, y, z, rx, ry, rz and the period in ms since the last motion.
+   * Button press/release: the button number followed by unused values.
+   */
+  int32_t data[7];
+};
+static_assert(sizeof(SpaceMouseSpnavPacket) == 32, "spacenavd packets are 32 bytes");
+
+/**
+ * @brief Minimal client for the spacenavd socket, replacing libspnav (and with it X11).
+ *
+ * receive() reads as many complete packets as are pending with a single recv() and hands them
+ * out in place, i.e. straight from the receive buffer.
+ */
+class SpaceMouseSpnavClient {
+ public:
+  /** Maximal number of packets returned by one call to receive() */
+  static const std::size_t kMaxPackets = 64;
+
+  SpaceMouseSpnavClient();
+  ~SpaceMouseSpnavClient();
+
+  /**
+   * @brief Connects to spacenavd without blocking
+   * @param path Socket path, defaults to $SPNAV_SOCKET or /var/run/spnav.sock
+   * @return false if the daemon is not reachable (or does not accept connections right now)
+   */
+  bool open(const char *path = nullptr);
+  void close();
+  bool isOpen() const { return mFd != -1; }
+  /** Socket to poll() for incoming packets, -1 if not connected */
+  int fd() const { return mFd; }
+
+  /**
+   * @brief Reads the pending packets without blocking
+   * @param packets    Set to the received packets, valid until the next call to receive()
+   * @param maxPackets Maximal number of packets to return (at most kMaxPackets)
+   * @return Number of packets in packets (0 if nothing is pending) or -1 if the connection was
+   *         closed or failed
+   */
+  int receive(const SpaceMouseSpnavPacket *&packets, std::size_t maxPackets);
+
+ private:
+  int mFd;
+  /** Packets received by the last recv(), followed by a partial packet if it was split */
+  SpaceMouseSpnavPacket mBuffer[kMaxPackets];
+  /** Start of the bytes of a partial packet in mBuffer */
+  std::size_t mPartialOffset;
+  /** Number of bytes of a partial packet */
+  std::size_t mPartialSize;
+
+  SpaceMouseSpnavClient(const SpaceMouseSpnavClient &);             // not implemented
+  SpaceMouseSpnavClient &operator=(const SpaceMouseSpnavClient &);  // not implemented
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSESPNAVCLIENT_HPP
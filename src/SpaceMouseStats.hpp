@@ -0,0 +1,139 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSESTATS_HPP
+#define SPACEMOUSESTATS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "SpaceMouseRing.hpp"
+
+/**
+ * Wraps statements that only collect statistics. Without WITH_SPACEMOUSE_STATS they are not
+ * compiled at all, including the clock reads they need.
+ */
+#ifdef WITH_SPACEMOUSE_STATS
+#define SPACEMOUSE_STATS(...) __VA_ARGS__
+#else
+#define SPACEMOUSE_STATS(...)
+#endif  // WITH_SPACEMOUSE_STATS
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Pipeline statistics                                                      */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Lock-free histogram of durations in nanoseconds with power of two buckets: bucket 0
+ * counts durations <= 0, bucket i > 0 those in [2^(i-1), 2^i), the last one everything above.
+ * Each histogram starts on its own cache line.
+ */
+class alignas(kCacheLineSize) SpaceMouseHistogram {
+ public:
+  static const int kBuckets = 40;  // 2^39 ns are about 9 minutes
+
+  SpaceMouseHistogram() { reset(); }
+
+  void record(int64_t nanoseconds) {
+    int bucket = 0;
+    for (uint64_t value = nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0;
+         value != 0 && bucket < kBuckets - 1; value >>= 1)
+      ++bucket;
+    mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    int64_t max = mMax.load(std::memory_order_relaxed);
+    while (nanoseconds > max &&
+           !mMax.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+    }
+  }
+
+  void reset() {
+    for (int i = 0; i < kBuckets; ++i) mBuckets[i].store(0, std::memory_order_relaxed);
+    mCount.store(0, std::memory_order_relaxed);
+    mSum.store(0, std::memory_order_relaxed);
+    mMax.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t bucket(int i) const { return mBuckets[i].load(std::memory_order_relaxed); }
+  /** Exclusive upper bound of bucket i in nanoseconds */
+  static int64_t bucketLimit(int i) { return int64_t(1) << i; }
+  uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+  int64_t sum() const { return mSum.load(std::memory_order_relaxed); }
+  int64_t max() const { return mMax.load(std::memory_order_relaxed); }
+  /** Upper bound of the bucket containing the given percentile (0 if empty) */
+  int64_t percentile(double percent) const;
+
+ private:
+  std::atomic<uint64_t> mBuckets[kBuckets];
+  std::atomic<uint64_t> mCount;
+  std::atomic<int64_t> mSum;
+  std::atomic<int64_t> mMax;
+};
+
+enum SpaceMouseCounter {
+  SPMC_RECEIVED = 0,   /**< Packets received from the driver */
+  SPMC_DISPATCHED = 1, /**< Events passed to a callback or drained */
+  SPMC_MERGED = 2,     /**< Motion events merged into another one */
+  SPMC_DROPPED = 3,    /**< Events dropped because the queue was full */
+  SPMC_FILTERED = 4,   /**< Motion samples dropped because the filter chain zeroed them */
+  SPMC_COUNT
+};
+
+enum SpaceMouseHistogramId {
+  SPMH_DECODE = 0,      /**< Time to decode the packets of one read */
+  SPMH_QUEUE_DELAY = 1, /**< Time from reading an event to dispatching (or draining) it */
+  SPMH_CALLBACK = 2,    /**< Time spent in a callback */
+  SPMH_GIL_WAIT = 3,    /**< Time a callback waited for the python GIL */
+  SPMH_COUNT
+};
+
+/**
+ * @brief Counters and histograms of the event pipeline. The reader and the consumer side are
+ * kept on separate cache lines, so that the threads do not slow each other down.
+ */
+class SpaceMouseStats {
+ public:
+  /** @brief Adds to a counter, call from the reader (producer) thread */
+  void countRead(SpaceMouseCounter counter, uint64_t n = 1) {
+    mReader.counters[counter].fetch_add(n, std::memory_order_relaxed);
+  }
+  /** @brief Adds to a counter, call from the consumer thread */
+  void countDispatch(SpaceMouseCounter counter, uint64_t n = 1) {
+    mDispatch.counters[counter].fetch_add(n, std::memory_order_relaxed);
+  }
+  void record(SpaceMouseHistogramId histogram, int64_t nanoseconds) {
+    mHistograms[histogram].record(nanoseconds);
+  }
+
+  uint64_t counter(SpaceMouseCounter counter) const {
+    return mReader.counters[counter].load(std::memory_order_relaxed) +
+           mDispatch.counters[counter].load(std::memory_order_relaxed);
+  }
+  const SpaceMouseHistogram &histogram(SpaceMouseHistogramId histogram) const {
+    return mHistograms[histogram];
+  }
+  /** @brief Clears all counters and histograms (not atomic as a whole) */
+  void reset();
+
+ private:
+  struct Counters {
+    Counters() {
+      for (int i = 0; i < SPMC_COUNT; ++i) counters[i].store(0, std::memory_order_relaxed);
+    }
+    std::atomic<uint64_t> counters[SPMC_COUNT];
+  };
+  alignas(kCacheLineSize) Counters mReader;
+  alignas(kCacheLineSize) Counters mDispatch;
+  // decode is written by the reader, the others by the consumer
+  SpaceMouseHistogram mHistograms[SPMH_COUNT];
+};
+
+/** Statistics of the event pipeline, only updated if built with WITH_SPACEMOUSE_STATS */
+extern SpaceMouseStats pipelineStats;
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSESTATS_HPP
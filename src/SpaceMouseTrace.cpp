@@ -0,0 +1,137 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#include "SpaceMouseTrace.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "SpaceMouse.hpp"
+
+namespace spacemouse {
+
+namespace {
+const char kTraceMagic[8] = {'S', 'M', 'T', 'R', 'A', 'C', 'E', '\0'};
+
+bool writeAll(int fd, const void *data, std::size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t written = ::write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes += written;
+    size -= static_cast<std::size_t>(written);
+  }
+  return true;
+}
+}  // namespace
+
+/*--------------------------------------------------------------------------*/
+/* Trace writer                                                             */
+/*--------------------------------------------------------------------------*/
+SpaceMouseTraceWriter::SpaceMouseTraceWriter() : mFd(-1), mBuffered(0) {}
+
+SpaceMouseTraceWriter::~SpaceMouseTraceWriter() { close(); }
+
+bool SpaceMouseTraceWriter::open(const char *path) {
+  close();
+  mFd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (mFd == -1)
+    return false;
+
+  SpaceMouseTraceHeader header;
+  std::memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  header.version = kTraceVersion;
+  header.recordSize = sizeof(SpaceMouseTraceRecord);
+  header.startTime = monotonicTime();
+  if (!writeAll(mFd, &header, sizeof(header))) {
+    ::close(mFd);
+    mFd = -1;
+    return false;
+  }
+  return true;
+}
+
+void SpaceMouseTraceWriter::close() {
+  if (mFd == -1)
+    return;
+  flush();
+  ::close(mFd);
+  mFd = -1;
+}
+
+void SpaceMouseTraceWriter::append(int64_t timestamp, const SpaceMouseSpnavPacket *packets,
+                                   std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    if (mBuffered == kBufferRecords)
+      flush();
+    mBuffer[mBuffered].timestamp = timestamp;
+    mBuffer[mBuffered].packet = packets[i];
+    ++mBuffered;
+  }
+}
+
+bool SpaceMouseTraceWriter::flush() {
+  bool ok = mFd != -1 && writeAll(mFd, mBuffer, mBuffered * sizeof(SpaceMouseTraceRecord));
+  mBuffered = 0;
+  return ok;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Trace reader                                                             */
+/*--------------------------------------------------------------------------*/
+SpaceMouseTraceReader::SpaceMouseTraceReader()
+    : mData(nullptr), mSize(0), mHeader(nullptr), mRecords(nullptr), mRecordCount(0) {}
+
+SpaceMouseTraceReader::~SpaceMouseTraceReader() { close(); }
+
+bool SpaceMouseTraceReader::open(const char *path) {
+  close();
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) == -1 ||
+      static_cast<std::size_t>(info.st_size) < sizeof(SpaceMouseTraceHeader)) {
+    ::close(fd);
+    return false;
+  }
+  mSize = static_cast<std::size_t>(info.st_size);
+  void *data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);  // the mapping stays valid
+  if (data == MAP_FAILED)
+    return false;
+  mData = data;
+
+  mHeader = static_cast<const SpaceMouseTraceHeader *>(mData);
+  if (std::memcmp(mHeader->magic, kTraceMagic, sizeof(kTraceMagic)) != 0 ||
+      mHeader->version != kTraceVersion ||
+      mHeader->recordSize != sizeof(SpaceMouseTraceRecord)) {
+    close();
+    return false;
+  }
+  madvise(mData, mSize, MADV_SEQUENTIAL);
+  mRecords = reinterpret_cast<const SpaceMouseTraceRecord *>(mHeader + 1);
+  mRecordCount = (mSize - sizeof(SpaceMouseTraceHeader)) / sizeof(SpaceMouseTraceRecord);
+  return true;
+}
+
+void SpaceMouseTraceReader::close() {
+  if (mData != nullptr)
+    munmap(mData, mSize);
+  mData = nullptr;
+  mSize = 0;
+  mHeader = nullptr;
+  mRecords = nullptr;
+  mRecordCount = 0;
+}
+
+}  // namespace spacemouse
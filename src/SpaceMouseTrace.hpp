@@ -0,0 +1,103 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSETRACE_HPP
+#define SPACEMOUSETRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "SpaceMouseSpnavClient.hpp"
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Binary traces of spacenavd sessions                                      */
+/*--------------------------------------------------------------------------*/
+/*
+ * A trace file is a SpaceMouseTraceHeader followed by fixed-size SpaceMouseTraceRecords in
+ * native byte order. All packets received by one recv() share the same timestamp, so the
+ * batches the reader thread saw can be restored on replay.
+ */
+
+/** @brief Header at the start of a trace file */
+struct SpaceMouseTraceHeader {
+  char magic[8];       /**< "SMTRACE" followed by a zero byte */
+  uint32_t version;    /**< kTraceVersion */
+  uint32_t recordSize; /**< sizeof(SpaceMouseTraceRecord) */
+  int64_t startTime;   /**< Time the recording started, see monotonicTime() */
+};
+static_assert(sizeof(SpaceMouseTraceHeader) == 24, "trace header has to be 24 bytes");
+
+/** @brief One packet received from spacenavd */
+struct SpaceMouseTraceRecord {
+  int64_t timestamp; /**< Time the packet was received, see monotonicTime() */
+  SpaceMouseSpnavPacket packet;
+};
+static_assert(sizeof(SpaceMouseTraceRecord) == 40, "trace records have to be 40 bytes");
+
+static const uint32_t kTraceVersion = 1;
+
+/**
+ * @brief Writes a trace file. Records are collected in a buffer and written in blocks, so that
+ * append() costs a copy most of the time.
+ */
+class SpaceMouseTraceWriter {
+ public:
+  SpaceMouseTraceWriter();
+  ~SpaceMouseTraceWriter();
+
+  /** @brief Creates (or truncates) the trace file and writes the header */
+  bool open(const char *path);
+  /** @brief Writes the buffered records and closes the file */
+  void close();
+  bool isOpen() const { return mFd != -1; }
+
+  /** @brief Appends the packets received at timestamp */
+  void append(int64_t timestamp, const SpaceMouseSpnavPacket *packets, std::size_t count);
+  /** @brief Writes the buffered records to the file */
+  bool flush();
+
+ private:
+  static const std::size_t kBufferRecords = 256;
+
+  int mFd;
+  SpaceMouseTraceRecord mBuffer[kBufferRecords];
+  std::size_t mBuffered;
+
+  SpaceMouseTraceWriter(const SpaceMouseTraceWriter &);             // not implemented
+  SpaceMouseTraceWriter &operator=(const SpaceMouseTraceWriter &);  // not implemented
+};
+
+/**
+ * @brief Read-only view of a trace file, memory-mapped so that replaying does not copy the
+ * records. A partially written last record (e.g. after a crash) is ignored.
+ */
+class SpaceMouseTraceReader {
+ public:
+  SpaceMouseTraceReader();
+  ~SpaceMouseTraceReader();
+
+  /** @brief Maps the trace file, false if it cannot be read or is not a trace */
+  bool open(const char *path);
+  void close();
+  bool isOpen() const { return mData != nullptr; }
+
+  const SpaceMouseTraceHeader &header() const { return *mHeader; }
+  std::size_t recordCount() const { return mRecordCount; }
+  const SpaceMouseTraceRecord *records() const { return mRecords; }
+
+ private:
+  void *mData;
+  std::size_t mSize;
+  const SpaceMouseTraceHeader *mHeader;
+  const SpaceMouseTraceRecord *mRecords;
+  std::size_t mRecordCount;
+
+  SpaceMouseTraceReader(const SpaceMouseTraceReader &);             // not implemented
+  SpaceMouseTraceReader &operator=(const SpaceMouseTraceReader &);  // not implemented
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSETRACE_HPP
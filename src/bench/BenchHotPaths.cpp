@@ -0,0 +1,428 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+// Microbenchmarks of the per-event hot paths of the spacenavd backend, without sockets or threads:
+//
+//   bench_hotpaths [-n iterations] [-r repetitions] [-f filter] [-j]
+//
+// Every benchmark runs its loop repetitions times and reports the median and the minimum time
+// per event together with the heap allocations per event, counted by replacing the global
+// operator new (and, for the python benchmarks, by hooking the allocators of the interpreter).
+// With -j every benchmark is printed as one JSON object per line, so that runs can be compared
+// by scripts. The python benchmarks are only built if the interpreter can be embedded
+// (WITH_PYTHON_BENCH, see build_bench.sh).
+
+#ifdef WITH_PYTHON_BENCH
+#include "PySpaceMouse.hpp"
+#endif  // WITH_PYTHON_BENCH
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "SpaceMouse.hpp"
+
+using spacemouse::monotonicTime;
+
+/*--------------------------------------------------------------------------*/
+/* Allocation counting                                                      */
+/*--------------------------------------------------------------------------*/
+namespace {
+std::atomic<uint64_t> allocations(0);
+}  // namespace
+
+void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+#ifdef WITH_PYTHON_BENCH
+/** Allocators of the interpreter, wrapped by the counting hooks below */
+PyMemAllocatorEx pythonAllocators[3];
+
+void *countingMalloc(void *ctx, std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  PyMemAllocatorEx *allocator = static_cast<PyMemAllocatorEx *>(ctx);
+  return allocator->malloc(allocator->ctx, size);
+}
+void *countingCalloc(void *ctx, std::size_t count, std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  PyMemAllocatorEx *allocator = static_cast<PyMemAllocatorEx *>(ctx);
+  return allocator->calloc(allocator->ctx, count, size);
+}
+void *countingRealloc(void *ctx, void *p, std::size_t size) {
+  if (p == nullptr)
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  PyMemAllocatorEx *allocator = static_cast<PyMemAllocatorEx *>(ctx);
+  return allocator->realloc(allocator->ctx, p, size);
+}
+void countingFree(void *ctx, void *p) {
+  PyMemAllocatorEx *allocator = static_cast<PyMemAllocatorEx *>(ctx);
+  allocator->free(allocator->ctx, p);
+}
+
+/** @brief Counts the allocations of all memory domains of the interpreter, too */
+void hookPythonAllocators() {
+  const PyMemAllocatorDomain domains[3] = {PYMEM_DOMAIN_RAW, PYMEM_DOMAIN_MEM, PYMEM_DOMAIN_OBJ};
+  for (int i = 0; i < 3; ++i) {
+    PyMem_GetAllocator(domains[i], &pythonAllocators[i]);
+    PyMemAllocatorEx hook = {&pythonAllocators[i], countingMalloc, countingCalloc,
+                             countingRealloc, countingFree};
+    PyMem_SetAllocator(domains[i], &hook);
+  }
+}
+#endif  // WITH_PYTHON_BENCH
+
+/** @brief Keeps the compiler from optimizing away the computation of value */
+template <typename T>
+inline void doNotOptimize(const T &value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+/*--------------------------------------------------------------------------*/
+/* Benchmarks                                                               */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Exposes the packet processing of the spacenavd backend without connecting it. The
+ * instance is never initialized, so no reader or dispatch thread is running.
+ */
+class BenchSpnav : public spacemouse::SpaceMouseSpnav {
+ public:
+  using SpaceMouseSpnav::FlushMotion;
+  using SpaceMouseSpnav::ProcessEvent;
+  /** @brief Pops one queued event as the consumer would */
+  bool pop(spacemouse::SpaceMouseEvent &event) { return mEventQueue.pop(event); }
+};
+
+struct Benchmark {
+  const char *name;
+  /** Events handled by one call of run */
+  std::size_t eventsPerIteration;
+  std::function<void(std::size_t iterations)> run;
+};
+
+struct Result {
+  double nsPerEvent;
+  double minNsPerEvent;
+  double allocationsPerEvent;
+};
+
+Result measure(const Benchmark &benchmark, std::size_t iterations, int repetitions) {
+  benchmark.run(iterations / 10 + 1);  // warm up caches, freelists and branch predictors
+  std::vector<double> times;
+  uint64_t allocated = 0;
+  for (int i = 0; i < repetitions; ++i) {
+    const uint64_t before = allocations.load(std::memory_order_relaxed);
+    const int64_t start = monotonicTime();
+    benchmark.run(iterations);
+    const int64_t elapsed = monotonicTime() - start;
+    allocated += allocations.load(std::memory_order_relaxed) - before;
+    times.push_back(static_cast<double>(elapsed));
+  }
+  std::sort(times.begin(), times.end());
+  const double events = static_cast<double>(iterations * benchmark.eventsPerIteration);
+  Result result;
+  result.nsPerEvent = times[times.size() / 2] / events;
+  result.minNsPerEvent = times[0] / events;
+  result.allocationsPerEvent = static_cast<double>(allocated) / (events * repetitions);
+  return result;
+}
+
+/** Raw axes of a typical stream, cycled through so that the results do not stay constant */
+const int kAxes[8][6] = {{12, -3, 40, 0, 0, 0},        {0, 0, 0, 25, -7, 3},
+                         {-150, 80, 0, 12, 0, -90},    {350, 350, -350, 350, -350, 350},
+                         {1, 0, 0, 0, 0, 0},           {0, 0, 0, 0, 0, 1},
+                         {-20, 44, -6, -130, 210, 17}, {5, 5, 5, 5, 5, 5}};
+
+std::vector<Benchmark> benchmarks(BenchSpnav &backend) {
+  std::vector<Benchmark> list;
+
+  // raw axes to angle and normalized axis (sqrt, divisions)
+  list.push_back({"decode_motion", 1, [](std::size_t iterations) {
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      const int *a = kAxes[i & 7];
+                      spacemouse::SpaceMouseMoveEvent e =
+                          spacemouse::SpaceMouseMoveEvent::fromAxes(a[0], a[1], a[2], a[3], a[4],
+                                                                    a[5]);
+                      doNotOptimize(e);
+                    }
+                  }});
+
+  // press and release of every button, i.e. button mapping, modifier tracking and queueing
+  list.push_back({"button_mapping", 2, [&backend](std::size_t iterations) {
+                    static const int kButtons[] = {0,  1,  2,  4,  5,  8,  12, 13,
+                                                   14, 15, 22, 23, 24, 25, 26, 30};
+                    spacemouse::SpaceMouseSpnavPacket packet = {};
+                    spacemouse::SpaceMouseEvent event;
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      packet.data[0] = kButtons[i & 15];
+                      packet.type = spacemouse::SPNAV_PACKET_PRESS;
+                      backend.ProcessEvent(packet);
+                      packet.type = spacemouse::SPNAV_PACKET_RELEASE;
+                      backend.ProcessEvent(packet);
+                      backend.pop(event);
+                      backend.pop(event);
+                      doNotOptimize(event);
+                    }
+                  }});
+
+  // the modifier bookkeeping on its own
+  list.push_back({"modifier_keys", 1, [](std::size_t iterations) {
+                    static const spacemouse::SpaceMouseModifierKey kKeys[] = {
+                        spacemouse::SpaceMouseModifierKey::SPMM_SHIFT,
+                        spacemouse::SpaceMouseModifierKey::SPMM_CTRL,
+                        spacemouse::SpaceMouseModifierKey::SPMM_ALT};
+                    spacemouse::SpaceMouseModifierKeys modifiers;
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      const spacemouse::SpaceMouseModifierKey key = kKeys[i % 3];
+                      if (modifiers.contains(key))
+                        modifiers.remove(key);
+                      else
+                        modifiers.add(key);
+                      doNotOptimize(modifiers);
+                    }
+                  }});
+
+  // the type erased call every callback goes through
+  list.push_back({"std_function_dispatch", 1, [](std::size_t iterations) {
+                    int sum = 0;
+                    std::function<void(spacemouse::SpaceMouseMoveEvent)> callback =
+                        [&sum](spacemouse::SpaceMouseMoveEvent e) { sum += e.tx; };
+                    doNotOptimize(callback);
+                    spacemouse::SpaceMouseMoveEvent e(1, 2, 3, 0.5, 0.0, 0.0, 1.0);
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      callback(e);
+                      doNotOptimize(sum);
+                    }
+                  }});
+
+  // the same through the read section that allows replacing the callback while it is called
+  list.push_back({"rcu_callback_dispatch", 1, [](std::size_t iterations) {
+                    int sum = 0;
+                    spacemouse::SpaceMouseCallback<spacemouse::SpaceMouseMoveEvent> callback(
+                        [&sum](spacemouse::SpaceMouseMoveEvent e) { sum += e.tx; });
+                    spacemouse::SpaceMouseMoveEvent e(1, 2, 3, 0.5, 0.0, 0.0, 1.0);
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      callback(e);
+                      doNotOptimize(sum);
+                    }
+                  }});
+
+  // a message formatted into the log ring by a device thread, flushed in batches by the consumer
+  list.push_back({"log_message", 1, [](std::size_t iterations) {
+                    int sum = 0;
+                    spacemouse::logFun = [&sum](const spacemouse::SpaceMouseLogRecord &record) {
+                      sum += record.text[0];
+                    };
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      spacemouse::logRing.log(spacemouse::SPML_INFO, "Lost connection to device %d",
+                                              static_cast<int>(i & 7));
+                      if ((i & 127) == 127)
+                        spacemouse::logRing.flush();
+                    }
+                    spacemouse::logRing.flush();
+                    doNotOptimize(sum);
+                    spacemouse::logFun = spacemouse::SpaceMouseCallback<
+                        const spacemouse::SpaceMouseLogRecord &>::Function();
+                  }});
+
+  // motion packet in, move callback out: accumulator, queue, merge and decode
+  list.push_back({"motion_pipeline", 1, [&backend](std::size_t iterations) {
+                    spacemouse::SpaceMouseSpnavPacket packet = {};
+                    packet.type = spacemouse::SPNAV_PACKET_MOTION;
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      std::memcpy(packet.data, kAxes[i & 7], sizeof(kAxes[0]));
+                      backend.ProcessEvent(packet);
+                      backend.FlushMotion();
+                      backend.dispatchEvents();
+                    }
+                  }});
+
+  // motion events queued until the ring is full and then drained in bulk, as drain_events does
+  list.push_back({"queue_drain", 1, [](std::size_t iterations) {
+                    const std::size_t kCapacity = spacemouse::SpaceMouseEventQueue::kCapacity;
+                    static spacemouse::SpaceMouseEventQueue queue;
+                    static spacemouse::SpaceMouseEvent events[kCapacity];
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      queue.push(spacemouse::SpaceMouseEvent::motion(0, kAxes[i & 7]));
+                      if (i % kCapacity == kCapacity - 1)
+                        doNotOptimize(queue.pop(events, kCapacity));
+                    }
+                    queue.pop(events, kCapacity);
+                  }});
+
+  // button packet in, button callback out
+  list.push_back({"button_pipeline", 2, [&backend](std::size_t iterations) {
+                    spacemouse::SpaceMouseSpnavPacket packet = {};
+                    for (std::size_t i = 0; i < iterations; ++i) {
+                      packet.data[0] = (i & 1) ? 12 : 24;  // button 1, shift
+                      packet.type = spacemouse::SPNAV_PACKET_PRESS;
+                      backend.ProcessEvent(packet);
+                      packet.type = spacemouse::SPNAV_PACKET_RELEASE;
+                      backend.ProcessEvent(packet);
+                      backend.dispatchEvents();
+                    }
+                  }});
+
+  // the device state published to shared memory by the reader thread and sampled by another
+  // process through the seqlock
+  list.push_back({"shared_state_publish", 1, [](std::size_t iterations) {
+                    static spacemouse::SpaceMouseSharedStatePublisher publisher;
+                    if (!publisher.isOpen() && !publisher.open("/spacemouse_bench"))
+                      return;
+                    for (std::size_t i = 0; i < iterations; ++i)
+                      publisher.publishMotion(0, static_cast<int64_t>(i), kAxes[i & 7]);
+                  }});
+  list.push_back({"shared_state_read", 1, [](std::size_t iterations) {
+                    static spacemouse::SpaceMouseSharedStateReader reader;
+                    if (!reader.isOpen() && !reader.open("/spacemouse_bench"))
+                      return;
+                    spacemouse::SpaceMouseSharedStateSample sample;
+                    int sum = 0;
+                    for (std::size_t i = 0; i < iterations; ++i)
+                      if (reader.read(0, sample))
+                        sum += sample.axes[i % 6];
+                    doNotOptimize(sum);
+                  }});
+
+#ifdef WITH_PYTHON_BENCH
+  // the callbacks of PySpaceMouse.cpp calling a trivial python function, both from a thread
+  // holding the GIL (pull mode) and from one that has to acquire it (dispatch thread)
+  static PyObject *noop = nullptr;
+  if (noop == nullptr) {
+    Py_XDECREF(PyInit_pyspacemouse());  // readies the event types
+    PyObject *globals = PyDict_New();
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyObject *result = PyRun_String("def noop(*args):\n    pass\n", Py_file_input, globals,
+                                    globals);
+    Py_XDECREF(result);
+    noop = PyDict_GetItemString(globals, "noop");
+    Py_XINCREF(noop);
+    Py_DECREF(globals);
+  }
+  static const std::function<void(spacemouse::SpaceMouseMoveEvent)> moveCallback =
+      pythonMoveCallback(noop);
+  static const std::function<void(spacemouse::SpaceMouseButtonEvent)> buttonCallback =
+      pythonButtonCallback(noop);
+  static const std::function<void(spacemouse::SpaceMouseMoveEvent)> moveEventCallback =
+      pythonMoveCallback(noop, false, true);
+  static const std::function<void(spacemouse::SpaceMouseButtonEvent)> buttonEventCallback =
+      pythonButtonCallback(noop, false, true);
+  list.push_back({"python_move_callback", 1, [](std::size_t iterations) {
+                    spacemouse::SpaceMouseMoveEvent e(1, 2, 3, 0.5, 0.0, 0.0, 1.0);
+                    for (std::size_t i = 0; i < iterations; ++i) moveCallback(e);
+                  }});
+  list.push_back({"python_button_callback", 1, [](std::size_t iterations) {
+                    spacemouse::SpaceMouseButtonEvent e = {spacemouse::SPMB_1, {}};
+                    for (std::size_t i = 0; i < iterations; ++i) buttonCallback(e);
+                  }});
+  // the same with the reused event objects instead of boxed arguments
+  list.push_back({"python_move_event_callback", 1, [](std::size_t iterations) {
+                    spacemouse::SpaceMouseMoveEvent e(1, 2, 3, 0.5, 0.0, 0.0, 1.0);
+                    for (std::size_t i = 0; i < iterations; ++i) moveEventCallback(e);
+                  }});
+  list.push_back({"python_button_event_callback", 1, [](std::size_t iterations) {
+                    spacemouse::SpaceMouseButtonEvent e = {spacemouse::SPMB_1, {}};
+                    for (std::size_t i = 0; i < iterations; ++i) buttonEventCallback(e);
+                  }});
+  list.push_back({"python_move_callback_acquire_gil", 1, [](std::size_t iterations) {
+                    spacemouse::SpaceMouseMoveEvent e(1, 2, 3, 0.5, 0.0, 0.0, 1.0);
+                    PyThreadState *state = PyEval_SaveThread();
+                    for (std::size_t i = 0; i < iterations; ++i) moveCallback(e);
+                    PyEval_RestoreThread(state);
+                  }});
+#endif  // WITH_PYTHON_BENCH
+  return list;
+}
+
+void usage(const char *name) {
+  std::fprintf(stderr,
+               "Usage: %s [-n iterations] [-r repetitions] [-f filter] [-j]\n"
+               "  -n  iterations per repetition (default 1000000)\n"
+               "  -r  repetitions, the median is reported (default 5)\n"
+               "  -f  only run benchmarks whose name contains filter\n"
+               "  -j  print one JSON object per benchmark\n",
+               name);
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::size_t iterations = 1000000;
+  int repetitions = 5;
+  const char *filter = nullptr;
+  bool json = false;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:r:f:jh")) != -1) {
+    switch (option) {
+      case 'n':
+        iterations = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'r':
+        repetitions = std::atoi(optarg);
+        break;
+      case 'f':
+        filter = optarg;
+        break;
+      case 'j':
+        json = true;
+        break;
+      default:
+        usage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+  if (iterations == 0 || repetitions < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+#ifdef WITH_PYTHON_BENCH
+  Py_InitializeEx(0);
+  hookPythonAllocators();
+#endif  // WITH_PYTHON_BENCH
+
+  BenchSpnav backend;
+  backend.setPullMode(true);  // the queue is emptied by the benchmarks themselves
+  backend.setMoveCallback([](spacemouse::SpaceMouseMoveEvent e) { doNotOptimize(e); });
+  backend.setButtonPressCallback([](spacemouse::SpaceMouseButtonEvent e) { doNotOptimize(e); });
+  backend.setButtonReleaseCallback([](spacemouse::SpaceMouseButtonEvent e) { doNotOptimize(e); });
+
+  if (!json)
+    std::printf("%-34s %12s %12s %14s\n", "benchmark", "ns/event", "min ns/event",
+                "allocs/event");
+  for (const Benchmark &benchmark : benchmarks(backend)) {
+    if (filter != nullptr && std::strstr(benchmark.name, filter) == nullptr)
+      continue;
+    const Result result = measure(benchmark, iterations, repetitions);
+    if (json)
+      std::printf("{\"benchmark\": \"%s\", \"iterations\": %zu, \"repetitions\": %d, "
+                  "\"ns_per_event\": %.3f, \"min_ns_per_event\": %.3f, "
+                  "\"allocations_per_event\": %.4f}\n",
+                  benchmark.name, iterations, repetitions, result.nsPerEvent,
+                  result.minNsPerEvent, result.allocationsPerEvent);
+    else
+      std::printf("%-34s %12.2f %12.2f %14.4f\n", benchmark.name, result.nsPerEvent,
+                  result.minNsPerEvent, result.allocationsPerEvent);
+    std::fflush(stdout);
+  }
+  shm_unlink("/spacemouse_bench");
+  return 0;
+}
@@ -0,0 +1,423 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+// End-to-end benchmark of the spacenavd backend: a forked SpaceMouseMockDaemon streams packets
+// into the real SpaceMouseDaemon and the callbacks record how long each packet took to arrive.
+//
+//   bench_spacenav [-r rate] [-n count] [-b buttonEvery] [-w window] [-c callbackMicroseconds]
+//                  [-s source] [-l loadProcesses] [-p policy[:priority]] [-t probeMicroseconds]
+//                  [-j]
+//
+// Every motion packet has tx = 1, so the tx of a (merged) move event counts the packets it
+// contains and the running sum identifies the newest of them. Its latency is the time from
+// before send() in the daemon to the call of the move callback.
+//
+// With -s evdev a forked SpaceMouseMockDevice writes the events into a FIFO that the backend
+// reads as its evdev node instead. -s relay puts a forked process standing in for spacenavd in
+// between, which reads the FIFO and forwards the packets over the socket. The latency is then
+// measured from before write() into the FIFO, so that the difference between both is the cost
+// of the hop through the daemon.
+//
+// -l forks processes that keep cores busy meanwhile, e.g. -l $(nproc) to see whether the latency
+// stays flat when the reader thread runs with -p fifo:50 (see setReaderScheduling()). -t measures
+// the wakeup jitter of the reader thread with a probe timer, see setJitterProbe().
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SpaceMouse.hpp"
+#include "SpaceMouseMockDaemon.hpp"
+
+using spacemouse::monotonicTime;
+
+namespace {
+/** Where the backend reads the events from */
+enum Source { SOURCE_SPACENAVD, SOURCE_EVDEV, SOURCE_RELAY };
+const char *sourceNames[] = {"spacenavd", "evdev", "relay"};
+/** Indexed by spacemouse::SpaceMouseSchedulingPolicy */
+const char *policyNames[] = {"default", "nice", "fifo", "rr"};
+
+/** Daemon side of the benchmark, shared with the forked daemon process */
+struct SharedState {
+  std::atomic<std::size_t> motionSent;
+  std::atomic<bool> finished;
+};
+
+/** Results of the callbacks, only touched by the dispatch thread until the run is over */
+struct Receiver {
+  const int64_t *motionSendTimes;
+  const int64_t *buttonSendTimes;
+  int64_t callbackCost;
+  std::vector<int64_t> motionLatencies;
+  std::vector<int64_t> buttonLatencies;
+  std::atomic<std::size_t> motionReceived;
+  std::size_t moveCalls;
+  std::size_t presses;
+  int64_t firstCall;
+  std::atomic<int64_t> lastCall;
+};
+
+Receiver receiver;
+
+void busyWait(int64_t nanoseconds) {
+  const int64_t until = monotonicTime() + nanoseconds;
+  while (monotonicTime() < until) {
+  }
+}
+
+void onMove(spacemouse::SpaceMouseMoveEvent e) {
+  const int64_t now = monotonicTime();
+  const std::size_t received = receiver.motionReceived.load(std::memory_order_relaxed) + e.tx;
+  if (receiver.moveCalls == 0)
+    receiver.firstCall = now;
+  ++receiver.moveCalls;
+  if (e.tx > 0 && receiver.motionLatencies.size() < receiver.motionLatencies.capacity())
+    receiver.motionLatencies.push_back(now - receiver.motionSendTimes[received - 1]);
+  receiver.motionReceived.store(received, std::memory_order_relaxed);
+  receiver.lastCall.store(now, std::memory_order_release);
+  busyWait(receiver.callbackCost);
+}
+
+void onPress(spacemouse::SpaceMouseButtonEvent) {
+  const int64_t now = monotonicTime();
+  if (receiver.buttonLatencies.size() < receiver.buttonLatencies.capacity())
+    receiver.buttonLatencies.push_back(now - receiver.buttonSendTimes[receiver.presses]);
+  ++receiver.presses;
+  receiver.lastCall.store(now, std::memory_order_release);
+}
+
+void onRelease(spacemouse::SpaceMouseButtonEvent) {}
+
+double percentile(const std::vector<int64_t> &sorted, double p) {
+  if (sorted.empty())
+    return 0.0;
+  std::size_t index = static_cast<std::size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1));
+  return static_cast<double>(sorted[index]) / 1000.0;
+}
+
+int64_t cpuTime() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (static_cast<int64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+          usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
+void usage(const char *name) {
+  std::fprintf(stderr,
+               "Usage: %s [-r rate] [-n count] [-b buttonEvery] [-w window] [-c us] [-s source] "
+               "[-l processes] [-p policy[:priority]] [-t us] [-j]\n"
+               "  -r  motion packets per second, 0 for as fast as possible (default 1000)\n"
+               "  -n  number of motion packets (default 10000)\n"
+               "  -b  press and release a button after every n-th motion packet (default 0)\n"
+               "  -w  coalescing window in ms (default 0)\n"
+               "  -c  time spent in the move callback in us (default 0)\n"
+               "  -s  spacenavd: packets from a mock spacenavd (default), evdev: input events\n"
+               "      read directly from a FIFO, relay: the same input events forwarded by a mock\n"
+               "      spacenavd\n"
+               "  -l  number of processes spinning on the cpus meanwhile (default 0)\n"
+               "  -p  scheduling of the reader thread: default, nice, fifo or rr, optionally with\n"
+               "      the nice value or real-time priority, e.g. fifo:50 (default: default)\n"
+               "  -t  measure the wakeup jitter of the reader thread with a timer expiring every\n"
+               "      n us (default 0, off)\n"
+               "  -j  print the results as one JSON object\n",
+               name);
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  spacemouse::SpaceMouseMockStream stream;
+  int window = 0;
+  bool json = false;
+  Source source = SOURCE_SPACENAVD;
+  int loadProcesses = 0;
+  spacemouse::SpaceMouseReaderScheduling scheduling;
+  int64_t probeInterval = 0;
+  receiver.callbackCost = 0;
+
+  int option;
+  while ((option = getopt(argc, argv, "r:n:b:w:c:s:l:p:t:jh")) != -1) {
+    switch (option) {
+      case 'r':
+        stream.rate = std::atof(optarg);
+        break;
+      case 'n':
+        stream.motionCount = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'b':
+        stream.buttonEvery = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'w':
+        window = std::atoi(optarg);
+        break;
+      case 'c':
+        receiver.callbackCost = static_cast<int64_t>(std::atof(optarg) * 1000.0);
+        break;
+      case 's':
+        source = SOURCE_SPACENAVD;
+        while (source <= SOURCE_RELAY && std::string(optarg) != sourceNames[source])
+          source = static_cast<Source>(source + 1);
+        if (source > SOURCE_RELAY) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'l':
+        loadProcesses = std::atoi(optarg);
+        break;
+      case 'p': {
+        const std::string policy(optarg);
+        const std::string name = policy.substr(0, policy.find(':'));
+        int index = 0;
+        while (index < 4 && name != policyNames[index]) ++index;
+        if (index == 4) {
+          usage(argv[0]);
+          return 1;
+        }
+        scheduling.policy = static_cast<spacemouse::SpaceMouseSchedulingPolicy>(index);
+        if (name.size() < policy.size())
+          scheduling.priority = std::atoi(policy.c_str() + name.size() + 1);
+        break;
+      }
+      case 't':
+        probeInterval = static_cast<int64_t>(std::atof(optarg) * 1000.0);
+        break;
+      case 'j':
+        json = true;
+        break;
+      default:
+        usage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+  if (stream.motionCount == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  const std::size_t buttonCount =
+      stream.buttonEvery > 0 ? stream.motionCount / stream.buttonEvery : 0;
+
+  // send times are written by the daemon process, so they live in shared memory
+  const std::size_t sharedSize =
+      sizeof(SharedState) + (stream.motionCount + buttonCount + 1) * sizeof(int64_t);
+  void *shared =
+      mmap(nullptr, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    std::perror("mmap");
+    return 1;
+  }
+  SharedState *state = new (shared) SharedState();
+  int64_t *motionSendTimes = reinterpret_cast<int64_t *>(state + 1);
+  int64_t *buttonSendTimes = motionSendTimes + stream.motionCount;
+
+  const std::string basePath = "/tmp/spacemouse-bench-" + std::to_string(getpid());
+  const std::string socketPath = basePath + ".sock";
+  const std::string fifoPath = basePath + ".fifo";
+  spacemouse::SpaceMouseMockDaemon daemon;
+  if (source != SOURCE_EVDEV && !daemon.listen(socketPath.c_str())) {
+    std::perror("Could not listen on socket");
+    return 1;
+  }
+  if (source != SOURCE_SPACENAVD && mkfifo(fifoPath.c_str(), 0600) == -1) {
+    std::perror("mkfifo");
+    return 1;
+  }
+  int startPipe[2];
+  if (pipe(startPipe) == -1) {
+    std::perror("pipe");
+    return 1;
+  }
+
+  // fork before any thread exists, the daemon processes are not part of the measured CPU time
+  pid_t relay = -1;
+  if (source == SOURCE_RELAY) {
+    relay = fork();
+    if (relay == 0) {
+      prctl(PR_SET_TIMERSLACK, 1UL);
+      ::close(startPipe[1]);
+      spacemouse::SpaceMouseEvdevClient device;
+      if (!device.open(fifoPath.c_str()) || !daemon.acceptClient())
+        _exit(1);
+      daemon.relay(device);
+      // stay connected until the benchmark is done
+      char start;
+      read(startPipe[0], &start, 1);
+      _exit(0);
+    }
+  }
+  pid_t child = fork();
+  if (child == 0) {
+    prctl(PR_SET_TIMERSLACK, 1UL);
+    ::close(startPipe[1]);
+    char start;
+    spacemouse::SpaceMouseMockDevice device;
+    spacemouse::SpaceMouseMockSender *sender = &daemon;
+    if (source != SOURCE_SPACENAVD)
+      sender = &device;
+    if ((source == SOURCE_SPACENAVD ? !daemon.acceptClient() : !device.open(fifoPath.c_str())) ||
+        read(startPipe[0], &start, 1) != 1)
+      _exit(1);
+    state->motionSent = sender->playSynthetic(stream, motionSendTimes, buttonSendTimes);
+    state->finished = true;
+    // stay connected until the benchmark is done
+    read(startPipe[0], &start, 1);
+    _exit(0);
+  }
+  ::close(startPipe[0]);
+  std::vector<pid_t> load;
+  for (int i = 0; i < loadProcesses; ++i) {
+    const pid_t spinner = fork();
+    if (spinner == 0) {
+      for (volatile uint64_t n = 0;; n = n + 1) {
+      }
+    }
+    load.push_back(spinner);
+  }
+
+  receiver.motionSendTimes = motionSendTimes;
+  receiver.buttonSendTimes = buttonSendTimes;
+  receiver.motionLatencies.reserve(stream.motionCount);
+  receiver.buttonLatencies.reserve(buttonCount);
+  receiver.motionReceived = 0;
+  receiver.moveCalls = 0;
+  receiver.presses = 0;
+  receiver.firstCall = 0;
+  receiver.lastCall = 0;
+
+  setenv("SPNAV_SOCKET", socketPath.c_str(), 1);
+  auto &smDaemon = spacemouse::SpaceMouseDaemon::instance();
+  if (source == SOURCE_EVDEV)
+    smDaemon.useEvdev(fifoPath.c_str());
+  if (!smDaemon.isInitialized() || (source == SOURCE_EVDEV && !smDaemon.isEvdev())) {
+    std::fprintf(stderr, "Could not connect to the mock daemon\n");
+    kill(child, SIGTERM);
+    if (relay != -1)
+      kill(relay, SIGTERM);
+    for (pid_t spinner : load) kill(spinner, SIGKILL);
+    return 1;
+  }
+  const spacemouse::SpaceMouseSchedulingPolicy policy = smDaemon.setReaderScheduling(scheduling);
+  if (probeInterval > 0)
+    smDaemon.setJitterProbe(probeInterval);
+  smDaemon.setCoalescingWindow(window);
+  smDaemon.setMoveCallback(onMove);
+  smDaemon.setButtonPressCallback(onPress);
+  smDaemon.setButtonReleaseCallback(onRelease);
+
+  const int64_t cpuStart = cpuTime();
+  const int64_t wallStart = monotonicTime();
+  if (write(startPipe[1], "s", 1) != 1) {
+    std::perror("write");
+    return 1;
+  }
+
+  // wait for the daemon, then until everything arrived or nothing arrived for a second
+  while (!state->finished) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  int64_t idleSince = monotonicTime();
+  std::size_t lastReceived = receiver.motionReceived.load();
+  while (receiver.motionReceived.load() < state->motionSent &&
+         monotonicTime() - idleSince < 1000000000) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (receiver.motionReceived.load() != lastReceived) {
+      lastReceived = receiver.motionReceived.load();
+      idleSince = monotonicTime();
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));  // trailing button events
+  const int64_t wallEnd = receiver.lastCall.load(std::memory_order_acquire);
+  const int64_t cpuEnd = cpuTime();
+  const int64_t wallNow = monotonicTime();
+  smDaemon.setJitterProbe(0);
+  const spacemouse::SpaceMouseHistogram &jitter = smDaemon.wakeupJitter();
+
+  for (pid_t spinner : load) kill(spinner, SIGKILL);
+  for (pid_t spinner : load) waitpid(spinner, nullptr, 0);
+  ::close(startPipe[1]);
+  waitpid(child, nullptr, 0);
+  if (relay != -1)
+    waitpid(relay, nullptr, 0);
+  daemon.close();
+  if (source != SOURCE_SPACENAVD)
+    unlink(fifoPath.c_str());
+
+  // evaluate
+  const std::size_t sent = state->motionSent;
+  const std::size_t received = receiver.motionReceived.load();
+  std::vector<int64_t> motion(receiver.motionLatencies);
+  std::vector<int64_t> buttons(receiver.buttonLatencies);
+  std::sort(motion.begin(), motion.end());
+  std::sort(buttons.begin(), buttons.end());
+  const double seconds = static_cast<double>(std::max<int64_t>(wallEnd - wallStart, 1)) / 1e9;
+  const double cpu = 100.0 * static_cast<double>(cpuEnd - cpuStart) /
+                     static_cast<double>(std::max<int64_t>(wallNow - wallStart, 1));
+  const double p[] = {50.0, 90.0, 99.0, 99.9, 100.0};
+  const char *names[] = {"p50", "p90", "p99", "p99.9", "max"};
+
+  if (json) {
+    std::printf("{\"source\": \"%s\", \"rate\": %g, \"window_ms\": %d, \"callback_us\": %g, "
+                "\"load_processes\": %d, \"policy\": \"%s\", \"sent\": %zu, "
+                "\"received\": %zu, \"move_calls\": %zu, \"merged\": %zu, \"dropped\": %zu, "
+                "\"buttons_sent\": %zu, \"buttons_received\": %zu, \"packets_per_s\": %.1f, "
+                "\"calls_per_s\": %.1f, \"cpu_percent\": %.2f",
+                sourceNames[source], stream.rate, window,
+                static_cast<double>(receiver.callbackCost) / 1000.0, loadProcesses,
+                policyNames[policy], sent,
+                received, receiver.moveCalls, received - std::min(received, receiver.moveCalls),
+                sent - std::min(sent, received), buttonCount, receiver.presses,
+                static_cast<double>(received) / seconds,
+                static_cast<double>(receiver.moveCalls) / seconds, cpu);
+    for (int i = 0; i < 5; ++i)
+      std::printf(", \"motion_latency_%s_us\": %.2f", names[i], percentile(motion, p[i]));
+    for (int i = 0; i < 5; ++i)
+      std::printf(", \"button_latency_%s_us\": %.2f", names[i], percentile(buttons, p[i]));
+    if (probeInterval > 0) {
+      std::printf(", \"wakeups\": %llu, \"jitter_p50_us\": %.2f, \"jitter_p90_us\": %.2f, "
+                  "\"jitter_p99_us\": %.2f, \"jitter_max_us\": %.2f",
+                  static_cast<unsigned long long>(jitter.count()), jitter.percentile(50.0) / 1000.0,
+                  jitter.percentile(90.0) / 1000.0, jitter.percentile(99.0) / 1000.0,
+                  jitter.max() / 1000.0);
+    }
+    std::printf("}\n");
+  } else {
+    std::printf("source %s, rate %g/s, window %d ms, callback %g us\n", sourceNames[source],
+                stream.rate, window, static_cast<double>(receiver.callbackCost) / 1000.0);
+    std::printf("reader thread: %s, %d processes loading the cpus\n", policyNames[policy],
+                loadProcesses);
+    std::printf("motion packets: %zu sent, %zu received in %zu move calls (%zu merged, %zu "
+                "dropped)\n",
+                sent, received, receiver.moveCalls,
+                received - std::min(received, receiver.moveCalls),
+                sent - std::min(sent, received));
+    std::printf("button presses: %zu sent, %zu received\n", buttonCount, receiver.presses);
+    std::printf("throughput: %.0f packets/s, %.0f move calls/s\n",
+                static_cast<double>(received) / seconds,
+                static_cast<double>(receiver.moveCalls) / seconds);
+    std::printf("cpu: %.2f %% of one core\n", cpu);
+    std::printf("motion latency [us]:");
+    for (int i = 0; i < 5; ++i) std::printf(" %s %.1f", names[i], percentile(motion, p[i]));
+    std::printf("\nbutton latency [us]:");
+    for (int i = 0; i < 5; ++i) std::printf(" %s %.1f", names[i], percentile(buttons, p[i]));
+    std::printf("\n");
+    if (probeInterval > 0) {
+      // the percentiles are upper bounds of power of two buckets
+      std::printf("wakeup jitter [us] (%llu wakeups): p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+                  static_cast<unsigned long long>(jitter.count()), jitter.percentile(50.0) / 1000.0,
+                  jitter.percentile(90.0) / 1000.0, jitter.percentile(99.0) / 1000.0,
+                  jitter.max() / 1000.0);
+    }
+  }
+  return 0;
+}
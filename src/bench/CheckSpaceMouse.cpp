@@ -0,0 +1,411 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+// Checks of the spacenavd backend, with the mock daemon instead of a device and spacenavd:
+//
+//   check_spacemouse [-f filter]
+//
+// Every check prints OK or the conditions that failed, the exit status is 1 if any check failed.
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "SpaceMouse.hpp"
+#include "SpaceMouseFilter.hpp"
+#include "SpaceMouseFrameSampler.hpp"
+#include "SpaceMouseMockDaemon.hpp"
+#include "SpaceMouseRcu.hpp"
+#include "SpaceMouseSharedState.hpp"
+#include "SpaceMouseSpnavClient.hpp"
+
+using spacemouse::SpaceMouseBackpressure;
+using spacemouse::SpaceMouseEvent;
+using spacemouse::SpaceMouseEventQueue;
+using spacemouse::SpaceMouseFilterChain;
+using spacemouse::SpaceMouseFilterStage;
+using spacemouse::SpaceMouseFrameSampler;
+using spacemouse::SpaceMouseMockDaemon;
+using spacemouse::SpaceMouseRcu;
+using spacemouse::SpaceMouseRcuPointer;
+using spacemouse::SpaceMouseSharedStateReader;
+using spacemouse::SpaceMouseSharedStateSample;
+using spacemouse::SpaceMouseSpnavClient;
+using spacemouse::SpaceMouseSpnavPacket;
+
+namespace {
+/** Number of failed conditions of the running check */
+int failures = 0;
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      std::printf("\n  %s:%d: %s", __FILE__, __LINE__, #condition);            \
+      ++failures;                                                              \
+    }                                                                          \
+  } while (0)
+
+struct Check {
+  const char *name;
+  void (*run)();
+};
+
+/*--------------------------------------------------------------------------*/
+/* SpaceMouseSpnavClient                                                    */
+/*--------------------------------------------------------------------------*/
+/** Mock daemon with a connected client, both in this thread */
+struct SpnavConnection {
+  SpnavConnection() {
+    std::snprintf(path, sizeof(path), "/tmp/check_spacemouse_%d.sock", int(getpid()));
+    connected = daemon.listen(path) && client.open(path) && daemon.acceptClient();
+  }
+
+  char path[64];
+  SpaceMouseMockDaemon daemon;
+  SpaceMouseSpnavClient client;
+  bool connected;
+};
+
+SpaceMouseSpnavPacket motionPacket(int value) {
+  SpaceMouseSpnavPacket packet;
+  packet.type = spacemouse::SPNAV_PACKET_MOTION;
+  for (int i = 0; i < 6; ++i) packet.data[i] = value + i;
+  packet.data[6] = 1;
+  return packet;
+}
+
+bool isMotionPacket(const SpaceMouseSpnavPacket &packet, int value) {
+  const SpaceMouseSpnavPacket expected = motionPacket(value);
+  return std::memcmp(&packet, &expected, sizeof(packet)) == 0;
+}
+
+void checkSpnavWholePackets() {
+  SpnavConnection connection;
+  CHECK(connection.connected);
+  const SpaceMouseSpnavPacket *packets;
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == 0);
+
+  for (int i = 0; i < 3; ++i) CHECK(connection.daemon.send(motionPacket(10 * i)));
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == 3);
+  for (int i = 0; i < 3; ++i) CHECK(isMotionPacket(packets[i], 10 * i));
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == 0);
+}
+
+void checkSpnavSplitPacket() {
+  SpnavConnection connection;
+  CHECK(connection.connected);
+  const SpaceMouseSpnavPacket *packets;
+  const SpaceMouseSpnavPacket split = motionPacket(20);
+  const char *bytes = reinterpret_cast<const char *>(&split);
+  const std::size_t head = 13;  // not even a whole int32
+
+  // a whole packet followed by the start of the next one
+  CHECK(connection.daemon.send(motionPacket(10)));
+  CHECK(connection.daemon.sendBytes(bytes, head));
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == 1);
+  CHECK(isMotionPacket(packets[0], 10));
+
+  // the rest of it arrives together with another packet
+  CHECK(connection.daemon.sendBytes(bytes + head, sizeof(split) - head));
+  CHECK(connection.daemon.send(motionPacket(30)));
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == 2);
+  CHECK(isMotionPacket(packets[0], 20));
+  CHECK(isMotionPacket(packets[1], 30));
+
+  // limited by maxPackets, so that the recv() itself ends within a packet
+  CHECK(connection.daemon.sendBytes(bytes, head));
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == 0);
+  CHECK(connection.daemon.sendBytes(bytes + head, sizeof(split) - head));
+  for (int i = 0; i < 3; ++i) CHECK(connection.daemon.send(motionPacket(40 + 10 * i)));
+  CHECK(connection.client.receive(packets, 2) == 2);
+  CHECK(isMotionPacket(packets[0], 20));
+  CHECK(isMotionPacket(packets[1], 40));
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == 2);
+  CHECK(isMotionPacket(packets[0], 50));
+  CHECK(isMotionPacket(packets[1], 60));
+}
+
+void checkSpnavHangUp() {
+  SpnavConnection connection;
+  CHECK(connection.connected);
+  const SpaceMouseSpnavPacket *packets;
+  const SpaceMouseSpnavPacket split = motionPacket(20);
+
+  // the packets sent before the hang-up are still delivered, the partial one is dropped
+  CHECK(connection.daemon.send(motionPacket(10)));
+  CHECK(connection.daemon.sendBytes(&split, sizeof(split) / 2));
+  connection.daemon.close();
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == 1);
+  CHECK(isMotionPacket(packets[0], 10));
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == -1);
+
+  connection.client.close();
+  CHECK(connection.client.receive(packets, SpaceMouseSpnavClient::kMaxPackets) == -1);
+}
+
+/*--------------------------------------------------------------------------*/
+/* SpaceMouseEventQueue                                                     */
+/*--------------------------------------------------------------------------*/
+bool hasAxes(const SpaceMouseEvent &event, int value) {
+  for (int i = 0; i < 6; ++i) {
+    if (event.axes[i] != value)
+      return false;
+  }
+  return true;
+}
+
+void checkQueueOverflowMerge() {
+  SpaceMouseEventQueue queue;
+  SpaceMouseEvent filler = {};
+  filler.type = spacemouse::SPME_BUTTON_PRESS;
+  while (queue.overflows() == 0) queue.push(filler);
+
+  // motion is only merged into the overflowed motion of the same device, and then takes its
+  // timestamp
+  const int one[6] = {1, 1, 1, 1, 1, 1};
+  queue.push(SpaceMouseEvent::motion(1, one, 0));
+  queue.push(SpaceMouseEvent::motion(2, one, 1));
+  queue.push(SpaceMouseEvent::motion(3, one, 1));
+  queue.push(SpaceMouseEvent::motion(4, one, 0));
+  queue.push(SpaceMouseEvent::motion(5, one, 0));
+  CHECK(queue.merged() == 2);
+  CHECK(queue.dropped() == 0);
+
+  SpaceMouseEvent event;
+  while (queue.pop(event)) CHECK(event.type == spacemouse::SPME_BUTTON_PRESS);
+  CHECK(queue.flushOverflow());
+  CHECK(queue.pop(event) && event.type == spacemouse::SPME_BUTTON_PRESS);
+  CHECK(queue.pop(event) && event.device == 0 && event.timestamp == 1 && hasAxes(event, 1));
+  CHECK(queue.pop(event) && event.device == 1 && event.timestamp == 3 && hasAxes(event, 2));
+  CHECK(queue.pop(event) && event.device == 0 && event.timestamp == 5 && hasAxes(event, 2));
+  CHECK(!queue.pop(event));
+}
+
+/*--------------------------------------------------------------------------*/
+/* SpaceMouseFilterChain                                                    */
+/*--------------------------------------------------------------------------*/
+/** @brief Filters a sample with value on the first axis, returns the filtered value */
+int filterAxis(SpaceMouseFilterChain &chain, int value, int64_t timestamp) {
+  int axes[6] = {value, 0, 0, 0, 0, 0};
+  const bool kept = chain.apply(axes, timestamp);
+  CHECK(kept == (axes[0] != 0));
+  return axes[0];
+}
+
+void checkFilterDeadzoneHysteresis() {
+  SpaceMouseFilterChain chain;
+  const SpaceMouseFilterStage deadzone = {spacemouse::SPMF_DEADZONE, {10.0, 4.0, 0.0}};
+  CHECK(chain.configure(&deadzone, 1));
+
+  // the axis turns on at the threshold and only turns off again below threshold - hysteresis
+  CHECK(filterAxis(chain, 9, 1) == 0);
+  CHECK(filterAxis(chain, 10, 2) == 10);
+  CHECK(filterAxis(chain, 7, 3) == 7);
+  CHECK(filterAxis(chain, -6, 4) == -6);
+  CHECK(filterAxis(chain, 5, 5) == 0);
+  CHECK(filterAxis(chain, 7, 6) == 0);
+  CHECK(filterAxis(chain, -10, 7) == -10);
+}
+
+void checkFilterSmoothingConverges() {
+  const SpaceMouseFilterStage stages[] = {{spacemouse::SPMF_EMA, {0.3, 0.0, 0.0}},
+                                          {spacemouse::SPMF_ONE_EURO, {1.0, 0.01, 1.0}}};
+  for (const SpaceMouseFilterStage &stage : stages) {
+    SpaceMouseFilterChain chain;
+    CHECK(chain.configure(&stage, 1));
+    // a constant input at 100 Hz is approached from below without overshooting, and reached
+    int value = 0;
+    bool monotonic = true;
+    for (int64_t i = 1; i <= 300; ++i) {
+      const int filtered = filterAxis(chain, 100, i * 10000000);
+      monotonic = monotonic && filtered >= value && filtered <= 100;
+      value = filtered;
+    }
+    CHECK(monotonic);
+    CHECK(value == 100);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+/* SpaceMouseFrameSampler                                                   */
+/*--------------------------------------------------------------------------*/
+void checkFrameSamplerWakeup() {
+  SpaceMouseFrameSampler sampler;
+  const int64_t ms = 1000000;
+  const int rest[6] = {0, 0, 0, 0, 0, 0};
+  const int moving[6] = {100, 0, 0, 0, 0, 0};
+  double delta[6];
+
+  // at rest the consumer goes idle, and only the first motion sample after that wakes it
+  CHECK(!sampler.add(rest, 1000 * ms));
+  CHECK(!sampler.sample(1001 * ms, delta));
+  CHECK(sampler.add(moving, 1002 * ms));
+  CHECK(!sampler.add(moving, 1003 * ms));
+  CHECK(sampler.sample(1004 * ms, delta) && delta[0] > 0);
+
+  // back at rest, the motion up to the zero sample is still handed out before it goes idle again
+  CHECK(!sampler.add(rest, 1005 * ms));
+  CHECK(sampler.sample(1006 * ms, delta) && delta[0] > 0);
+  CHECK(!sampler.sample(1007 * ms, delta) && delta[0] == 0);
+  CHECK(sampler.add(moving, 1008 * ms));
+  CHECK(!sampler.add(moving, 1009 * ms));
+}
+
+/*--------------------------------------------------------------------------*/
+/* Backpressure                                                             */
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Exposes the packet processing of the spacenavd backend without connecting it. The
+ * instance is never initialized, so no reader or dispatch thread is running.
+ */
+class CheckSpnav : public spacemouse::SpaceMouseSpnav {
+ public:
+  using SpaceMouseSpnav::FlushMotion;
+  using SpaceMouseSpnav::ProcessEvent;
+
+  SpaceMouseEventQueue &eventQueue() { return mEventQueue; }
+  SpaceMouseBackpressure &backpressure() { return mBackpressure; }
+};
+
+void checkMergedMotionOverflow() {
+  CheckSpnav spnav;
+  SpaceMouseBackpressure &backpressure = spnav.backpressure();
+  // samples every millisecond and a move callback that takes a second
+  for (int64_t i = 1; i <= 8; ++i) backpressure.recordSample(i * 1000000);
+  CHECK(backpressure.recordDelivery(1000000000, 0));
+  CHECK(backpressure.mode() == spacemouse::SPMD_MERGED);
+
+  SpaceMouseEventQueue &queue = spnav.eventQueue();
+  SpaceMouseEvent filler = {};
+  filler.type = spacemouse::SPME_BUTTON_PRESS;
+  while (queue.overflows() == 0) queue.push(filler);
+
+  // the second motion is merged into the overflowed first one, both are taken as one event
+  const SpaceMouseSpnavPacket packet = motionPacket(1);
+  for (int i = 0; i < 2; ++i) {
+    spnav.ProcessEvent(packet);
+    spnav.FlushMotion();
+  }
+  CHECK(queue.merged() == 1);
+
+  SpaceMouseEvent event;
+  uint64_t motion = 0;
+  do {
+    while (queue.pop(event)) motion += event.type == spacemouse::SPME_MOTION;
+  } while (!queue.flushOverflow() || !queue.isEmpty());
+  CHECK(motion == 1);
+  backpressure.motionTaken(motion);
+  CHECK(!backpressure.holdMotion());
+
+  // further motion is queued again
+  spnav.ProcessEvent(packet);
+  spnav.FlushMotion();
+  CHECK(queue.pop(event) && event.type == spacemouse::SPME_MOTION);
+}
+
+/*--------------------------------------------------------------------------*/
+/* SpaceMouseRcu                                                            */
+/*--------------------------------------------------------------------------*/
+/** Counts its destruction */
+struct Counted {
+  explicit Counted(int &destroyed) : destroyed(destroyed) {}
+  ~Counted() { ++destroyed; }
+  int &destroyed;
+};
+
+void checkRcuReadGuard() {
+  int destroyed = 0;
+  SpaceMouseRcu rcu;
+  {
+    SpaceMouseRcuPointer<Counted> pointer(rcu, new Counted(destroyed));
+    uint64_t laterEpoch;
+    {
+      // an object replaced while a reader may use it survives until the reader left
+      SpaceMouseRcu::ReadGuard reader(rcu);
+      const Counted *loaded = pointer.load();
+      pointer.store(new Counted(destroyed));
+      rcu.reclaim();
+      CHECK(destroyed == 0 && rcu.hasRetired());
+
+      // a reader entering after the replacement cannot see it and does not hold it back
+      laterEpoch = rcu.enter();
+      CHECK(pointer.load() != loaded);
+    }
+    rcu.reclaim();
+    CHECK(destroyed == 1 && !rcu.hasRetired());
+    rcu.leave(laterEpoch);
+  }
+  CHECK(destroyed == 2);
+}
+
+/*--------------------------------------------------------------------------*/
+/* Shared device state                                                      */
+/*--------------------------------------------------------------------------*/
+void checkSharedStateAtRest() {
+  char name[64];
+  std::snprintf(name, sizeof(name), "/check_spacemouse_%d", int(getpid()));
+  CheckSpnav spnav;
+  const spacemouse::SpaceMouseFilterStage deadzone = {spacemouse::SPMF_DEADZONE, {3.0, 1.0, 0.0}};
+  CHECK(spnav.setFilterChain(&deadzone, 1));
+  CHECK(spnav.publishState(name));
+  SpaceMouseSharedStateReader reader;
+  CHECK(reader.open(name));
+
+  // a deflection followed by noise the deadzone turns into a sample at rest
+  SpaceMouseSpnavPacket packet = motionPacket(100);
+  spnav.ProcessEvent(packet, 0);
+  SpaceMouseSharedStateSample sample;
+  CHECK(reader.read(0, sample) && sample.axes[0] != 0);
+  for (int i = 0; i < 6; ++i) packet.data[i] = 1;
+  spnav.ProcessEvent(packet, 0);
+  CHECK(reader.read(0, sample));
+  for (int i = 0; i < 6; ++i) CHECK(sample.axes[i] == 0);
+
+  spnav.publishState(nullptr);
+  shm_unlink(name);
+}
+
+const Check checks[] = {
+    {"spnav_whole_packets", checkSpnavWholePackets},
+    {"spnav_split_packet", checkSpnavSplitPacket},
+    {"spnav_hang_up", checkSpnavHangUp},
+    {"queue_overflow_merge", checkQueueOverflowMerge},
+    {"filter_deadzone_hysteresis", checkFilterDeadzoneHysteresis},
+    {"filter_smoothing_converges", checkFilterSmoothingConverges},
+    {"frame_sampler_wakeup", checkFrameSamplerWakeup},
+    {"merged_motion_overflow", checkMergedMotionOverflow},
+    {"rcu_read_guard", checkRcuReadGuard},
+    {"shared_state_at_rest", checkSharedStateAtRest},
+};
+}  // namespace
+
+int main(int argc, char **argv) {
+  const char *filter = nullptr;
+  int option;
+  while ((option = getopt(argc, argv, "f:h")) != -1) {
+    switch (option) {
+      case 'f':
+        filter = optarg;
+        break;
+      default:
+        std::fprintf(stderr, "Usage: %s [-f filter]\n", argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+
+  int failed = 0;
+  for (const Check &check : checks) {
+    if (filter != nullptr && std::string(check.name).find(filter) == std::string::npos)
+      continue;
+    std::printf("%-32s", check.name);
+    failures = 0;
+    check.run();
+    std::printf(failures == 0 ? "OK\n" : "\n");
+    if (failures != 0)
+      ++failed;
+  }
+  return failed == 0 ? 0 : 1;
+}
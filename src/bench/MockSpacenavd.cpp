@@ -0,0 +1,90 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+// Stand-in for spacenavd: plays a synthetic or scripted stream to every client that connects.
+//
+//   mock_spacenavd [-s socket] [-r rate] [-n count] [-b buttonEvery] [-f script] [-1]
+
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "SpaceMouseMockDaemon.hpp"
+
+static void usage(const char *name) {
+  std::fprintf(stderr,
+               "Usage: %s [-s socket] [-r rate] [-n count] [-b buttonEvery] [-f script] [-1]\n"
+               "  -s  socket path (default /tmp/spnav-mock.sock)\n"
+               "  -r  packets per second, 0 for as fast as possible (default 1000)\n"
+               "  -n  number of synthetic motion packets per client (default 10000)\n"
+               "  -b  press and release a button after every n-th motion packet (default 0)\n"
+               "  -f  play this script instead of the synthetic stream, see\n"
+               "      SpaceMouseMockDaemon::playScript()\n"
+               "  -1  exit after the first client\n",
+               name);
+}
+
+int main(int argc, char **argv) {
+  const char *socketPath = "/tmp/spnav-mock.sock";
+  const char *script = nullptr;
+  bool once = false;
+  spacemouse::SpaceMouseMockStream stream;
+
+  int option;
+  while ((option = getopt(argc, argv, "s:r:n:b:f:1h")) != -1) {
+    switch (option) {
+      case 's':
+        socketPath = optarg;
+        break;
+      case 'r':
+        stream.rate = std::atof(optarg);
+        break;
+      case 'n':
+        stream.motionCount = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'b':
+        stream.buttonEvery = std::strtoul(optarg, nullptr, 10);
+        break;
+      case 'f':
+        script = optarg;
+        break;
+      case '1':
+        once = true;
+        break;
+      default:
+        usage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+
+  // the default timer slack of 50 us would make kHz rates jittery
+  prctl(PR_SET_TIMERSLACK, 1UL);
+
+  spacemouse::SpaceMouseMockDaemon daemon;
+  if (!daemon.listen(socketPath)) {
+    std::perror("Could not listen on socket");
+    return 1;
+  }
+  std::printf("Listening on %s\n", socketPath);
+  std::fflush(stdout);
+
+  do {
+    if (!daemon.acceptClient()) {
+      std::perror("accept failed");
+      return 1;
+    }
+    std::printf("Client connected\n");
+    std::fflush(stdout);
+    if (script != nullptr) {
+      if (!daemon.playScript(script, stream.rate))
+        std::printf("Script aborted\n");
+    } else {
+      std::size_t sent = daemon.playSynthetic(stream, nullptr, nullptr);
+      std::printf("Sent %zu motion packets\n", sent);
+    }
+    std::fflush(stdout);
+  } while (!once);
+  return 0;
+}
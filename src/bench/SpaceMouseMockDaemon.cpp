@@ -0,0 +1,283 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#include "SpaceMouseMockDaemon.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "SpaceMouse.hpp"
+
+namespace spacemouse {
+
+namespace {
+/** Sleeps until the given monotonicTime() */
+void sleepUntil(int64_t time) {
+  timespec until;
+  until.tv_sec = static_cast<time_t>(time / 1000000000);
+  until.tv_nsec = static_cast<long>(time % 1000000000);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR) {
+  }
+}
+
+/** Time of the i-th packet of a stream starting at start */
+int64_t scheduledTime(int64_t start, double rate, std::size_t i) {
+  return rate > 0 ? start + static_cast<int64_t>(static_cast<double>(i) * 1e9 / rate) : 0;
+}
+
+/** Input event as written by the kernel */
+input_event inputEvent(const timeval &time, int type, int code, int value) {
+  input_event event;
+  std::memset(&event, 0, sizeof(event));
+#ifdef input_event_sec
+  event.input_event_sec = time.tv_sec;
+  event.input_event_usec = time.tv_usec;
+#else
+  event.time = time;
+#endif  // input_event_sec
+  event.type = static_cast<uint16_t>(type);
+  event.code = static_cast<uint16_t>(code);
+  event.value = value;
+  return event;
+}
+}  // namespace
+
+SpaceMouseMockDaemon::SpaceMouseMockDaemon() : mListenFd(-1), mClientFd(-1) { mPath[0] = '\0'; }
+
+SpaceMouseMockDaemon::~SpaceMouseMockDaemon() { close(); }
+
+bool SpaceMouseMockDaemon::listen(const char *path) {
+  close();
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(address.sun_path) || std::strlen(path) >= sizeof(mPath))
+    return false;
+  std::strcpy(address.sun_path, path);
+
+  unlink(path);
+  mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (mListenFd == -1)
+    return false;
+  if (bind(mListenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1 ||
+      ::listen(mListenFd, 1) == -1) {
+    ::close(mListenFd);
+    mListenFd = -1;
+    return false;
+  }
+  std::strcpy(mPath, path);
+  return true;
+}
+
+bool SpaceMouseMockDaemon::acceptClient() {
+  if (mClientFd != -1) {
+    ::close(mClientFd);
+    mClientFd = -1;
+  }
+  do {
+    mClientFd = accept(mListenFd, nullptr, nullptr);
+  } while (mClientFd == -1 && errno == EINTR);
+  return mClientFd != -1;
+}
+
+void SpaceMouseMockDaemon::close() {
+  if (mClientFd != -1) {
+    ::close(mClientFd);
+    mClientFd = -1;
+  }
+  if (mListenFd != -1) {
+    ::close(mListenFd);
+    mListenFd = -1;
+    unlink(mPath);
+  }
+  mPath[0] = '\0';
+}
+
+bool SpaceMouseMockDaemon::send(const SpaceMouseSpnavPacket &packet) {
+  return sendBytes(&packet, sizeof(packet));
+}
+
+bool SpaceMouseMockDaemon::sendBytes(const void *data, std::size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  std::size_t sent = 0;
+  while (sent < size) {
+    ssize_t n = ::send(mClientFd, bytes + sent, size - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    sent += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool SpaceMouseMockDaemon::sendMotion(const int axes[6], int period) {
+  SpaceMouseSpnavPacket packet;
+  packet.type = SPNAV_PACKET_MOTION;
+  for (int i = 0; i < 6; ++i) packet.data[i] = axes[i];
+  packet.data[6] = period;
+  return send(packet);
+}
+
+bool SpaceMouseMockDaemon::sendButton(int button, bool press) {
+  SpaceMouseSpnavPacket packet;
+  std::memset(&packet, 0, sizeof(packet));
+  packet.type = press ? SPNAV_PACKET_PRESS : SPNAV_PACKET_RELEASE;
+  packet.data[0] = button;
+  return send(packet);
+}
+
+bool SpaceMouseMockDaemon::relay(SpaceMouseEvdevClient &device) {
+  pollfd fds[1];
+  fds[0].fd = device.fd();
+  fds[0].events = POLLIN;
+  while (true) {
+    if (poll(fds, 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return true;
+    }
+    const SpaceMouseSpnavPacket *packets;
+    int count;
+    while ((count = device.receive(packets, SpaceMouseEvdevClient::kMaxEvents)) > 0) {
+      for (int i = 0; i < count; ++i)
+        if (!send(packets[i]))
+          return false;
+    }
+    if (count < 0)
+      return true;
+  }
+}
+
+std::size_t SpaceMouseMockSender::playSynthetic(const SpaceMouseMockStream &stream,
+                                                int64_t *motionSendTimes,
+                                                int64_t *buttonSendTimes) {
+  const int period = stream.rate > 0 ? static_cast<int>(1000.0 / stream.rate) : 0;
+  const int64_t start = monotonicTime();
+  std::size_t buttons = 0;
+  for (std::size_t i = 0; i < stream.motionCount; ++i) {
+    // absolute schedule, so that the rate does not drift with the time spent sending
+    if (stream.rate > 0)
+      sleepUntil(scheduledTime(start, stream.rate, i));
+    if (motionSendTimes != nullptr)
+      motionSendTimes[i] = monotonicTime();
+    if (!sendMotion(stream.axes, period))
+      return i;
+    if (stream.buttonEvery > 0 && (i + 1) % stream.buttonEvery == 0) {
+      if (buttonSendTimes != nullptr)
+        buttonSendTimes[buttons] = monotonicTime();
+      ++buttons;
+      if (!sendButton(stream.button, true) || !sendButton(stream.button, false))
+        return i + 1;
+    }
+  }
+  return stream.motionCount;
+}
+
+bool SpaceMouseMockSender::playScript(const char *path, double rate) {
+  FILE *file = std::fopen(path, "r");
+  if (file == nullptr)
+    return false;
+
+  const int period = rate > 0 ? static_cast<int>(1000.0 / rate) : 0;
+  int64_t next = monotonicTime();
+  bool ok = true;
+  char line[256];
+  while (ok && std::fgets(line, sizeof(line), file) != nullptr) {
+    int values[6];
+    long pause;
+    if (line[0] == '#' || line[0] == '\n' || line[0] == '\0') {
+      continue;
+    } else if (std::sscanf(line, "w %ld", &pause) == 1) {
+      next += static_cast<int64_t>(pause) * 1000;
+      continue;
+    }
+
+    sleepUntil(next);
+    if (std::sscanf(line, "m %d %d %d %d %d %d", &values[0], &values[1], &values[2], &values[3],
+                    &values[4], &values[5]) == 6) {
+      ok = sendMotion(values, period);
+    } else if (std::sscanf(line, "p %d", &values[0]) == 1) {
+      ok = sendButton(values[0], true);
+    } else if (std::sscanf(line, "r %d", &values[0]) == 1) {
+      ok = sendButton(values[0], false);
+    } else {
+      std::fprintf(stderr, "Ignoring invalid script line: %s", line);
+      continue;
+    }
+    if (rate > 0)
+      next += static_cast<int64_t>(1e9 / rate);
+  }
+  std::fclose(file);
+  return ok;
+}
+
+SpaceMouseMockDevice::SpaceMouseMockDevice() : mFd(-1) {}
+
+SpaceMouseMockDevice::~SpaceMouseMockDevice() { close(); }
+
+bool SpaceMouseMockDevice::open(const char *path) {
+  close();
+  do {
+    mFd = ::open(path, O_WRONLY | O_CLOEXEC);
+  } while (mFd == -1 && errno == EINTR);
+  return mFd != -1;
+}
+
+void SpaceMouseMockDevice::close() {
+  if (mFd != -1) {
+    ::close(mFd);
+    mFd = -1;
+  }
+}
+
+bool SpaceMouseMockDevice::write(const input_event *events, std::size_t count) {
+  const char *bytes = reinterpret_cast<const char *>(events);
+  const std::size_t size = count * sizeof(input_event);
+  std::size_t written = 0;
+  while (written < size) {
+    ssize_t n = ::write(mFd, bytes + written, size - written);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    written += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool SpaceMouseMockDevice::sendMotion(const int axes[6], int /*period*/) {
+  timeval now;
+  gettimeofday(&now, nullptr);
+  input_event events[7];
+  std::size_t count = 0;
+  for (int axis = 0; axis < 6; ++axis) {
+    // the kernel does not pass on relative events of value 0
+    if (axes[axis] != 0)
+      events[count++] = inputEvent(now, EV_REL, SpaceMouseEvdevClient::kAxisMap[axis],
+                                   SpaceMouseEvdevClient::kAxisSign[axis] * axes[axis]);
+  }
+  events[count++] = inputEvent(now, EV_SYN, SYN_REPORT, 0);
+  return write(events, count);
+}
+
+bool SpaceMouseMockDevice::sendButton(int button, bool press) {
+  timeval now;
+  gettimeofday(&now, nullptr);
+  input_event events[2] = {inputEvent(now, EV_KEY, BTN_0 + button, press ? 1 : 0),
+                           inputEvent(now, EV_SYN, SYN_REPORT, 0)};
+  return write(events, 2);
+}
+
+}  // namespace spacemouse
@@ -0,0 +1,154 @@
+// Copyright (c) 2020 FlyingSamson.
+// SpaceMouseTool is released under the terms of the AGPLv3 or higher.
+
+#ifndef SPACEMOUSEMOCKDAEMON_HPP
+#define SPACEMOUSEMOCKDAEMON_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "SpaceMouseEvdevClient.hpp"
+#include "SpaceMouseSpnavClient.hpp"
+
+namespace spacemouse {
+
+/*--------------------------------------------------------------------------*/
+/* Stand-in for spacenavd                                                   */
+/*--------------------------------------------------------------------------*/
+/** @brief Synthetic event stream played by SpaceMouseMockDaemon::playSynthetic() */
+struct SpaceMouseMockStream {
+  SpaceMouseMockStream()
+      : rate(1000.0), motionCount(10000), buttonEvery(0), button(0) {
+    axes[0] = 1;
+    axes[1] = axes[2] = 0;
+    axes[3] = 1;
+    axes[4] = 2;
+    axes[5] = 3;
+  }
+
+  /** Motion packets per second, 0 sends as fast as the socket takes them */
+  double rate;
+  /** Number of motion packets */
+  std::size_t motionCount;
+  /** A press and a release of button follow every buttonEvery-th motion packet, 0 for none */
+  std::size_t buttonEvery;
+  /** spacenavd number of the button pressed and released */
+  int button;
+  /** x, y, z, rx, ry, rz of every motion packet */
+  int axes[6];
+};
+
+/**
+ * @brief Plays synthetic or scripted event streams through sendMotion() and sendButton() of the
+ * derived class.
+ */
+class SpaceMouseMockSender {
+ public:
+  virtual ~SpaceMouseMockSender() {}
+
+  /** @brief Sends a motion event (axes as sent by spacenavd), false if the receiver is gone */
+  virtual bool sendMotion(const int axes[6], int period) = 0;
+  /** @brief Sends a button event, false if the receiver is gone */
+  virtual bool sendButton(int button, bool press) = 0;
+
+  /**
+   * @brief Plays a synthetic stream at a fixed rate
+   * @param stream           Stream to play
+   * @param motionSendTimes  If not null, gets the time (see monotonicTime()) right before each
+   *                         motion packet was sent, needs room for stream.motionCount entries
+   * @param buttonSendTimes  Same for the button press packets
+   * @return Number of motion packets sent
+   */
+  std::size_t playSynthetic(const SpaceMouseMockStream &stream, int64_t *motionSendTimes,
+                            int64_t *buttonSendTimes);
+
+  /**
+   * @brief Plays a script, one packet or pause per line:
+   *   m <x> <y> <z> <rx> <ry> <rz>   motion
+   *   p <button> / r <button>        button press / release
+   *   w <microseconds>               pause
+   * Empty lines and lines starting with # are ignored.
+   * @param rate Packets per second where the script does not pause, 0 for as fast as possible
+   * @return false if the script could not be read or the receiver is gone
+   */
+  bool playScript(const char *path, double rate);
+};
+
+/**
+ * @brief Listens on a UNIX socket like spacenavd does and sends scripted or synthetic packets to
+ * the client connecting to it (protocol 0, see SpaceMouseSpnavPacket).
+ *
+ * Packets are sent with blocking writes, so a client that does not keep up slows the stream
+ * down instead of losing packets, as with spacenavd.
+ */
+class SpaceMouseMockDaemon : public SpaceMouseMockSender {
+ public:
+  SpaceMouseMockDaemon();
+  ~SpaceMouseMockDaemon();
+
+  /**
+   * @brief Creates the listening socket, replacing a stale socket file at path
+   * @return false if the socket could not be created
+   */
+  bool listen(const char *path);
+  /** @brief Waits for a client to connect, dropping the previous one */
+  bool acceptClient();
+  /** @brief Disconnects the client and removes the listening socket */
+  void close();
+  /** Listening socket, -1 if not listening */
+  int listenFd() const { return mListenFd; }
+
+  /** @brief Sends a single packet, false if the client is gone */
+  bool send(const SpaceMouseSpnavPacket &packet);
+  /** @brief Sends raw bytes, e.g. part of a packet, false if the client is gone */
+  bool sendBytes(const void *data, std::size_t size);
+  bool sendMotion(const int axes[6], int period);
+  bool sendButton(int button, bool press);
+
+  /**
+   * @brief Forwards the packets read from an evdev node to the client, like spacenavd does
+   * @return false if the client is gone, true if the device was removed or the file ended
+   */
+  bool relay(SpaceMouseEvdevClient &device);
+
+ private:
+  int mListenFd;
+  int mClientFd;
+  char mPath[108];
+
+  SpaceMouseMockDaemon(const SpaceMouseMockDaemon &);             // not implemented
+  SpaceMouseMockDaemon &operator=(const SpaceMouseMockDaemon &);  // not implemented
+};
+
+/**
+ * @brief Stand-in for the kernel side of an evdev node: writes the input events a space mouse
+ * would generate into a file, usually a FIFO read by SpaceMouseEvdevClient.
+ *
+ * Motion is written as one report of EV_REL events closed by SYN_REPORT, with the axes converted
+ * back from the coordinate system of spacenavd, so that the client reproduces them.
+ */
+class SpaceMouseMockDevice : public SpaceMouseMockSender {
+ public:
+  SpaceMouseMockDevice();
+  ~SpaceMouseMockDevice();
+
+  /** @brief Opens the file for writing, blocks until a FIFO has a reader */
+  bool open(const char *path);
+  void close();
+
+  bool sendMotion(const int axes[6], int period);
+  bool sendButton(int button, bool press);
+
+ private:
+  /** @brief Writes the events, false if the reader is gone */
+  bool write(const input_event *events, std::size_t count);
+
+  int mFd;
+
+  SpaceMouseMockDevice(const SpaceMouseMockDevice &);             // not implemented
+  SpaceMouseMockDevice &operator=(const SpaceMouseMockDevice &);  // not implemented
+};
+
+}  // namespace spacemouse
+
+#endif  // SPACEMOUSEMOCKDAEMON_HPP
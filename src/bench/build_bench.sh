@@ -0,0 +1,52 @@
+#!/bin/bash
+# Builds the benchmarks and checks of the spacenavd backend (Linux only, no python needed):
+#   mock_spacenavd  stand-in for spacenavd playing synthetic or scripted streams
+#   bench_spacenav  end-to-end latency/throughput benchmark of SpaceMouseDaemon
+#   bench_hotpaths  microbenchmarks of the per-event code paths, including the python callbacks
+#                   if python3-config can embed the interpreter
+#   check_spacemouse  checks of the backend against the mock daemon, exits with 1 on failures
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-O2 -g"}
+BUILD_DIR=${BUILD_DIR:-build}
+
+SRC_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+BENCH_DIR="${SRC_DIR}/bench"
+FLAGS="-std=c++11 -Wall -pthread -DWITH_SPACEMOUSE -DWITH_LIBSPACENAV -DWITH_DAEMONSPACENAV"
+FLAGS+=" -I${SRC_DIR} -I${BENCH_DIR}"
+PYTHON_CONFIG=${PYTHON_CONFIG:-python3-config}
+
+mkdir -p "${BUILD_DIR}" || exit 1
+
+set -x
+${CXX} ${FLAGS} ${CXXFLAGS} -o "${BUILD_DIR}/mock_spacenavd" \
+    "${BENCH_DIR}/MockSpacenavd.cpp" "${BENCH_DIR}/SpaceMouseMockDaemon.cpp" \
+    "${SRC_DIR}/SpaceMouseEvdevClient.cpp" || exit 1
+${CXX} ${FLAGS} ${CXXFLAGS} -o "${BUILD_DIR}/bench_spacenav" \
+    "${BENCH_DIR}/BenchSpacenav.cpp" "${BENCH_DIR}/SpaceMouseMockDaemon.cpp" \
+    "${SRC_DIR}/SpaceMouse.cpp" "${SRC_DIR}/SpaceMouseFilter.cpp" \
+    "${SRC_DIR}/SpaceMouseFrameSampler.cpp" "${SRC_DIR}/SpaceMouseSpnavClient.cpp" \
+    "${SRC_DIR}/SpaceMouseEvdevClient.cpp" "${SRC_DIR}/SpaceMouseTrace.cpp" \
+    "${SRC_DIR}/SpaceMouseSharedState.cpp" -lrt || exit 1
+${CXX} ${FLAGS} ${CXXFLAGS} -o "${BUILD_DIR}/check_spacemouse" \
+    "${BENCH_DIR}/CheckSpaceMouse.cpp" "${BENCH_DIR}/SpaceMouseMockDaemon.cpp" \
+    "${SRC_DIR}/SpaceMouse.cpp" "${SRC_DIR}/SpaceMouseFilter.cpp" \
+    "${SRC_DIR}/SpaceMouseFrameSampler.cpp" "${SRC_DIR}/SpaceMouseSpnavClient.cpp" \
+    "${SRC_DIR}/SpaceMouseEvdevClient.cpp" "${SRC_DIR}/SpaceMouseTrace.cpp" \
+    "${SRC_DIR}/SpaceMouseSharedState.cpp" -lrt || exit 1
+
+if PYTHON_LDFLAGS=$(${PYTHON_CONFIG} --embed --ldflags 2>/dev/null); then
+  ${CXX} ${FLAGS} ${CXXFLAGS} -DWITH_PYTHON_BENCH $(${PYTHON_CONFIG} --includes) \
+      -o "${BUILD_DIR}/bench_hotpaths" "${BENCH_DIR}/BenchHotPaths.cpp" \
+      "${SRC_DIR}/PySpaceMouse.cpp" "${SRC_DIR}/SpaceMouse.cpp" "${SRC_DIR}/SpaceMouseCamera.cpp" \
+      "${SRC_DIR}/SpaceMouseFilter.cpp" "${SRC_DIR}/SpaceMouseFrameSampler.cpp" \
+      "${SRC_DIR}/SpaceMouseSpnavClient.cpp" "${SRC_DIR}/SpaceMouseEvdevClient.cpp" \
+      "${SRC_DIR}/SpaceMouseTrace.cpp" "${SRC_DIR}/SpaceMouseSharedState.cpp" \
+      ${PYTHON_LDFLAGS} -lrt || exit 1
+else
+  ${CXX} ${FLAGS} ${CXXFLAGS} -o "${BUILD_DIR}/bench_hotpaths" "${BENCH_DIR}/BenchHotPaths.cpp" \
+      "${SRC_DIR}/SpaceMouse.cpp" "${SRC_DIR}/SpaceMouseFilter.cpp" \
+      "${SRC_DIR}/SpaceMouseFrameSampler.cpp" "${SRC_DIR}/SpaceMouseSpnavClient.cpp" \
+      "${SRC_DIR}/SpaceMouseEvdevClient.cpp" "${SRC_DIR}/SpaceMouseTrace.cpp" \
+      "${SRC_DIR}/SpaceMouseSharedState.cpp" -lrt || exit 1
+fi
@@ -8,6 +8,8 @@ import platform
 os.environ['CC'] = 'g++'
 
 debug = True
+# collect the statistics returned by get_stats()
+stats = True
 
 undefList = []
 if debug:
@@ -16,9 +18,13 @@ if debug:
 spacemouse_link_args = []
 spacemouse_static_libs = []
 spacemouse_compiler_args = ['-std=c++11', '-DWITH_SPACEMOUSE']
+if stats:
+    spacemouse_compiler_args.append('-DWITH_SPACEMOUSE_STATS')
 spacemouse_include_args = ['.']
 spacemouse_libraries = []
 spacemouse_lib_dirs = []
+spacemouse_sources = ['PySpaceMouse.cpp', 'SpaceMouse.cpp', 'SpaceMouseCamera.cpp',
+                      'SpaceMouseFilter.cpp', 'SpaceMouseFrameSampler.cpp']
 extension_dir = ""
 
 libdir = os.path.join("..", "lib")
@@ -33,8 +39,11 @@ if system == "Darwin":
         libdir = os.path.join(libdir, "darwin_x86_64")
 elif system == "Linux":
     libdir = os.path.join(libdir, "linux")
-    spacemouse_static_libs = ['/usr/lib/libspnav.a']
     spacemouse_compiler_args.extend(['-DWITH_LIBSPACENAV', '-DWITH_DAEMONSPACENAV'])
+    spacemouse_sources.extend(['SpaceMouseSpnavClient.cpp', 'SpaceMouseEvdevClient.cpp',
+                               'SpaceMouseTrace.cpp', 'SpaceMouseSharedState.cpp'])
+    # shm_open() lives in librt before glibc 2.34
+    spacemouse_libraries.extend(['rt'])
 elif system == "Windows":
     libdir = os.path.join(libdir, "windows")
     spacemouse_compiler_args.extend(['-DWITH_LIB3DX_WIN'])
@@ -46,8 +55,7 @@ elif system == "Windows":
 module = Extension('pyspacemouse',
                    language='c++',
                    extra_compile_args=spacemouse_compiler_args,
-                   sources=['PySpaceMouse.cpp',
-                            'SpaceMouse.cpp'],
+                   sources=spacemouse_sources,
                    include_dirs=spacemouse_include_args,
                    extra_link_args=spacemouse_link_args,
                    extra_objects=spacemouse_static_libs,